@@ -1,42 +1,216 @@
+// Extensões do Linux (afinidade de threads, ver DEPARTAMENTOS)
+#ifdef __linux__
+    #define _GNU_SOURCE
+#endif
+
 // Bibliotecas padrão do C
 #include <stdlib.h>  // Alocação de memória (malloc, free)
 #include <stdio.h>   // Entrada/saída padrão (printf, scanf)
 #include <string.h>  // Manipulação de strings (strlen, strcpy)
 #include <limits.h>  // Limites de valores inteiros
 #include <locale.h>  // Configuração de localização (suporte a português)
+#include <stdint.h>  // Inteiros de tamanho fixo (uint32_t)
+#include <fcntl.h>   // Abertura de arquivos de baixo nível (open)
+#include <time.h>    // Medição de tempo (clock)
+#include <pthread.h> // Threads e travas (fila concorrente)
+#include <stdatomic.h> // Contadores atômicos
+#include <stdarg.h>  // va_list (saída formatada)
+
+#ifdef _WIN32
+    #include <io.h>  // open, write, close no Windows
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>  // SetConsoleMode e SetConsoleOutputCP (console)
+    #ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+        #define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004  // Ausente em SDKs antigos
+    #endif
+    #define fsync _commit
+    #define ftruncate _chsize
+#else
+    #include <unistd.h>    // write, fsync, ftruncate, close
+    #include <sys/mman.h>  // mmap (arquivo do histórico)
+    #include <sys/stat.h>  // fstat
+    #include <sys/resource.h> // getrusage (pico de memória)
+    #include <sched.h>     // sched_yield, afinidade de threads
+#endif
+
+#ifdef __linux__
+    #include <errno.h>        // errno (EAGAIN, EINTR)
+    #include <signal.h>       // sigaction (encerrar o servidor)
+    #include <poll.h>         // poll (cliente)
+    #include <netdb.h>        // getaddrinfo
+    #include <netinet/in.h>   // IPPROTO_TCP
+    #include <netinet/tcp.h>  // TCP_NODELAY
+    #include <sys/epoll.h>    // epoll (servidor)
+    #include <sys/socket.h>   // socket, bind, listen, accept
+    #include <sys/un.h>       // Sockets Unix
+#endif
+
+#ifndef O_BINARY
+    #define O_BINARY 0  // Só existe (e só é necessário) no Windows
+#endif
+
+// Escala de prioridades, escolhida na compilação
+// Cada X(constante, rótulo, chegadas por hora, minutos de atendimento) é um
+// nível, do mais urgente ao menos urgente; os dois últimos campos são os
+// padrões da simulação. A escala padrão tem três níveis; com
+// -DESCALA_MANCHESTER valem os cinco níveis da triagem de Manchester, e
+// qualquer outra escala pode ser passada com -D'PRIORIDADES(X)=...'
+#if defined(ESCALA_MANCHESTER)
+    #define PRIORIDADES(X) \
+        X(EMERGENTE,     "Emergente",     0.5, 60) /* Vermelho - atendimento imediato */ \
+        X(MUITO_URGENTE, "Muito urgente", 2,   40) /* Laranja */ \
+        X(URGENTE,       "Urgente",       4,   25) /* Amarelo */ \
+        X(POUCO_URGENTE, "Pouco urgente", 7,   15) /* Verde */ \
+        X(NAO_URGENTE,   "Não urgente",   3,   10) /* Azul */
+#elif !defined(PRIORIDADES)
+    #define PRIORIDADES(X) \
+        X(EMERGENCIA, "Emergência", 1.5, 45) /* Máxima prioridade - atendimento imediato */ \
+        X(URGENCIA,   "Urgência",   5,   25) /* Prioridade média */ \
+        X(NORMAL,     "Normal",     10,  15) /* Mínima prioridade */
+#endif
 
 // Constantes de prioridade: quanto menor o número, maior a prioridade
-#define EMERGENCIA 1  // Máxima prioridade - atendimento imediato
-#define URGENCIA   2  // Prioridade média
-#define NORMAL     3  // Mínima prioridade
+// (a primeira da escala vale 1, a segunda 2 e assim por diante)
+#define PRIORIDADE_ENUM(nome, rotulo, chegadas, minutos) nome,
+enum { PRIORIDADE_ANTERIOR_A_ESCALA, PRIORIDADES(PRIORIDADE_ENUM) PRIORIDADE_POSTERIOR_A_ESCALA };
+#define PRIORIDADE_MAXIMA 1                                    // Primeira da escala
+#define PRIORIDADE_MINIMA (PRIORIDADE_POSTERIOR_A_ESCALA - 1) // Última da escala
 
-#define IDADE_MIN 1            // Idade mínima permitida
-#define IDADE_MAX 150          // Idade máxima permitida
+#ifndef IDADE_MIN
+    #define IDADE_MIN 1        // Idade mínima permitida
+#endif
+#ifndef IDADE_MAX
+    #define IDADE_MAX 150      // Idade máxima permitida
+#endif
 #define ID_MIN 1               // ID mínimo válido
 #define PRIORIDADE_INVALIDA -1 // Valor sentinel para paciente inválido
 
+// Referência para um nome guardado no armazém de nomes (ver ArmazemNomes)
+// Os 16 bits altos indicam o bloco e os 16 bits baixos a posição no bloco
+// A referência 0 é sempre o nome vazio ""
+typedef uint32_t NomeRef;
+
 // Estrutura de dados para armazenar informações de um paciente
 // Esta é a estrutura fundamental do sistema
+// Registro compacto (12 bytes): o nome não fica embutido no paciente,
+// apenas uma referência para o armazém de nomes, então copiar um paciente
+// entre fila, pilha e busca custa o mesmo que copiar um ponteiro
 typedef struct {
-    int id;              // Identificador único do paciente
-    char nome[100];      // Nome
-    int idade;           // Idade em anos
-    int prioridade;      // 1=Emergência, 2=Urgência, 3=Normal (quanto menor o número, maior a prioridade)
+    int32_t id;          // Identificador único do paciente
+    NomeRef nome;        // Nome (referência para o armazém de nomes)
+    uint16_t idade;      // Idade em anos
+    int8_t prioridade;   // 1..PRIORIDADE_MINIMA (quanto menor o número, maior a prioridade)
+    uint8_t reservado;   // Preenchimento (mantém o registro alinhado)
 } Paciente;
 
+// Tamanho de cada bloco do armazém de nomes (limite do deslocamento de 16 bits)
+#define TAM_BLOCO_NOMES 65536
+// Quantidade máxima de blocos (limite dos 16 bits altos da referência)
+#define MAX_BLOCOS_NOMES 65536
+// Valor devolvido por internarNome quando falta memória
+#define NOME_FALHA UINT32_MAX
+
+// Armazém de nomes: área de memória somente-anexação
+// Cada nome é gravado uma única vez (nomes repetidos reaproveitam a mesma
+// referência) e nunca é movido, então as referências continuam válidas
+// durante toda a execução. Nomes maiores que um bloco ganham um bloco só
+// para eles, por isso não há limite de tamanho nem truncamento.
+typedef struct {
+    char** blocos;         // Tabela de blocos (alocada no primeiro uso)
+    uint32_t numBlocos;    // Blocos em uso
+    uint32_t usadoNoAtual; // Bytes ocupados do último bloco
+    NomeRef* tabela;       // Hash dos nomes já gravados (0 = posição livre)
+    uint32_t capTabela;    // Capacidade da tabela hash (potência de 2)
+    uint32_t qtdTabela;    // Nomes distintos gravados
+    size_t bytes;          // Total de bytes de nomes gravados
+} ArmazemNomes;
+
+// Armazém global de nomes do sistema
+ArmazemNomes armazemNomes = {NULL, 0, 0, NULL, 0, 0, 0};
+
+// Trava das gravações no armazém de nomes (a leitura não precisa de trava,
+// pois os blocos nunca mudam de lugar)
+pthread_mutex_t travaNomes = PTHREAD_MUTEX_INITIALIZER;
+
+// Entrada do índice de IDs: associa o ID de um paciente ao nó que o guarda
+// id == 0 marca uma posição livre (IDs válidos começam em ID_MIN)
+typedef struct {
+    int id;      // ID do paciente
+    void* no;    // Nó da fila (No*) ou da pilha (NoPilha*) com o paciente
+} EntradaIndice;
+
+// Índice hash de IDs com endereçamento aberto (sondagem linear)
+// Busca, inserção e remoção em O(1) médio, sem percorrer listas
+typedef struct {
+    EntradaIndice* entradas;  // Vetor de posições (NULL até o primeiro uso)
+    uint32_t capacidade;      // Sempre potência de 2
+    uint32_t quantidade;      // Posições ocupadas
+    int bits;                 // log2(capacidade), usado no hash
+} IndiceID;
+
+// Quantidade de níveis de prioridade atendidos pelo sistema
+#define NUM_PRIORIDADES (PRIORIDADE_MINIMA - PRIORIDADE_MAXIMA + 1)
+
+// Limites da escala: o nível do nó tem 4 bits, o mapa de baldes ocupados da
+// fila tem 32 e a idade é gravada em 16 bits nos registros e arquivos
+_Static_assert(NUM_PRIORIDADES >= 2 && NUM_PRIORIDADES <= 16, "a escala deve ter de 2 a 16 prioridades");
+_Static_assert(IDADE_MIN >= 0 && IDADE_MIN <= IDADE_MAX && IDADE_MAX <= UINT16_MAX, "faixa de idade inválida");
+
 // Nó da lista encadeada - cada nó contém um paciente e aponta para o próximo
+// e para o anterior, para que um paciente possa sair do meio do balde em O(1)
 // Implementa a fila de espera de pacientes
 typedef struct No {
     Paciente dados;      // Dados do paciente armazenado neste nó
+    uint32_t chegada;    // Entrada na fila (relogioMs), para o tempo de espera
+    uint32_t entradaNivel; // Entrada no balde atual (relogioMs), para o envelhecimento
+    uint32_t nivel : 4;  // Balde em que o nó está (0 = prioridade máxima)
+    uint32_t ordem : 28; // Número do nó na ordem do balde (ver posicaoNaFila)
     struct No* prox;     // Ponteiro para o próximo nó (NULL se for o último)
+    struct No* ant;      // Ponteiro para o nó anterior (NULL se for o primeiro)
 } No;
 
-// Fila de atendimento - estrutura que gerencia a lista encadeada
-// Mantém ponteiros para início e fim para operações eficientes
-// (inserção no final em O(1), remoção do início em O(1))
+// Balde de um único nível de prioridade - lista encadeada FIFO
+// Todos os pacientes do balde têm a mesma prioridade, então basta
+// manter a ordem de chegada (inserção no fim, remoção do início)
+typedef struct {
+    No* inicio;      // Paciente mais antigo deste nível
+    No* fim;         // Paciente mais recente deste nível
+    int quantidade;  // Pacientes esperando neste nível
+    int32_t* arvore;          // Árvore de Fenwick das ordens dos nós (ver posicaoNaFila)
+    struct No** porOrdem;     // Nó de cada ordem em uso (ver anteriorPorPosicao)
+    uint32_t capArvore;       // Ordens cobertas pela árvore
+    uint32_t primeiraOrdem;   // Ordem do primeiro nó do balde
+    uint32_t proximaOrdem;    // Ordem do próximo nó que entrar no fim
+} Balde;
+
+// Pool de nós compartilhado pela fila e pela pilha (definido mais abaixo)
+typedef struct PoolNos PoolNos;
+
+// Diário de alterações (write-ahead log) da fila e da pilha (definido mais abaixo)
+typedef struct DiarioWAL DiarioWAL;
+
+// Índice de busca por nome da fila e do histórico (definido mais abaixo)
+typedef struct IndiceNomes IndiceNomes;
+
+// Fila de atendimento - fila de PRIORIDADE com um balde FIFO por nível
+// baldes[0] = prioridade máxima, ..., baldes[NUM_PRIORIDADES - 1] = mínima
+// Inserção no fim do balde em O(1) e remoção do primeiro balde não vazio
+// em O(1): o mapa 'ocupados' tem um bit por balde com pacientes, e o
+// primeiro balde não vazio é o bit ligado mais baixo (uma instrução)
 typedef struct {
-    No* inicio;  // Ponteiro para o primeiro paciente a atender (cabeça da lista)
-    No* fim;     // Ponteiro para o último paciente inserido (cauda da lista)
+    Balde baldes[NUM_PRIORIDADES];  // Um balde por nível de prioridade
+    uint32_t ocupados;              // Bit i ligado = baldes[i] tem pacientes
+    int tamanho;                    // Total de pacientes em espera
+    IndiceID indice;                // ID -> nó, para busca em O(1)
+    PoolNos* pool;                  // De onde saem os nós da fila
+    DiarioWAL* diario;              // Onde as alterações são registradas (NULL = sem registro)
+    uint32_t ultimaEspera;          // Espera (ms) do último paciente removido
+    uint32_t ultimaChegada;         // Chegada e entrada no nível do último removido,
+    uint32_t ultimaEntradaNivel;    //   para devolvê-lo ao mesmo lugar (desfazer)
+    uint32_t ultimaPosicaoNivel;    // Quantos estavam à frente dele no balde
+    int ultimoNivel;                // Balde de onde saiu o último removido
+    uint32_t envelhecimentoMs;      // Espera que sobe um nível de prioridade (0 = desligado)
+    IndiceNomes* nomes;             // Busca por nome (NULL = sem índice)
 } Fila;
 
 // Nó da pilha - estrutura idêntica ao nó da fila, mas usada para histórico
@@ -44,24 +218,278 @@ typedef struct {
 typedef struct NoPilha {
     Paciente dados;       // Dados do paciente atendido
     struct NoPilha* prox; // Ponteiro para o próximo nó na pilha (próximo histórico)
+    struct NoPilha* ant;  // Ponteiro para o nó mais recente (NULL no topo)
 } NoPilha;
 
+// Arquivo em disco com os atendimentos mais antigos (definido mais abaixo)
+typedef struct ArquivoHistorico ArquivoHistorico;
+
 // Pilha - estrutura que armazena o histórico de atendimentos
 // Permite desfazer o último atendimento (operação pop)
+// Com um arquivo de histórico ligado, só os 'limiteQuentes' atendimentos
+// mais recentes ficam em memória; os mais antigos descem para o arquivo
 typedef struct {
     NoPilha* topo;  // Ponteiro para o topo da pilha (último atendimento)
+    NoPilha* base;  // Atendimento mais antigo ainda em memória
+    size_t quentes; // Atendimentos em memória
+    size_t limiteQuentes;        // Máximo em memória quando há arquivo
+    ArquivoHistorico* arquivo;   // Atendimentos antigos (NULL = tudo em memória)
+    IndiceID indice; // ID -> nó, para busca no histórico em O(1)
+    PoolNos* pool;   // De onde saem os nós da pilha
+    DiarioWAL* diario; // Onde as alterações são registradas (NULL = sem registro)
+    IndiceNomes* nomes; // Busca por nome (NULL = sem índice)
 } Pilha;
 
-// Array estático global para manter contadores do sistema
-// Índices: [0]=Total cadastrados, [1]=Total atendidos, [2]=Total desfeitos
-int estatisticas[3] = {0, 0, 0};
+// Atendimentos mantidos em memória quando o histórico tem arquivo
+#define LIMITE_HISTORICO_QUENTE 1024
+
+// Registro de tamanho fixo do arquivo de histórico (24 bytes)
+// O nome fica no arquivo de nomes, a partir de 'posNome' (terminado em \0)
+typedef struct {
+    int32_t id;
+    uint16_t idade;
+    int8_t prioridade;
+    uint8_t reservado;
+    uint32_t tamNome;
+    uint32_t reservado2;
+    uint64_t posNome;
+} RegistroHistorico;
+
+// Arquivo do histórico: dois arquivos somente-anexação mapeados em memória
+//   <prefixo>.hist  - cabeçalho + vetor de RegistroHistorico (do mais antigo
+//                     para o mais recente)
+//   <prefixo>.nomes - cabeçalho + nomes terminados em \0
+// O acesso é feito pelo mmap: o sistema operacional carrega só as páginas
+// consultadas, então o histórico pode crescer sem ocupar memória
+struct ArquivoHistorico {
+    int fdRegistros;
+    int fdNomes;
+    unsigned char* mapaRegistros;  // Mapeamento do .hist
+    unsigned char* mapaNomes;      // Mapeamento do .nomes
+    size_t tamMapaRegistros;       // Bytes mapeados do .hist
+    size_t tamMapaNomes;           // Bytes mapeados do .nomes
+    uint64_t quantidade;           // Registros válidos
+    uint64_t usadoNomes;           // Bytes válidos no .nomes (sem cabeçalho)
+    uint64_t protegidos;           // Registros que o último snapshot espera encontrar:
+    uint64_t nomesProtegidos;      //   não são sobrescritos nem saem do cabeçalho até o próximo
+};
+
+// Índice de nomes: índice invertido de trigramas sobre os nomes
+// normalizados (minúsculas, sem acentos, espaços simples, com um espaço no
+// início para marcar o começo das palavras: "José  da Silva" -> " jose da silva").
+// Cada nome normalizado distinto ganha um número (nid); os trigramas
+// apontam para nids e cada nid tem a lista dos IDs com aquele nome.
+// O mesmo índice é compartilhado pela fila e pelo histórico.
+#define CODIGOS_TRIGRAMA 37  // Espaço, a-z e 0-9
+#define NUM_TRIGRAMAS (CODIGOS_TRIGRAMA * CODIGOS_TRIGRAMA * CODIGOS_TRIGRAMA)
+
+// Vetor dinâmico de nids
+typedef struct {
+    uint32_t* itens;
+    uint32_t quantidade;
+    uint32_t capacidade;
+} ListaNids;
+
+// Paciente ligado a um nome (lista encadeada dentro de um vetor)
+typedef struct {
+    int id;
+    uint32_t prox;  // Posição + 1 do próximo paciente com o mesmo nome (0 = fim)
+} PacienteNome;
+
+struct IndiceNomes {
+    // Nomes normalizados distintos, indexados por nid
+    uint32_t* inicioTexto;       // nid -> posição do texto em 'textos'
+    uint32_t* primeiroPaciente;  // nid -> posição + 1 em 'pacientes' (0 = nenhum)
+    uint32_t* marca;             // Usado pela busca para não repetir candidatos
+    uint32_t numNomes;
+    uint32_t capNomes;
+    char* textos;                // Textos normalizados terminados em \0
+    size_t usadoTextos;
+    size_t capTextos;
+    uint32_t* tabela;            // Hash do texto -> nid + 1 (0 = vazio)
+    uint32_t capTabela;
+    PacienteNome* pacientes;
+    uint32_t numPacientes;
+    uint32_t capPacientes;
+    IndiceID ids;                // ID -> nid + 1, para não indexar o mesmo paciente duas vezes
+    uint32_t geracaoBusca;       // Valor atual de 'marca'
+    ListaNids trigramas[NUM_TRIGRAMAS];  // Trigrama -> nids que o contêm
+};
+
+// Quantidade de nós reservados de uma vez em cada slab do pool
+#define BLOCOS_POR_SLAB 512
+
+// Bloco do pool: tem o tamanho do maior nó (No ou NoPilha)
+// Enquanto está livre, o próprio bloco guarda o ponteiro da lista de livres
+typedef union BlocoPool {
+    No no;
+    NoPilha noPilha;
+    union BlocoPool* proxLivre;  // Próximo bloco livre (só quando livre)
+} BlocoPool;
+
+// Slab - um pedaço contínuo de memória com BLOCOS_POR_SLAB nós
+typedef struct Slab {
+    struct Slab* prox;                  // Próximo slab do pool
+    BlocoPool blocos[BLOCOS_POR_SLAB];  // Nós reservados
+} Slab;
+
+// Pool de nós: evita um malloc/free por paciente
+// Nós devolvidos vão para uma lista de livres e são reaproveitados;
+// quando ela acaba, os nós saem do slab mais recente, e só quando este
+// enche é que um novo slab é alocado
+struct PoolNos {
+    BlocoPool* livres;     // Lista de blocos devolvidos
+    Slab* slabs;           // Lista de slabs alocados (o primeiro é o atual)
+    size_t usadosNoAtual;  // Blocos já entregues do slab atual
+    size_t vivos;          // Nós em uso no momento
+    size_t pico;           // Maior quantidade de nós em uso ao mesmo tempo
+    size_t numSlabs;       // Quantidade de slabs alocados
+    int usuarios;          // Filas/pilhas ligadas ao pool
+};
+
+// Pool padrão do sistema, usado pela fila e pelo histórico do menu
+PoolNos poolNos = {NULL, NULL, BLOCOS_POR_SLAB, 0, 0, 0, 0};
+
+// Histograma de latências log-linear (no estilo HDR): valores abaixo de
+// 64 ns têm balde exato; acima disso cada potência de 2 é dividida em 32
+// baldes, então o erro relativo de qualquer percentil fica abaixo de ~3%
+// usando só alguns KB, qualquer que seja a quantidade de amostras.
+// Os campos são atômicos: várias threads registram sem trava.
+#define BALDES_EXATOS_LATENCIA 64
+#define SUBBALDES_LATENCIA 32
+#define NUM_BALDES_LATENCIA (BALDES_EXATOS_LATENCIA + 58 * SUBBALDES_LATENCIA)
+
+typedef struct {
+    _Atomic uint64_t contagem[NUM_BALDES_LATENCIA];
+    _Atomic uint64_t total;   // Quantidade de amostras
+    _Atomic uint64_t soma;    // Soma das amostras (para a média)
+    _Atomic uint64_t maximo;  // Maior amostra
+} HistogramaLatencia;
+
+// Contadores do sistema (os índices também são usados pelo diário)
+enum {
+    CONTADOR_CADASTRADOS,  // Total de pacientes cadastrados
+    CONTADOR_ATENDIDOS,    // Total de pacientes atendidos
+    CONTADOR_DESFEITOS,    // Total de cadastros e atendimentos desfeitos
+    NUM_CONTADORES
+};
+
+// Operações medidas na camada de comandos (menu, lote e fila concorrente)
+enum {
+    OPERACAO_INSERIR,
+    OPERACAO_ATENDER,
+    OPERACAO_DESFAZER,
+    OPERACAO_BUSCAR,
+    OPERACAO_REFAZER,
+    OPERACAO_POSICAO,
+    OPERACAO_PRIORIDADE,
+    OPERACAO_DESISTENCIA,
+    NUM_OPERACOES
+};
+
+// Métricas do sistema
+// Tudo é atômico: várias mesas e médicos podem alterá-las ao mesmo tempo
+// (ver FILA CONCORRENTE). As profundidades por prioridade não ficam aqui:
+// são lidas direto dos baldes da fila quando as métricas são exibidas.
+typedef struct {
+    _Atomic int contadores[NUM_CONTADORES];
+    _Atomic uint64_t realizadas[NUM_OPERACOES];  // Operações que tiveram efeito
+    _Atomic uint64_t recusadas[NUM_OPERACOES];   // Fila vazia, ID repetido, não encontrado...
+    HistogramaLatencia latencias[NUM_OPERACOES]; // Duração de cada operação (ns)
+    HistogramaLatencia espera[NUM_PRIORIDADES];  // Tempo na fila dos atendidos (ns), por triagem
+    HistogramaLatencia resposta;                 // Tempo de resposta do console a cada linha (ns)
+} Metricas;
+
+Metricas metricas;
+
+// Quando diferente de 0, as operações da fila e da pilha não imprimem
+// mensagens de sucesso (usado no modo em lote, que só mostra o resumo)
+int saidaSilenciosa = 0;
+
+// Quando diferente de 0, o console não mostra as mensagens de abertura e
+// de encerramento (--quiet); as operações continuam respondendo normalmente
+int semBanners = 0;
+
+// Ações que podem ser desfeitas e refeitas
+enum {
+    ACAO_CADASTRO,     // registrarPaciente
+    ACAO_ATENDIMENTO,  // atenderPaciente
+    ACAO_PRIORIDADE,   // retriarPaciente
+    ACAO_DESISTENCIA   // registrarDesistencia
+};
+
+// Uma ação do histórico de comandos, com o que é preciso para revertê-la
+// e repeti-la (no atendimento, na retriagem e na desistência, o lugar de
+// onde o paciente saiu do balde; 'paciente' guarda a prioridade antiga)
+typedef struct {
+    Paciente paciente;
+    uint32_t chegada;       // Chegada na fila do paciente
+    uint32_t entradaNivel;  // Entrada no balde de onde ele saiu
+    uint32_t posicaoNivel;  // Quantos estavam à frente dele nesse balde
+    int8_t tipo;            // ACAO_CADASTRO, ACAO_ATENDIMENTO...
+    int8_t nivel;           // Balde de onde ele saiu
+    int8_t prioridade;      // Nova prioridade (retriagem)
+} AcaoComando;
+
+// Histórico de comandos para desfazer/refazer: um anel de tamanho fixo
+// As ações [inicio, inicio + desfaziveis) podem ser desfeitas (a última é a
+// mais recente) e as 'refaziveis' seguintes podem ser refeitas. Uma ação
+// nova descarta as refazíveis e, com o anel cheio, a mais antiga.
+typedef struct {
+    AcaoComando* acoes;
+    size_t capacidade;   // Profundidade máxima (0 = desligado)
+    size_t inicio;       // Posição da ação mais antiga
+    size_t desfaziveis;
+    size_t refaziveis;
+} HistoricoComandos;
+
+// Profundidade padrão do desfazer/refazer
+#define PROFUNDIDADE_DESFAZER 100
+
+HistoricoComandos comandos;
+
+// Tamanho do buffer de escrita do diário
+#define TAM_BUFFER_DIARIO (64 * 1024)
+// Maior caminho de arquivo aceito para o diário e o snapshot
+#define TAM_CAMINHO 512
+
+// Tipos de registro do diário: um para cada alteração da fila, da pilha
+// e dos contadores do sistema
+#define REG_INSERIR   1  // inserirFila(paciente)
+#define REG_REMOVER   2  // removerFila()
+#define REG_PUSH      3  // push(paciente)
+#define REG_POP       4  // pop()
+#define REG_CONTADOR  5  // metricas.contadores[indice] += delta
+#define REG_PROMOVER  6  // Primeiro do balde origem vai para o fim do balde destino
+#define REG_REINSERIR 7  // reinserirFila(paciente, nivel): volta ao início do balde
+#define REG_RETIRAR   8  // retirarFila(id): sai de qualquer posição da fila
+#define REG_PRIORIDADE 9 // Paciente id passa à prioridade p, na posição pos do balde nivel
+
+// Diário de alterações (write-ahead log)
+// Cada alteração é anexada ao buffer e escrita no arquivo .wal; o fsync é
+// feito em grupo, a cada 'loteSync' registros (group commit). A cada
+// 'intervaloSnapshot' registros o estado completo é gravado no arquivo
+// .snap e o diário recomeça vazio com a geração seguinte.
+struct DiarioWAL {
+    int fd;                                 // Arquivo .wal aberto para anexação
+    char caminhoWal[TAM_CAMINHO];           // <prefixo>.wal
+    char caminhoSnap[TAM_CAMINHO];          // <prefixo>.snap
+    unsigned char buffer[TAM_BUFFER_DIARIO];// Registros ainda não escritos
+    size_t usado;                           // Bytes ocupados no buffer
+    uint64_t geracao;                       // Geração do arquivo .wal atual
+    size_t pendentesSync;                   // Registros escritos sem fsync
+    size_t registrosDesdeSnapshot;          // Registros desde o último snapshot
+    size_t loteSync;                        // fsync a cada N registros
+    size_t intervaloSnapshot;               // Snapshot a cada N registros
+    int falhou;                             // 1 se alguma escrita falhou
+};
 
 // ============= FUNÇÕES DE VALIDAÇÃO =============
 // Validam os dados de entrada do usuário para garantir o correto funcionamento
 
-// Verifica se a prioridade é válida (entre 1 e 3)
+// Verifica se a prioridade é válida (entre 1 e PRIORIDADE_MINIMA)
 int validarPrioridade(int prioridade) {
-    return (prioridade >= EMERGENCIA && prioridade <= NORMAL);
+    return (prioridade >= PRIORIDADE_MAXIMA && prioridade <= PRIORIDADE_MINIMA);
 }
 
 // Verifica se a idade está dentro do intervalo aceitável
@@ -74,442 +502,7770 @@ int validarID(int id) {
     return (id >= ID_MIN);
 }
 
+// Rótulos da escala, na ordem das prioridades
+#define PRIORIDADE_ROTULO(nome, rotulo, chegadas, minutos) rotulo,
+static const char* const ROTULOS_PRIORIDADE[NUM_PRIORIDADES] = { PRIORIDADES(PRIORIDADE_ROTULO) };
+
 // Função utilitária: converte número de prioridade em texto legível
-// Exemplo: 1 retorna "Emergência"
+// Exemplo: 1 retorna "Emergência" (na escala padrão)
 const char* obterNomePrioridade(int prioridade) {
-    switch (prioridade) {
-        case EMERGENCIA: return "Emergência";
-        case URGENCIA:   return "Urgência";
-        case NORMAL:     return "Normal";
-        default:         return "Desconhecida";
+    if (!validarPrioridade(prioridade)) return "Desconhecida";
+    return ROTULOS_PRIORIDADE[prioridade - PRIORIDADE_MAXIMA];
+}
+
+// Caracteres (e não bytes) de um texto UTF-8, para alinhar colunas
+int caracteresUTF8(const char* texto) {
+    int caracteres = 0;
+    for (; *texto != '\0'; texto++) {
+        if (((unsigned char) *texto & 0xC0) != 0x80) caracteres++;  // Não é byte de continuação
+    }
+    return caracteres;
+}
+
+// Largura em bytes que o printf precisa para ocupar 'largura' caracteres
+// com o texto (os acentos ocupam dois bytes em UTF-8)
+int larguraEmBytes(const char* texto, int largura) {
+    return largura + (int) strlen(texto) - caracteresUTF8(texto);
+}
+
+// Largura de uma coluna com os rótulos da escala nos relatórios
+// (o maior rótulo, mas nunca menos que 'minimo')
+int larguraRotulosPrioridade(int minimo) {
+    int largura = minimo;
+    for (int i = 0; i < NUM_PRIORIDADES; i++) {
+        int tamanho = caracteresUTF8(ROTULOS_PRIORIDADE[i]);
+        if (tamanho > largura) largura = tamanho;
+    }
+    return largura;
+}
+
+// Imprime as opções da escala para o usuário escolher uma prioridade
+// Exemplo: "(1-Emergência, 2-Urgência, 3-Normal)"
+void imprimirOpcoesPrioridade(void) {
+    for (int p = PRIORIDADE_MAXIMA; p <= PRIORIDADE_MINIMA; p++)
+        printf("%s%d-%s", p == PRIORIDADE_MAXIMA ? "(" : ", ", p, obterNomePrioridade(p));
+    printf(")");
+}
+
+// ============= ÍNDICE HASH DE IDs =============
+// Tabela com endereçamento aberto: cada ID ocupa a primeira posição livre
+// a partir do seu hash. A fila e a pilha mantêm cada uma o seu índice,
+// atualizado a cada inserção e remoção de nó.
+
+// Inicializa um índice vazio (a tabela só é alocada no primeiro uso)
+void inicializaIndice(IndiceID* indice) {
+    indice->entradas = NULL;
+    indice->capacidade = 0;
+    indice->quantidade = 0;
+    indice->bits = 0;
+}
+
+// Hash multiplicativo (Fibonacci): espalha IDs sequenciais pela tabela
+static uint32_t hashID(const IndiceID* indice, int id) {
+    return ((uint32_t) id * 2654435769u) >> (32 - indice->bits);
+}
+
+// Libera a tabela do índice
+void destruirIndice(IndiceID* indice) {
+    free(indice->entradas);
+    inicializaIndice(indice);
+}
+
+// Troca a tabela por uma de 2^bits posições e reposiciona todas as entradas
+// Retorna 1 se conseguiu, 0 se faltou memória
+static int redimensionarIndice(IndiceID* indice, int bits) {
+    uint32_t capacidade = 1u << bits;
+    EntradaIndice* novas = (EntradaIndice*) calloc(capacidade, sizeof(EntradaIndice));
+    if (novas == NULL) return 0;
+
+    EntradaIndice* antigas = indice->entradas;
+    uint32_t capacidadeAntiga = indice->capacidade;
+
+    indice->entradas = novas;
+    indice->capacidade = capacidade;
+    indice->bits = bits;
+
+    // Reinsere cada entrada ocupada na nova tabela
+    for (uint32_t i = 0; i < capacidadeAntiga; i++) {
+        if (antigas[i].id == 0) continue;
+        uint32_t pos = hashID(indice, antigas[i].id);
+        while (novas[pos].id != 0) {
+            pos = (pos + 1) & (capacidade - 1);
+        }
+        novas[pos] = antigas[i];
+    }
+    free(antigas);
+    return 1;
+}
+
+// Dobra a capacidade da tabela
+static int crescerIndice(IndiceID* indice) {
+    return redimensionarIndice(indice, indice->bits == 0 ? 4 : indice->bits + 1);
+}
+
+// Garante espaço para 'quantidade' entradas sem novos crescimentos, com
+// um único reposicionamento (cargas em lote)
+// Retorna 1 se conseguiu, 0 se faltou memória
+int reservarIndice(IndiceID* indice, size_t quantidade) {
+    int bits = indice->bits == 0 ? 4 : indice->bits;
+    while (quantidade * 10 > ((size_t) 1 << bits) * 7) bits++;
+    if (bits > 31) return 0;
+    return bits == indice->bits || redimensionarIndice(indice, bits);
+}
+
+// Procura o ID no índice; retorna o nó associado ou NULL
+void* buscarIndice(const IndiceID* indice, int id) {
+    if (indice->quantidade == 0) return NULL;
+
+    uint32_t mascara = indice->capacidade - 1;
+    uint32_t pos = hashID(indice, id);
+    // Sonda até achar o ID ou uma posição livre (fim da sequência)
+    while (indice->entradas[pos].id != 0) {
+        if (indice->entradas[pos].id == id)
+            return indice->entradas[pos].no;
+        pos = (pos + 1) & mascara;
+    }
+    return NULL;
+}
+
+// Associa o ID ao nó (substitui a associação se o ID já existir)
+// Retorna 1 se conseguiu, 0 se faltou memória
+int inserirIndice(IndiceID* indice, int id, void* no) {
+    // Mantém a ocupação abaixo de 70% para as sondagens ficarem curtas
+    if ((indice->quantidade + 1) * 10 > indice->capacidade * 7) {
+        if (!crescerIndice(indice)) return 0;
+    }
+
+    uint32_t mascara = indice->capacidade - 1;
+    uint32_t pos = hashID(indice, id);
+    while (indice->entradas[pos].id != 0) {
+        if (indice->entradas[pos].id == id) {
+            indice->entradas[pos].no = no;
+            return 1;
+        }
+        pos = (pos + 1) & mascara;
+    }
+    indice->entradas[pos].id = id;
+    indice->entradas[pos].no = no;
+    indice->quantidade++;
+    return 1;
+}
+
+// Remove o ID do índice (se existir)
+// Usa remoção por deslocamento: as entradas seguintes da mesma sequência
+// de sondagem são puxadas para trás, então não sobram "lápides"
+void removerIndice(IndiceID* indice, int id) {
+    if (indice->quantidade == 0) return;
+
+    uint32_t mascara = indice->capacidade - 1;
+    uint32_t pos = hashID(indice, id);
+    while (indice->entradas[pos].id != id) {
+        if (indice->entradas[pos].id == 0) return;  // ID não está no índice
+        pos = (pos + 1) & mascara;
+    }
+
+    // Fecha o buraco deixado pela remoção
+    uint32_t buraco = pos;
+    uint32_t prox = (pos + 1) & mascara;
+    while (indice->entradas[prox].id != 0) {
+        uint32_t ideal = hashID(indice, indice->entradas[prox].id);
+        // A entrada só pode ocupar o buraco se ele estiver entre a posição
+        // ideal dela e a posição atual (considerando a volta da tabela)
+        if (((prox - ideal) & mascara) >= ((prox - buraco) & mascara)) {
+            indice->entradas[buraco] = indice->entradas[prox];
+            buraco = prox;
+        }
+        prox = (prox + 1) & mascara;
+    }
+    indice->entradas[buraco].id = 0;
+    indice->entradas[buraco].no = NULL;
+    indice->quantidade--;
+}
+
+// ============= POOL DE NÓS =============
+// Alocador por slabs: reserva memória em blocos grandes e distribui nós
+// de tamanho fixo, evitando fragmentar o heap em sessões longas
+
+// Inicializa um pool vazio (nenhum slab é alocado antes do primeiro nó)
+void inicializaPool(PoolNos* pool) {
+    pool->livres = NULL;
+    pool->slabs = NULL;
+    pool->usadosNoAtual = BLOCOS_POR_SLAB;  // Força um slab novo no primeiro uso
+    pool->vivos = 0;
+    pool->pico = 0;
+    pool->numSlabs = 0;
+    pool->usuarios = 0;
+}
+
+// Entrega um nó do pool; retorna NULL se faltar memória
+void* alocarNo(PoolNos* pool) {
+    BlocoPool* bloco;
+
+    if (pool->livres != NULL) {
+        // Reaproveita um nó devolvido
+        bloco = pool->livres;
+        pool->livres = bloco->proxLivre;
+    } else {
+        // Slab atual cheio: aloca um novo
+        if (pool->usadosNoAtual == BLOCOS_POR_SLAB) {
+            Slab* slab = (Slab*) malloc(sizeof(Slab));
+            if (slab == NULL) return NULL;
+            slab->prox = pool->slabs;
+            pool->slabs = slab;
+            pool->usadosNoAtual = 0;
+            pool->numSlabs++;
+        }
+        bloco = &pool->slabs->blocos[pool->usadosNoAtual++];
+    }
+
+    pool->vivos++;
+    if (pool->vivos > pool->pico) pool->pico = pool->vivos;
+    return bloco;
+}
+
+// Devolve um nó ao pool (fica disponível para o próximo alocarNo)
+void liberarNo(PoolNos* pool, void* no) {
+    BlocoPool* bloco = (BlocoPool*) no;
+    bloco->proxLivre = pool->livres;
+    pool->livres = bloco;
+    pool->vivos--;
+}
+
+// Libera todos os slabs de uma vez, sem percorrer os nós
+// O pool continua utilizável (volta ao estado inicial, mantendo o pico)
+void liberarSlabs(PoolNos* pool) {
+    Slab* atual = pool->slabs;
+    while (atual != NULL) {
+        Slab* temp = atual;
+        atual = atual->prox;
+        free(temp);
+    }
+    pool->livres = NULL;
+    pool->slabs = NULL;
+    pool->usadosNoAtual = BLOCOS_POR_SLAB;
+    pool->vivos = 0;
+    pool->numSlabs = 0;
+}
+
+// ============= ARMAZÉM DE NOMES =============
+// Guarda os nomes dos pacientes fora dos registros: os registros só levam
+// uma NomeRef de 32 bits
+
+// Devolve o texto de um nome a partir da sua referência
+const char* obterNome(NomeRef ref) {
+    if (armazemNomes.blocos == NULL) return "";  // Só existe o nome vazio
+    return armazemNomes.blocos[ref >> 16] + (ref & 0xFFFF);
+}
+
+// Hash FNV-1a do texto do nome
+static uint32_t hashNome(const char* nome, size_t tamanho) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < tamanho; i++) {
+        h ^= (unsigned char) nome[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Cria um novo bloco de pelo menos 'tamanho' bytes no fim do armazém
+// Retorna 1 se conseguiu, 0 se faltou memória
+static int novoBlocoNomes(size_t tamanho) {
+    if (armazemNomes.numBlocos == MAX_BLOCOS_NOMES) return 0;
+    char* bloco = (char*) malloc(tamanho);
+    if (bloco == NULL) return 0;
+    armazemNomes.blocos[armazemNomes.numBlocos++] = bloco;
+    armazemNomes.usadoNoAtual = 0;
+    return 1;
+}
+
+// Dobra a tabela hash de nomes e reposiciona as referências
+static int crescerTabelaNomes() {
+    uint32_t capacidade = armazemNomes.capTabela == 0 ? 256 : armazemNomes.capTabela * 2;
+    NomeRef* nova = (NomeRef*) calloc(capacidade, sizeof(NomeRef));
+    if (nova == NULL) return 0;
+
+    for (uint32_t i = 0; i < armazemNomes.capTabela; i++) {
+        NomeRef ref = armazemNomes.tabela[i];
+        if (ref == 0) continue;
+        const char* texto = obterNome(ref);
+        uint32_t pos = hashNome(texto, strlen(texto)) & (capacidade - 1);
+        while (nova[pos] != 0) {
+            pos = (pos + 1) & (capacidade - 1);
+        }
+        nova[pos] = ref;
+    }
+    free(armazemNomes.tabela);
+    armazemNomes.tabela = nova;
+    armazemNomes.capTabela = capacidade;
+    return 1;
+}
+
+// Grava o nome no armazém (ou reaproveita um nome igual já gravado)
+// Retorna a referência do nome ou NOME_FALHA se faltar memória
+// Chamar com travaNomes já adquirida
+static NomeRef internarNomeSemTrava(const char* nome) {
+    size_t tamanho = strlen(nome);
+    if (tamanho == 0) return 0;
+
+    // Primeiro uso: cria a tabela de blocos e o bloco 0 com o nome vazio
+    if (armazemNomes.blocos == NULL) {
+        armazemNomes.blocos = (char**) calloc(MAX_BLOCOS_NOMES, sizeof(char*));
+        if (armazemNomes.blocos == NULL) return NOME_FALHA;
+        if (!novoBlocoNomes(TAM_BLOCO_NOMES)) return NOME_FALHA;
+        armazemNomes.blocos[0][0] = '\0';
+        armazemNomes.usadoNoAtual = 1;
+    }
+
+    // Mantém a tabela hash abaixo de 70% de ocupação
+    if ((armazemNomes.qtdTabela + 1) * 10 > armazemNomes.capTabela * 7) {
+        if (!crescerTabelaNomes()) return NOME_FALHA;
+    }
+
+    // Procura um nome igual já gravado
+    uint32_t mascara = armazemNomes.capTabela - 1;
+    uint32_t pos = hashNome(nome, tamanho) & mascara;
+    while (armazemNomes.tabela[pos] != 0) {
+        if (strcmp(obterNome(armazemNomes.tabela[pos]), nome) == 0)
+            return armazemNomes.tabela[pos];
+        pos = (pos + 1) & mascara;
+    }
+
+    // Não cabe no bloco atual: nomes longos ganham um bloco exclusivo,
+    // os demais começam um novo bloco padrão
+    if (armazemNomes.usadoNoAtual + tamanho + 1 > TAM_BLOCO_NOMES) {
+        size_t tamBloco = tamanho + 1 > TAM_BLOCO_NOMES ? tamanho + 1 : TAM_BLOCO_NOMES;
+        if (!novoBlocoNomes(tamBloco)) return NOME_FALHA;
+    }
+
+    uint32_t bloco = armazemNomes.numBlocos - 1;
+    NomeRef ref = (bloco << 16) | armazemNomes.usadoNoAtual;
+    memcpy(armazemNomes.blocos[bloco] + armazemNomes.usadoNoAtual, nome, tamanho + 1);
+    // Um bloco exclusivo fica cheio; um bloco padrão continua recebendo nomes
+    armazemNomes.usadoNoAtual = tamanho + 1 > TAM_BLOCO_NOMES
+                              ? TAM_BLOCO_NOMES
+                              : armazemNomes.usadoNoAtual + (uint32_t) tamanho + 1;
+    armazemNomes.bytes += tamanho + 1;
+
+    armazemNomes.tabela[pos] = ref;
+    armazemNomes.qtdTabela++;
+    return ref;
+}
+
+// Grava o nome no armazém (ou reaproveita um nome igual já gravado)
+// Retorna a referência do nome ou NOME_FALHA se faltar memória
+// Pode ser chamada por várias threads ao mesmo tempo
+NomeRef internarNome(const char* nome) {
+    pthread_mutex_lock(&travaNomes);
+    NomeRef ref = internarNomeSemTrava(nome);
+    pthread_mutex_unlock(&travaNomes);
+    return ref;
+}
+
+// Libera toda a memória do armazém de nomes
+void destruirArmazemNomes() {
+    for (uint32_t i = 0; i < armazemNomes.numBlocos; i++) {
+        free(armazemNomes.blocos[i]);
+    }
+    free(armazemNomes.blocos);
+    free(armazemNomes.tabela);
+    memset(&armazemNomes, 0, sizeof(armazemNomes));
+}
+
+// ============= ÍNDICE DE NOMES =============
+// Permite achar pacientes por parte do nome, sem acentos e com pequenos
+// erros de digitação. inserirFila e push indexam cada paciente na primeira
+// vez que ele aparece; removerFila e pop não mexem no índice, pois o
+// paciente só passa da fila para o histórico (ou volta). Quem sai do
+// sistema fica no índice até a próxima busca: cada resultado é conferido
+// no índice de IDs antes de ser mostrado.
+
+// Tamanho máximo de um nome normalizado (o resto é ignorado na busca)
+#define TAM_NOME_NORMALIZADO 256
+
+// Letra sem acento dos caracteres 0xC0-0xFF do Latin-1, que em UTF-8 são
+// os bytes 0xC3 0x80-0xBF; 0 = não é letra
+static const char letrasSemAcento[64] = {
+    'a','a','a','a','a','a','a','c','e','e','e','e','i','i','i','i',
+    'd','n','o','o','o','o','o', 0 ,'o','u','u','u','u','y', 0 ,'s',
+    'a','a','a','a','a','a','a','c','e','e','e','e','i','i','i','i',
+    'd','n','o','o','o','o','o', 0 ,'o','u','u','u','u','y', 0 ,'y'
+};
+
+// Normaliza um nome: minúsculas, sem acentos, só letras, dígitos e um
+// espaço entre as palavras, começando com um espaço (início de palavra)
+// Aceita UTF-8 e também Latin-1 (console do Windows)
+// Retorna o tamanho do texto gravado em 'destino'
+size_t normalizarNome(const char* nome, char* destino) {
+    size_t n = 0;
+    destino[n++] = ' ';
+    const unsigned char* c = (const unsigned char*) nome;
+    while (*c != '\0' && n < TAM_NOME_NORMALIZADO - 1) {
+        char letra = 0;
+        if (*c >= 'A' && *c <= 'Z') letra = (char) (*c - 'A' + 'a');
+        else if ((*c >= 'a' && *c <= 'z') || (*c >= '0' && *c <= '9')) letra = (char) *c;
+        else if (*c == 0xC3 && c[1] >= 0x80 && c[1] <= 0xBF) letra = letrasSemAcento[*++c - 0x80];
+        else if (*c >= 0xC0 && (c[1] < 0x80 || c[1] > 0xBF)) letra = letrasSemAcento[*c - 0xC0];
+        c++;
+
+        if (letra != 0) destino[n++] = letra;
+        else if (destino[n - 1] != ' ') destino[n++] = ' ';  // Separador de palavras
+    }
+    if (n > 1 && destino[n - 1] == ' ') n--;  // Sem espaço no fim
+    destino[n] = '\0';
+    return n;
+}
+
+// Código (0..CODIGOS_TRIGRAMA-1) de um caractere normalizado
+static int codigoTrigrama(char c) {
+    if (c == ' ') return 0;
+    if (c >= 'a' && c <= 'z') return 1 + (c - 'a');
+    return 27 + (c - '0');
+}
+
+// Número do trigrama que começa em 'texto'
+static uint32_t numeroTrigrama(const char* texto) {
+    return (uint32_t) ((codigoTrigrama(texto[0]) * CODIGOS_TRIGRAMA + codigoTrigrama(texto[1]))
+                       * CODIGOS_TRIGRAMA + codigoTrigrama(texto[2]));
+}
+
+// Cria um índice de nomes vazio (NULL se faltar memória)
+IndiceNomes* criarIndiceNomes() {
+    IndiceNomes* ix = (IndiceNomes*) calloc(1, sizeof(IndiceNomes));
+    if (ix != NULL) inicializaIndice(&ix->ids);
+    return ix;
+}
+
+// Libera o índice de nomes
+void destruirIndiceNomes(IndiceNomes* ix) {
+    if (ix == NULL) return;
+    for (uint32_t i = 0; i < NUM_TRIGRAMAS; i++) free(ix->trigramas[i].itens);
+    free(ix->inicioTexto);
+    free(ix->primeiroPaciente);
+    free(ix->marca);
+    free(ix->textos);
+    free(ix->tabela);
+    free(ix->pacientes);
+    destruirIndice(&ix->ids);
+    free(ix);
+}
+
+// Dobra a capacidade de um vetor (realloc); retorna 0 se faltar memória
+static int crescerVetor(void** vetor, uint32_t* capacidade, size_t tamItem) {
+    uint32_t nova = *capacidade == 0 ? 64 : *capacidade * 2;
+    void* maior = realloc(*vetor, (size_t) nova * tamItem);
+    if (maior == NULL) return 0;
+    *vetor = maior;
+    *capacidade = nova;
+    return 1;
+}
+
+// Anexa um nid a uma lista de trigrama; retorna 0 se faltar memória
+static int anexarNid(ListaNids* lista, uint32_t nid) {
+    if (lista->quantidade > 0 && lista->itens[lista->quantidade - 1] == nid)
+        return 1;  // Trigrama repetido no mesmo nome
+    if (lista->quantidade == lista->capacidade) {
+        uint32_t nova = lista->capacidade == 0 ? 4 : lista->capacidade * 2;
+        uint32_t* maior = (uint32_t*) realloc(lista->itens, nova * sizeof(uint32_t));
+        if (maior == NULL) return 0;
+        lista->itens = maior;
+        lista->capacidade = nova;
+    }
+    lista->itens[lista->quantidade++] = nid;
+    return 1;
+}
+
+// Dobra a tabela hash de textos e reposiciona os nids
+static int crescerTabelaTextos(IndiceNomes* ix) {
+    uint32_t capacidade = ix->capTabela == 0 ? 1024 : ix->capTabela * 2;
+    uint32_t* nova = (uint32_t*) calloc(capacidade, sizeof(uint32_t));
+    if (nova == NULL) return 0;
+    for (uint32_t nid = 0; nid < ix->numNomes; nid++) {
+        const char* texto = ix->textos + ix->inicioTexto[nid];
+        uint32_t pos = hashNome(texto, strlen(texto)) & (capacidade - 1);
+        while (nova[pos] != 0) pos = (pos + 1) & (capacidade - 1);
+        nova[pos] = nid + 1;
+    }
+    free(ix->tabela);
+    ix->tabela = nova;
+    ix->capTabela = capacidade;
+    return 1;
+}
+
+// Devolve o nid do texto normalizado, criando-o (com seus trigramas) se
+// ainda não existir; retorna UINT32_MAX se faltar memória
+static uint32_t obterNid(IndiceNomes* ix, const char* texto, size_t tamanho) {
+    if ((ix->numNomes + 1) * 10 > ix->capTabela * 7 && !crescerTabelaTextos(ix)) return UINT32_MAX;
+
+    uint32_t mascara = ix->capTabela - 1;
+    uint32_t pos = hashNome(texto, tamanho) & mascara;
+    while (ix->tabela[pos] != 0) {
+        uint32_t nid = ix->tabela[pos] - 1;
+        if (strcmp(ix->textos + ix->inicioTexto[nid], texto) == 0) return nid;
+        pos = (pos + 1) & mascara;
     }
+
+    // Nome novo: guarda o texto e liga os trigramas
+    if (ix->numNomes == ix->capNomes) {
+        uint32_t cap = ix->capNomes;
+        if (!crescerVetor((void**) &ix->inicioTexto, &cap, sizeof(uint32_t))) return UINT32_MAX;
+        cap = ix->capNomes;
+        if (!crescerVetor((void**) &ix->primeiroPaciente, &cap, sizeof(uint32_t))) return UINT32_MAX;
+        cap = ix->capNomes;
+        if (!crescerVetor((void**) &ix->marca, &cap, sizeof(uint32_t))) return UINT32_MAX;
+        ix->capNomes = cap;
+    }
+    while (ix->usadoTextos + tamanho + 1 > ix->capTextos) {
+        size_t nova = ix->capTextos == 0 ? 4096 : ix->capTextos * 2;
+        char* maior = (char*) realloc(ix->textos, nova);
+        if (maior == NULL) return UINT32_MAX;
+        ix->textos = maior;
+        ix->capTextos = nova;
+    }
+
+    uint32_t nid = ix->numNomes++;
+    ix->inicioTexto[nid] = (uint32_t) ix->usadoTextos;
+    ix->primeiroPaciente[nid] = 0;
+    ix->marca[nid] = 0;
+    memcpy(ix->textos + ix->usadoTextos, texto, tamanho + 1);
+    ix->usadoTextos += tamanho + 1;
+    ix->tabela[pos] = nid + 1;
+
+    for (size_t i = 0; i + 3 <= tamanho; i++) {
+        if (!anexarNid(&ix->trigramas[numeroTrigrama(texto + i)], nid)) return UINT32_MAX;
+    }
+    return nid;
+}
+
+// Indexa o paciente 'id' com o nome informado, se ainda não estiver no índice
+// Retorna 0 se faltar memória
+int indexarNome(IndiceNomes* ix, int id, const char* nome) {
+    if (buscarIndice(&ix->ids, id) != NULL) return 1;  // Já indexado
+
+    char texto[TAM_NOME_NORMALIZADO];
+    size_t tamanho = normalizarNome(nome, texto);
+    uint32_t nid = obterNid(ix, texto, tamanho);
+    if (nid == UINT32_MAX) return 0;
+
+    if (ix->numPacientes == ix->capPacientes &&
+        !crescerVetor((void**) &ix->pacientes, &ix->capPacientes, sizeof(PacienteNome)))
+        return 0;
+    PacienteNome* entrada = &ix->pacientes[ix->numPacientes++];
+    entrada->id = id;
+    entrada->prox = ix->primeiroPaciente[nid];
+    ix->primeiroPaciente[nid] = ix->numPacientes;  // Posição + 1
+    // O ID aponta para a sua entrada atual (posição + 1): entradas antigas
+    // do mesmo ID (desfeito e refeito) não passam na conferência da busca
+    return inserirIndice(&ix->ids, id, (void*) (uintptr_t) ix->numPacientes);
+}
+
+// Esquece o paciente 'id' (ele saiu do sistema); se o ID for cadastrado de
+// novo, será indexado com o novo nome. As entradas antigas são descartadas
+// pela conferência da busca.
+void esquecerNome(IndiceNomes* ix, int id) {
+    removerIndice(&ix->ids, id);
 }
 
 // ============= FUNÇÕES DE INICIALIZAÇÃO =============
 
-// Inicializa uma fila vazia
+// Converte a prioridade (1..PRIORIDADE_MINIMA) no índice do balde correspondente
+int nivelDaPrioridade(int prioridade) {
+    return prioridade - PRIORIDADE_MAXIMA;
+}
+
+// Inicializa uma fila vazia cujos nós saem do pool informado
+void inicializaFilaComPool(Fila* fila, PoolNos* pool) {
+    for (int i = 0; i < NUM_PRIORIDADES; i++) {
+        fila->baldes[i].inicio = NULL;  // Sem primeiro paciente no nível
+        fila->baldes[i].fim = NULL;     // Sem último paciente no nível
+        fila->baldes[i].quantidade = 0;
+        fila->baldes[i].arvore = NULL;  // Árvore de posições: alocada no primeiro paciente
+        fila->baldes[i].porOrdem = NULL;
+        fila->baldes[i].capArvore = 0;
+        fila->baldes[i].primeiraOrdem = 0;
+        fila->baldes[i].proximaOrdem = 0;
+    }
+    fila->ocupados = 0;
+    fila->tamanho = 0;
+    fila->ultimaEspera = 0;
+    fila->ultimaChegada = 0;
+    fila->ultimaEntradaNivel = 0;
+    fila->ultimaPosicaoNivel = 0;
+    fila->ultimoNivel = 0;
+    fila->envelhecimentoMs = 0;
+    fila->nomes = NULL;
+    inicializaIndice(&fila->indice);
+    fila->pool = pool;
+    fila->diario = NULL;
+    pool->usuarios++;
+}
+
+// Inicializa uma fila vazia usando o pool padrão do sistema
 void inicializaFila(Fila* fila) {
-    fila->inicio = NULL;  // Sem primeiro paciente
-    fila->fim = NULL;     // Sem último paciente
+    inicializaFilaComPool(fila, &poolNos);
 }
 
-// Aloca memória e inicializa uma nova pilha para o histórico
-Pilha* inicializaPilha() {
+// Aloca memória e inicializa uma nova pilha cujos nós saem do pool informado
+Pilha* inicializaPilhaComPool(PoolNos* pool) {
     // Aloca memória para a pilha
     Pilha* p = (Pilha*) malloc(sizeof(Pilha));
     if (p == NULL) {
         printf("Erro de alocação da pilha.\n");
         return NULL;
     }
-    p->topo = NULL;  // Pilha começa vazia
-    return p;
+    p->topo = NULL;  // Pilha começa vazia
+    p->base = NULL;
+    p->quentes = 0;
+    p->limiteQuentes = LIMITE_HISTORICO_QUENTE;
+    p->arquivo = NULL;  // Sem arquivo: todo o histórico fica em memória
+    inicializaIndice(&p->indice);
+    p->pool = pool;
+    p->diario = NULL;
+    p->nomes = NULL;
+    pool->usuarios++;
+    return p;
+}
+
+// Aloca memória e inicializa uma nova pilha usando o pool padrão do sistema
+Pilha* inicializaPilha() {
+    return inicializaPilhaComPool(&poolNos);
+}
+
+// ============= MEDIÇÃO DE TEMPO =============
+
+// Relógio monotônico em nanossegundos (não volta atrás com ajustes de hora)
+uint64_t relogioNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+// Tempo monotônico em segundos
+double tempoAgora() {
+    return (double) relogioNs() / 1e9;
+}
+
+// Relógio virtual da simulação (ver SIMULAÇÃO): enquanto ligado, relogioMs
+// devolve o instante simulado em vez do relógio do sistema
+// É por thread: na varredura, cada simulação tem o seu relógio
+static _Thread_local int relogioSimulado = 0;
+static _Thread_local uint32_t agoraSimuladoMs = 0;
+
+// Relógio monotônico em milissegundos, em 32 bits (volta a zero a cada
+// ~49 dias; diferenças entre duas leituras continuam corretas)
+// Usa o relógio "grosso" do Linux quando existe: resolução de poucos ms
+// basta para tempo de espera e a leitura é bem mais barata
+uint32_t relogioMs() {
+    if (relogioSimulado) return agoraSimuladoMs;
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint32_t) ((uint64_t) ts.tv_sec * 1000u + (uint64_t) ts.tv_nsec / 1000000u);
+}
+
+// Índice do balde de um valor em nanossegundos
+static int baldeLatencia(uint64_t ns) {
+    if (ns < BALDES_EXATOS_LATENCIA) return (int) ns;
+    int msb = 63 - __builtin_clzll(ns);                 // Bit mais alto (>= 6)
+    int sub = (int) (ns >> (msb - 5)) & (SUBBALDES_LATENCIA - 1);
+    int indice = BALDES_EXATOS_LATENCIA + (msb - 6) * SUBBALDES_LATENCIA + sub;
+    return indice < NUM_BALDES_LATENCIA ? indice : NUM_BALDES_LATENCIA - 1;
+}
+
+// Menor valor (em ns) que cai no balde 'indice'
+static uint64_t inicioBaldeLatencia(int indice) {
+    if (indice < BALDES_EXATOS_LATENCIA) return (uint64_t) indice;
+    int faixa = (indice - BALDES_EXATOS_LATENCIA) / SUBBALDES_LATENCIA;
+    int sub = (indice - BALDES_EXATOS_LATENCIA) % SUBBALDES_LATENCIA;
+    return (uint64_t) (SUBBALDES_LATENCIA + sub) << (faixa + 1);
+}
+
+// Zera o histograma
+void limparHistograma(HistogramaLatencia* h) {
+    for (int i = 0; i < NUM_BALDES_LATENCIA; i++)
+        atomic_store_explicit(&h->contagem[i], 0, memory_order_relaxed);
+    atomic_store_explicit(&h->total, 0, memory_order_relaxed);
+    atomic_store_explicit(&h->soma, 0, memory_order_relaxed);
+    atomic_store_explicit(&h->maximo, 0, memory_order_relaxed);
+}
+
+// Leva o máximo do histograma a pelo menos 'valor'
+static void atualizarMaximo(HistogramaLatencia* h, uint64_t valor) {
+    uint64_t maximo = atomic_load_explicit(&h->maximo, memory_order_relaxed);
+    while (valor > maximo &&
+           !atomic_compare_exchange_weak_explicit(&h->maximo, &maximo, valor,
+                                                  memory_order_relaxed, memory_order_relaxed));
+}
+
+// Registra uma amostra (pode ser chamada por várias threads ao mesmo tempo)
+// Só contadores independentes: quem lê durante a escrita pode ver o total
+// uma amostra à frente dos baldes, o que não altera os percentis
+void registrarLatencia(HistogramaLatencia* h, uint64_t ns) {
+    atomic_fetch_add_explicit(&h->contagem[baldeLatencia(ns)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->total, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->soma, ns, memory_order_relaxed);
+    atualizarMaximo(h, ns);
+}
+
+// Registra 'vezes' amostras iguais a 'valor' (amostras ponderadas)
+void registrarAmostras(HistogramaLatencia* h, uint64_t valor, uint64_t vezes) {
+    if (vezes == 0) return;
+    atomic_fetch_add_explicit(&h->contagem[baldeLatencia(valor)], vezes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->total, vezes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->soma, valor * vezes, memory_order_relaxed);
+    atualizarMaximo(h, valor);
+}
+
+// Quantidade de amostras do histograma
+uint64_t amostrasLatencia(const HistogramaLatencia* h) {
+    return atomic_load_explicit(&h->total, memory_order_relaxed);
+}
+
+// Média das amostras em nanossegundos
+double mediaLatencia(const HistogramaLatencia* h) {
+    uint64_t total = amostrasLatencia(h);
+    if (total == 0) return 0;
+    return (double) atomic_load_explicit(&h->soma, memory_order_relaxed) / (double) total;
+}
+
+// Maior amostra em nanossegundos
+uint64_t maximoLatencia(const HistogramaLatencia* h) {
+    return atomic_load_explicit(&h->maximo, memory_order_relaxed);
+}
+
+// Valor aproximado do percentil (0-100) em nanossegundos
+uint64_t percentilLatencia(const HistogramaLatencia* h, double percentil) {
+    uint64_t total = amostrasLatencia(h);
+    uint64_t maximo = maximoLatencia(h);
+    if (total == 0) return 0;
+    uint64_t alvo = (uint64_t) (percentil / 100.0 * (double) total + 0.5);
+    if (alvo == 0) alvo = 1;
+    uint64_t acumulado = 0;
+    for (int i = 0; i < NUM_BALDES_LATENCIA; i++) {
+        acumulado += atomic_load_explicit(&h->contagem[i], memory_order_relaxed);
+        if (acumulado >= alvo) {
+            uint64_t v = inicioBaldeLatencia(i);
+            return v < maximo ? v : maximo;
+        }
+    }
+    return maximo;
+}
+
+// Soma as amostras de 'origem' em 'destino' (várias threads podem somar
+// no mesmo destino ao mesmo tempo)
+void somarHistograma(HistogramaLatencia* destino, const HistogramaLatencia* origem) {
+    for (int i = 0; i < NUM_BALDES_LATENCIA; i++) {
+        uint64_t c = atomic_load_explicit(&origem->contagem[i], memory_order_relaxed);
+        if (c != 0) atomic_fetch_add_explicit(&destino->contagem[i], c, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&destino->total, amostrasLatencia(origem), memory_order_relaxed);
+    atomic_fetch_add_explicit(&destino->soma, atomic_load_explicit(&origem->soma, memory_order_relaxed),
+                              memory_order_relaxed);
+    atualizarMaximo(destino, maximoLatencia(origem));
+}
+
+// Gerador pseudoaleatório splitmix64: rápido e reproduzível pela semente
+uint64_t proximoAleatorio(uint64_t* estado) {
+    uint64_t z = (*estado += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// ============= FUNÇÕES DE IMPRESSÃO =============
+
+// Imprime os campos de um paciente de forma formatada
+// Recebe o nome já em texto, pois no arquivo de histórico ele não está
+// no armazém de nomes
+void imprimirCamposPaciente(Paciente p, const char* nome){
+	printf("\nID: %d\nNOME: %s\nIDADE: %d anos\nPRIORIDADE: %s (%d)\n------ --------- ------\n",
+	       p.id, nome, p.idade, obterNomePrioridade(p.prioridade), p.prioridade);
+}
+
+// Imprime os dados de um único paciente de forma formatada
+void imprimirPaciente(Paciente p){
+	imprimirCamposPaciente(p, obterNome(p.nome));
+}
+
+// ---------- Saída formatada ----------
+// Listagens grandes (fila, histórico) não usam um printf por campo: as
+// linhas são formatadas num buffer grande, reaproveitado entre listagens,
+// e o buffer inteiro vai para a saída com um único write quando enche ou
+// quando a listagem termina. Três formatos:
+//   tabela   - uma linha por paciente, com cabeçalho (menu)
+//   compacto - id|nome|idade|prioridade, fácil de processar com outras ferramentas
+//   json     - um vetor de objetos
+
+// Tamanho do buffer da saída formatada
+#define TAM_BUFFER_SAIDA (256 * 1024)
+
+enum {
+    FORMATO_TABELA,
+    FORMATO_COMPACTO,
+    FORMATO_JSON
+};
+
+// Buffer reaproveitado por todas as listagens
+static char bufferSaida[TAM_BUFFER_SAIDA];
+
+// Uma listagem em andamento
+typedef struct {
+    size_t usado;   // Bytes ocupados em bufferSaida
+    size_t itens;   // Pacientes escritos (para as vírgulas do JSON)
+    int formato;
+} SaidaFormatada;
+
+// Filtros e paginação de uma listagem
+typedef struct {
+    int formato;       // FORMATO_TABELA, FORMATO_COMPACTO ou FORMATO_JSON
+    size_t inicio;     // Pacientes pulados antes do primeiro mostrado
+    size_t limite;     // Máximo de pacientes mostrados (0 = sem limite)
+    int prioridade;    // Só esta prioridade (0 = todas)
+} OpcoesListagem;
+
+// Escreve o conteúdo do buffer na saída padrão e o esvazia
+void descarregarSaida(SaidaFormatada* s) {
+    fflush(stdout);  // O que já foi impresso com printf vem antes
+    size_t enviado = 0;
+    while (enviado < s->usado) {
+        long n = (long) write(fileno(stdout), bufferSaida + enviado, (unsigned) (s->usado - enviado));
+        if (n <= 0) break;
+        enviado += (size_t) n;
+    }
+    s->usado = 0;
+}
+
+// Acrescenta texto formatado ao buffer (descarrega se não couber)
+void anexarSaida(SaidaFormatada* s, const char* formato, ...) {
+    for (int tentativa = 0; tentativa < 2; tentativa++) {
+        va_list args;
+        va_start(args, formato);
+        size_t livre = TAM_BUFFER_SAIDA - s->usado;
+        int n = vsnprintf(bufferSaida + s->usado, livre, formato, args);
+        va_end(args);
+        if (n < 0) return;
+        if ((size_t) n < livre) {
+            s->usado += (size_t) n;
+            return;
+        }
+        descarregarSaida(s);
+    }
+    // Maior que o buffer inteiro (um nome enorme): vai direto
+    va_list args;
+    va_start(args, formato);
+    vprintf(formato, args);
+    va_end(args);
+}
+
+// Acrescenta um texto entre aspas, escapado para JSON
+static void anexarTextoJSON(SaidaFormatada* s, const char* texto) {
+    anexarSaida(s, "\"");
+    const char* inicio = texto;
+    for (const char* c = texto; ; c++) {
+        unsigned char u = (unsigned char) *c;
+        if (u != '\0' && u != '"' && u != '\\' && u >= 0x20) continue;
+        // Copia o trecho sem escapes de uma vez
+        if (c > inicio) anexarSaida(s, "%.*s", (int) (c - inicio), inicio);
+        if (u == '\0') break;
+        if (u == '"' || u == '\\') anexarSaida(s, "\\%c", u);
+        else anexarSaida(s, "\\u%04x", u);
+        inicio = c + 1;
+    }
+    anexarSaida(s, "\"");
+}
+
+// Começa uma listagem; 'titulo' só aparece no formato tabela
+void iniciarSaida(SaidaFormatada* s, int formato, const char* titulo) {
+    s->usado = 0;
+    s->itens = 0;
+    s->formato = formato;
+    if (formato == FORMATO_JSON) {
+        anexarSaida(s, "[");
+    } else if (formato == FORMATO_TABELA) {
+        anexarSaida(s, "\n=== %s ===\n%8s  %-30s %5s  %s\n", titulo, "ID", "NOME", "IDADE", "PRIORIDADE");
+    }
+}
+
+// Escreve um paciente no formato da listagem
+// 'nivel' é o balde em que ele está na fila (-1 no histórico); se for
+// diferente da triagem, o paciente foi promovido pelo envelhecimento
+void anexarPaciente(SaidaFormatada* s, Paciente p, const char* nome, int nivel) {
+    int promovido = nivel >= 0 && nivel != nivelDaPrioridade(p.prioridade);
+    switch (s->formato) {
+        case FORMATO_TABELA:
+            anexarSaida(s, "%8d  %-30s %5d  %s", p.id, nome, p.idade, obterNomePrioridade(p.prioridade));
+            if (promovido) anexarSaida(s, " -> %s", obterNomePrioridade(PRIORIDADE_MAXIMA + nivel));
+            anexarSaida(s, "\n");
+            break;
+        case FORMATO_COMPACTO:
+            anexarSaida(s, "%d|%s|%d|%d\n", p.id, nome, p.idade, promovido ? PRIORIDADE_MAXIMA + nivel : p.prioridade);
+            break;
+        default:
+            anexarSaida(s, "%s\n  {\"id\":%d,\"nome\":", s->itens > 0 ? "," : "", p.id);
+            anexarTextoJSON(s, nome);
+            anexarSaida(s, ",\"idade\":%d,\"prioridade\":%d", p.idade, p.prioridade);
+            if (nivel >= 0) anexarSaida(s, ",\"nivel\":%d", PRIORIDADE_MAXIMA + nivel);
+            anexarSaida(s, "}");
+    }
+    s->itens++;
+}
+
+// Termina a listagem e escreve o que falta
+void finalizarSaida(SaidaFormatada* s) {
+    if (s->formato == FORMATO_JSON) anexarSaida(s, s->itens > 0 ? "\n]\n" : "]\n");
+    descarregarSaida(s);
+}
+
+// Lista os pacientes em espera na ordem de atendimento, com filtros e
+// paginação. Baldes fora do filtro ou inteiramente antes de 'inicio' são
+// pulados pela contagem, sem percorrer os nós; dentro do balde em que
+// 'inicio' cai, o percurso sai da ponta mais próxima
+// Se 'continuar' aponta para um nó (o da posição 'inicio', guardado pela
+// página anterior), a listagem começa nele sem procurar 'inicio'; ao
+// final recebe o próximo nó não listado (NULL quando a fila acabou)
+// Retorna quantos pacientes foram listados
+size_t listarFilaDesde(Fila* fila, const OpcoesListagem* op, No** continuar) {
+    SaidaFormatada s;
+    iniciarSaida(&s, op->formato, "FILA DE ESPERA");
+
+    No* atual = continuar != NULL ? *continuar : NULL;
+    size_t pular = atual != NULL ? 0 : op->inicio;
+    size_t listados = 0;
+    for (int i = atual != NULL ? (int) atual->nivel : 0; i < NUM_PRIORIDADES; i++) {
+        if (op->prioridade != 0 && nivelDaPrioridade(op->prioridade) != i) continue;
+        Balde* balde = &fila->baldes[i];
+        if (atual == NULL) {
+            if (pular >= (size_t) balde->quantidade) {
+                pular -= (size_t) balde->quantidade;
+                continue;
+            }
+            if (pular <= (size_t) balde->quantidade / 2) {
+                for (atual = balde->inicio; pular > 0; pular--) atual = atual->prox;
+            } else {
+                atual = balde->fim;
+                for (size_t j = (size_t) balde->quantidade - 1; j > pular; j--) atual = atual->ant;
+                pular = 0;
+            }
+        }
+        for (; atual != NULL && (op->limite == 0 || listados < op->limite); atual = atual->prox) {
+            anexarPaciente(&s, atual->dados, obterNome(atual->dados.nome), i);
+            listados++;
+        }
+        if (atual != NULL) break;  // Limite atingido: 'atual' é o próximo da lista
+    }
+    finalizarSaida(&s);
+    if (continuar != NULL) *continuar = atual;
+    return listados;
+}
+
+// Lista os pacientes em espera a partir da posição op->inicio (ver listarFilaDesde)
+size_t listarFila(Fila* fila, const OpcoesListagem* op) {
+    return listarFilaDesde(fila, op, NULL);
+}
+
+// Pacientes em espera que passam pelo filtro de prioridade
+size_t contarFila(const Fila* fila, int prioridade) {
+    if (prioridade == 0) return (size_t) fila->tamanho;
+    return (size_t) fila->baldes[nivelDaPrioridade(prioridade)].quantidade;
+}
+
+// Exibe o relatório geral do sistema com estatísticas
+void exibirRelatorio(const Fila* fila) {
+    printf("RELATÓRIO DE PACIENTES\n");
+    printf("Total de Pacientes Cadastrados: %d\n", metricas.contadores[CONTADOR_CADASTRADOS]);
+    printf("Total de Pacientes Atendidos: %d\n", metricas.contadores[CONTADOR_ATENDIDOS]);
+    printf("Total de Pacientes Desfeitos: %d\n", metricas.contadores[CONTADOR_DESFEITOS]);
+    // Pacientes em espera: lidos da própria fila, total e por balde
+    printf("Pacientes em Espera (Fila): %d\n", fila->tamanho);
+    for (int i = 0; i < NUM_PRIORIDADES; i++)
+        printf("  %s: %d\n", obterNomePrioridade(PRIORIDADE_MAXIMA + i), fila->baldes[i].quantidade);
+    // Tempo de espera dos atendidos, pela prioridade da triagem
+    for (int i = 0; i < NUM_PRIORIDADES; i++) {
+        const HistogramaLatencia* e = &metricas.espera[i];
+        printf("Espera %s: média %.1f s | máxima %.1f s (%llu atendidos)\n",
+               obterNomePrioridade(PRIORIDADE_MAXIMA + i), mediaLatencia(e) / 1e9,
+               (double) maximoLatencia(e) / 1e9, (unsigned long long) amostrasLatencia(e));
+    }
+    // Uso de memória do pool de nós
+    printf("Nós em Uso: %zu (pico: %zu)\n", poolNos.vivos, poolNos.pico);
+    printf("Slabs Alocados: %zu (%d nós cada)\n", poolNos.numSlabs, BLOCOS_POR_SLAB);
+}
+
+// Limpa a tela do console com sequências ANSI (cursor no canto e tela
+// apagada), sem abrir um shell para rodar "clear" ou "cls"
+// Com a saída redirecionada para um arquivo, nada é escrito
+void limparTela(){
+	static int terminal = -1;  // Descoberto na primeira chamada
+	if (terminal < 0) terminal = isatty(fileno(stdout));
+	if (terminal) fputs("\033[H\033[2J\033[3J", stdout);  // Como o "clear": também apaga o histórico da rolagem
+}
+
+// ============= DIÁRIO DE ALTERAÇÕES (WAL) =============
+// Formato de cada registro no arquivo .wal:
+//   [u32 tamanho do conteúdo][u32 soma de verificação][conteúdo]
+// O conteúdo começa com o tipo (1 byte). Registros de paciente levam
+// id (i32), idade (u16), prioridade (i8), tamanho do nome (u32) e o nome.
+// Os que põem alguém na fila levam também os horários dele (i64, ver
+// instanteParaParede) entre a parte fixa e o nome.
+// A soma de verificação permite descartar um registro escrito pela metade
+// (queda do processo no meio de uma escrita).
+
+// Cabeçalho do arquivo .wal
+#define MAGICO_WAL 0x4C415748u  // "HWAL"
+#define MAGICO_SNAP 0x50414E53u // "SNAP"
+// Versão do formato do .wal e do .snap. Os registros guardam prioridades e
+// baldes, então uma escala com outra quantidade de níveis muda a versão
+// (os bits altos), e os arquivos de um programa compilado com outra escala
+// são recusados em vez de reproduzidos nos baldes errados
+#define VERSAO_DIARIO (3u | (NUM_PRIORIDADES == 3 ? 0u : (uint32_t) NUM_PRIORIDADES << 16))
+#define VERSAO_ESTRANHA (-2)  // Arquivo de outra versão ou escala de prioridades
+
+// Os horários da fila (chegada, entradaNivel) são instantes de relogioMs,
+// que recomeça a cada boot. No .wal e no .snap eles vão em milissegundos
+// do relógio de parede e voltam a instantes na leitura; o tempo com o
+// programa parado conta como espera
+static int64_t relogioParedeMs(void) {
+    struct timespec ts;
+#ifdef CLOCK_REALTIME_COARSE
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_REALTIME, &ts);
+#endif
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Instante de relogioMs -> milissegundos do relógio de parede
+static int64_t instanteParaParede(uint32_t instante) {
+    return relogioParedeMs() - (int64_t) (uint32_t) (relogioMs() - instante);
+}
+
+// Milissegundos do relógio de parede -> instante de relogioMs
+// A espera fica entre 0 (relógio atrasado) e INT32_MAX ms (~24 dias)
+static uint32_t paredeParaInstante(int64_t parede) {
+    int64_t espera = relogioParedeMs() - parede;
+    if (espera < 0) espera = 0;
+    if (espera > INT32_MAX) espera = INT32_MAX;
+    return relogioMs() - (uint32_t) espera;
+}
+
+// Escreve todo o conteúdo do buffer no arquivo (sem fsync)
+static void descarregarDiario(DiarioWAL* d) {
+    size_t escrito = 0;
+    while (escrito < d->usado) {
+        long n = (long) write(d->fd, d->buffer + escrito, (unsigned) (d->usado - escrito));
+        if (n <= 0) {
+            d->falhou = 1;
+            break;
+        }
+        escrito += (size_t) n;
+    }
+    d->usado = 0;
+}
+
+// Copia bytes para o buffer do diário, escrevendo no arquivo quando enche
+static void anexarDiario(DiarioWAL* d, const void* dados, size_t tamanho) {
+    const unsigned char* p = (const unsigned char*) dados;
+    while (tamanho > 0) {
+        if (d->usado == TAM_BUFFER_DIARIO) descarregarDiario(d);
+        size_t cabe = TAM_BUFFER_DIARIO - d->usado;
+        size_t n = tamanho < cabe ? tamanho : cabe;
+        memcpy(d->buffer + d->usado, p, n);
+        d->usado += n;
+        p += n;
+        tamanho -= n;
+    }
+}
+
+// Soma de verificação FNV-1a, continuando a partir de 'h'
+static uint32_t somaDiario(uint32_t h, const void* dados, size_t tamanho) {
+    const unsigned char* p = (const unsigned char*) dados;
+    for (size_t i = 0; i < tamanho; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Anexa um registro completo: cabeçalho + parte fixa + texto opcional
+static void registrarDiario(DiarioWAL* d, const void* fixo, size_t tamFixo,
+                            const char* texto, size_t tamTexto) {
+    uint32_t cabecalho[2];
+    cabecalho[0] = (uint32_t) (tamFixo + tamTexto);
+    cabecalho[1] = somaDiario(somaDiario(2166136261u, fixo, tamFixo), texto, tamTexto);
+    anexarDiario(d, cabecalho, sizeof(cabecalho));
+    anexarDiario(d, fixo, tamFixo);
+    if (tamTexto > 0) anexarDiario(d, texto, tamTexto);
+    d->pendentesSync++;
+    d->registrosDesdeSnapshot++;
+}
+
+// Monta a parte fixa de um registro de paciente (12 bytes)
+static size_t codificarPaciente(unsigned char* destino, int tipo, Paciente p, uint32_t tamNome) {
+    destino[0] = (unsigned char) tipo;
+    memcpy(destino + 1, &p.id, 4);
+    memcpy(destino + 5, &p.idade, 2);
+    destino[7] = (unsigned char) p.prioridade;
+    memcpy(destino + 8, &tamNome, 4);
+    return 12;
+}
+
+// Registra uma alteração que carrega um paciente (REG_PUSH)
+void diarioPaciente(DiarioWAL* d, int tipo, Paciente p) {
+    unsigned char fixo[12];
+    const char* nome = obterNome(p.nome);
+    uint32_t tamNome = (uint32_t) strlen(nome);
+    registrarDiario(d, fixo, codificarPaciente(fixo, tipo, p, tamNome), nome, tamNome);
+}
+
+// Registra a chegada de um paciente ao fim do balde da sua prioridade
+// (REG_INSERIR), com a hora de chegada
+void diarioInsercao(DiarioWAL* d, Paciente p, uint32_t chegada) {
+    unsigned char fixo[20];
+    const char* nome = obterNome(p.nome);
+    uint32_t tamNome = (uint32_t) strlen(nome);
+    int64_t parede = instanteParaParede(chegada);
+    codificarPaciente(fixo, REG_INSERIR, p, tamNome);
+    memcpy(fixo + 12, &parede, 8);
+    registrarDiario(d, fixo, sizeof(fixo), nome, tamNome);
+}
+
+// Registra uma alteração sem dados (REG_REMOVER ou REG_POP)
+void diarioSimples(DiarioWAL* d, int tipo) {
+    unsigned char fixo = (unsigned char) tipo;
+    registrarDiario(d, &fixo, 1, NULL, 0);
+}
+
+// Altera um contador do sistema e registra a alteração no diário
+void alterarEstatistica(DiarioWAL* d, int indice, int delta) {
+    metricas.contadores[indice] += delta;
+    if (d != NULL) {
+        unsigned char fixo[3] = {REG_CONTADOR, (unsigned char) indice, (unsigned char) (signed char) delta};
+        registrarDiario(d, fixo, sizeof(fixo), NULL, 0);
+    }
+}
+
+// ============= MÉTRICAS =============
+// Contadores e histogramas são alimentados pela camada de comandos
+// (registrarPaciente, atenderPaciente, desfazerAtendimento, buscas e a
+// fila concorrente), não pelas primitivas da fila e da pilha: a reprodução
+// do diário na inicialização não entra nas métricas.
+
+// Nome de cada operação medida (usado na exibição e no JSON)
+static const char* nomesOperacao[NUM_OPERACOES] = {"inserir", "atender", "desfazer", "buscar", "refazer", "posicao",
+                                                   "prioridade", "desistencia"};
+
+// Registra uma operação que começou em 'inicio' (relogioNs)
+void registrarOperacao(int operacao, uint64_t inicio, int realizada) {
+    registrarLatencia(&metricas.latencias[operacao], relogioNs() - inicio);
+    if (realizada)
+        atomic_fetch_add_explicit(&metricas.realizadas[operacao], 1, memory_order_relaxed);
+    else
+        atomic_fetch_add_explicit(&metricas.recusadas[operacao], 1, memory_order_relaxed);
+}
+
+// Conta uma operação recusada antes de começar (dados inválidos, ID
+// repetido detectado na entrada); não gera amostra de latência
+void recusarOperacao(int operacao) {
+    atomic_fetch_add_explicit(&metricas.recusadas[operacao], 1, memory_order_relaxed);
+}
+
+// Registra quanto tempo (ms) um paciente atendido esperou na fila,
+// separado pela prioridade da triagem (mesmo que tenha sido promovido)
+void registrarEspera(int prioridade, uint32_t esperaMs) {
+    registrarLatencia(&metricas.espera[nivelDaPrioridade(prioridade)], (uint64_t) esperaMs * 1000000u);
+}
+
+// Exibe as métricas em forma de tabela (opção do menu)
+void imprimirMetricas(const Fila* fila) {
+    printf("MÉTRICAS DO SISTEMA\n");
+    printf("Operação    Realizadas Recusadas  Média(us)    p50(us)    p99(us)    Máx(us)\n");
+    for (int i = 0; i < NUM_OPERACOES; i++) {
+        const HistogramaLatencia* h = &metricas.latencias[i];
+        printf("%-11s %10llu %9llu %10.1f %10.1f %10.1f %10.1f\n", nomesOperacao[i],
+               (unsigned long long) metricas.realizadas[i],
+               (unsigned long long) metricas.recusadas[i],
+               mediaLatencia(h) / 1e3,
+               (double) percentilLatencia(h, 50) / 1e3,
+               (double) percentilLatencia(h, 99) / 1e3,
+               (double) maximoLatencia(h) / 1e3);
+    }
+
+    int largura = larguraRotulosPrioridade(10);
+    printf("Em espera por prioridade:\n");
+    for (int i = 0; i < NUM_PRIORIDADES; i++) {
+        const char* rotulo = obterNomePrioridade(PRIORIDADE_MAXIMA + i);
+        printf("  %-*s %d\n", larguraEmBytes(rotulo, largura), rotulo, fila->baldes[i].quantidade);
+    }
+
+    printf("Tempo na fila dos atendidos (s):\n");
+    for (int i = 0; i < NUM_PRIORIDADES; i++) {
+        const HistogramaLatencia* e = &metricas.espera[i];
+        const char* rotulo = obterNomePrioridade(PRIORIDADE_MAXIMA + i);
+        printf("  %-*s média %.1f | p50 %.1f | p90 %.1f | p99 %.1f | máx %.1f\n",
+               larguraEmBytes(rotulo, largura), rotulo,
+               mediaLatencia(e) / 1e9, (double) percentilLatencia(e, 50) / 1e9,
+               (double) percentilLatencia(e, 90) / 1e9, (double) percentilLatencia(e, 99) / 1e9,
+               (double) maximoLatencia(e) / 1e9);
+    }
+
+    const HistogramaLatencia* r = &metricas.resposta;
+    printf("Resposta do console (us): média %.1f | p50 %.1f | p99 %.1f | máx %.1f (%llu linhas)\n",
+           mediaLatencia(r) / 1e3, (double) percentilLatencia(r, 50) / 1e3,
+           (double) percentilLatencia(r, 99) / 1e3, (double) maximoLatencia(r) / 1e3,
+           (unsigned long long) amostrasLatencia(r));
+}
+
+// Escreve um histograma como objeto JSON (valores em ns)
+static void escreverHistogramaJSON(FILE* saida, const HistogramaLatencia* h) {
+    fprintf(saida, "{\"amostras\":%llu,\"media_ns\":%.1f,\"p50_ns\":%llu,\"p90_ns\":%llu,"
+                   "\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}",
+            (unsigned long long) amostrasLatencia(h), mediaLatencia(h),
+            (unsigned long long) percentilLatencia(h, 50),
+            (unsigned long long) percentilLatencia(h, 90),
+            (unsigned long long) percentilLatencia(h, 99),
+            (unsigned long long) percentilLatencia(h, 99.9),
+            (unsigned long long) maximoLatencia(h));
+}
+
+// Escreve todas as métricas como um objeto JSON numa única linha
+void escreverMetricasJSON(FILE* saida, const Fila* fila) {
+    fprintf(saida, "{\"cadastrados\":%d,\"atendidos\":%d,\"desfeitos\":%d,\"em_espera\":%d,",
+            metricas.contadores[CONTADOR_CADASTRADOS], metricas.contadores[CONTADOR_ATENDIDOS],
+            metricas.contadores[CONTADOR_DESFEITOS], fila->tamanho);
+    fprintf(saida, "\"profundidade\":{");
+    for (int i = 0; i < NUM_PRIORIDADES; i++) {
+        fprintf(saida, "%s\"%s\":%d", i > 0 ? "," : "",
+                obterNomePrioridade(PRIORIDADE_MAXIMA + i), fila->baldes[i].quantidade);
+    }
+    fprintf(saida, "},\"operacoes\":{");
+    for (int i = 0; i < NUM_OPERACOES; i++) {
+        fprintf(saida, "%s\"%s\":{\"realizadas\":%llu,\"recusadas\":%llu,\"latencia\":",
+                i > 0 ? "," : "", nomesOperacao[i],
+                (unsigned long long) metricas.realizadas[i],
+                (unsigned long long) metricas.recusadas[i]);
+        escreverHistogramaJSON(saida, &metricas.latencias[i]);
+        fprintf(saida, "}");
+    }
+    fprintf(saida, "},\"espera\":{");
+    for (int i = 0; i < NUM_PRIORIDADES; i++) {
+        fprintf(saida, "%s\"%s\":", i > 0 ? "," : "", obterNomePrioridade(PRIORIDADE_MAXIMA + i));
+        escreverHistogramaJSON(saida, &metricas.espera[i]);
+    }
+    fprintf(saida, "},\"resposta_console\":");
+    escreverHistogramaJSON(saida, &metricas.resposta);
+    fprintf(saida, "}\n");
+}
+
+// Gravação periódica das métricas num arquivo (opção --metricas)
+static const char* arquivoMetricas = NULL;  // NULL = desligada
+static uint64_t intervaloMetricasNs = 0;
+static uint64_t proximaGravacaoMetricas = 0;
+
+// Liga a gravação periódica: o arquivo é reescrito a cada 'segundos'
+void configurarMetricasPeriodicas(const char* caminho, double segundos) {
+    arquivoMetricas = caminho;
+    intervaloMetricasNs = (uint64_t) (segundos * 1e9);
+    proximaGravacaoMetricas = 0;  // Grava na primeira oportunidade
+}
+
+// Reescreve o arquivo de métricas se o intervalo já passou (ou se
+// 'forcar' for 1). É chamada entre comandos, então não precisa de uma
+// thread nem de trava para ler a fila. O arquivo é trocado por rename,
+// quem o lê nunca vê uma gravação pela metade.
+void gravarMetricasPeriodicas(const Fila* fila, int forcar) {
+    if (arquivoMetricas == NULL) return;
+    uint64_t agora = relogioNs();
+    if (!forcar && agora < proximaGravacaoMetricas) return;
+    proximaGravacaoMetricas = agora + intervaloMetricasNs;
+
+    char temporario[TAM_CAMINHO];
+    snprintf(temporario, sizeof(temporario), "%s.tmp", arquivoMetricas);
+    FILE* arq = fopen(temporario, "w");
+    if (arq == NULL) return;
+    escreverMetricasJSON(arq, fila);
+    if (fclose(arq) != 0) return;
+#ifdef _WIN32
+    remove(arquivoMetricas);  // rename não substitui arquivos no Windows
+#endif
+    rename(temporario, arquivoMetricas);
+}
+
+// ============= FUNÇÕES DE FILA =============
+// CONCEITO IMPORTANTE: Este é uma fila de PRIORIDADE (Priority Queue)
+// Pacientes NÃO entram na ordem de chegada, mas sim ORDENADOS por prioridade
+// Prioridades: 1 (máxima) → ... → PRIORIDADE_MINIMA, conforme a escala
+// escolhida na compilação; na padrão, 1=Emergência → 2=Urgência → 3=Normal
+// Quanto MENOR o número, MAIOR a prioridade de atendimento
+//
+// Em vez de uma única lista ordenada (que exigia percorrer todos os
+// pacientes a cada cadastro), cada nível tem seu próprio balde FIFO.
+// Quem chega entra no FIM do balde da sua prioridade, então pacientes de
+// mesma prioridade continuam sendo atendidos por ordem de chegada.
+//
+// Exemplo com 3 baldes:
+//   Emergência: [P4]
+//   Urgência:   [P1] -> [P2]
+//   Normal:     [P3]
+// Ordem de atendimento: P4, P1, P2, P3
+//
+// A fila também mantém um mapa de bits dos baldes com pacientes
+// (ocupados = 0b111 no exemplo). Com ele, achar o primeiro balde não vazio
+// é contar os zeros à direita do mapa, em vez de testar balde por balde.
+
+// ---------- Posição na fila ----------
+// Cada balde numera os seus nós em ordem de atendimento (campo 'ordem' do
+// nó) e guarda uma árvore de Fenwick sobre esses números: a árvore conta
+// quantos nós ainda estão no balde com ordem <= x em O(log n). A posição de
+// um paciente é o total dos baldes anteriores (contagens mantidas a cada
+// inserção e remoção) mais essa contagem.
+// Quem chega no fim recebe o número seguinte ao último e quem volta ao
+// início (desfazer) o anterior ao primeiro. Quando os números acabam de um
+// dos lados, o balde é renumerado a partir de 1/4 de uma árvore com pelo
+// menos o dobro dos nós, o que custa O(n) a cada O(n) chegadas: O(1)
+// amortizado. Se faltar memória para a árvore, o balde continua
+// funcionando e a posição é calculada percorrendo o balde.
+// Quem sai do meio do balde deixa o seu número livre entre os vizinhos.
+// Quem volta para o meio (desfazer, reprodução do diário) acha o lugar
+// pela árvore, descendo até o k-ésimo nó, e ocupa um número livre entre
+// os novos vizinhos; só sem número livre o balde é renumerado.
+
+// Menor tamanho da árvore de um balde
+#define MIN_ARVORE_ORDEM 64
+// Maior tamanho da árvore (limite dos 28 bits do campo 'ordem' do nó)
+#define MAX_ARVORE_ORDEM (1u << 28)
+
+// Soma 'delta' à contagem da ordem 'ordem'
+static void somarArvoreOrdem(Balde* balde, uint32_t ordem, int32_t delta) {
+    for (uint32_t i = ordem + 1; i <= balde->capArvore; i += i & (0u - i)) balde->arvore[i] += delta;
+}
+
+// Nós do balde com ordem <= 'ordem'
+static uint32_t contarAteOrdem(const Balde* balde, uint32_t ordem) {
+    int32_t soma = 0;
+    for (uint32_t i = ordem + 1; i > 0; i -= i & (0u - i)) soma += balde->arvore[i];
+    return (uint32_t) soma;
+}
+
+// Renumera os nós do balde numa árvore nova com folga nos dois lados
+static void renumerarBalde(Balde* balde) {
+    uint64_t precisa = 2 * ((uint64_t) balde->quantidade + 1);
+    uint32_t cap = MIN_ARVORE_ORDEM;
+    while (cap < precisa && cap < MAX_ARVORE_ORDEM) cap *= 2;
+
+    free(balde->arvore);
+    free(balde->porOrdem);
+    balde->capArvore = 0;
+    balde->arvore = NULL;
+    balde->porOrdem = NULL;
+    if (cap >= precisa) {
+        balde->arvore = (int32_t*) calloc((size_t) cap + 1, sizeof(int32_t));
+        balde->porOrdem = (No**) malloc((size_t) cap * sizeof(No*));
+    }
+    if (balde->arvore == NULL || balde->porOrdem == NULL) {
+        // Sem árvore: posição pelo percurso do balde
+        free(balde->arvore);
+        free(balde->porOrdem);
+        balde->arvore = NULL;
+        balde->porOrdem = NULL;
+        return;
+    }
+    balde->capArvore = cap;
+
+    uint32_t ordem = cap / 4;
+    balde->primeiraOrdem = ordem;
+    for (No* no = balde->inicio; no != NULL; no = no->prox) {
+        no->ordem = ordem;
+        balde->porOrdem[ordem] = no;
+        balde->arvore[++ordem] = 1;  // Posição ordem + 1 da árvore (base 1)
+    }
+    balde->proximaOrdem = ordem;
+
+    // Montagem da árvore de Fenwick em O(cap)
+    for (uint32_t i = 1; i <= cap; i++) {
+        uint32_t pai = i + (i & (0u - i));
+        if (pai <= cap) balde->arvore[pai] += balde->arvore[i];
+    }
+}
+
+// Numera o nó que vai entrar no balde (no início ou no fim) e o conta na
+// árvore; deve ser chamado antes de ligar o nó ao balde
+static void numerarNo(Balde* balde, No* no, int noInicio) {
+    if (noInicio ? balde->primeiraOrdem == 0 : balde->proximaOrdem >= balde->capArvore)
+        renumerarBalde(balde);
+    if (balde->arvore == NULL) {
+        no->ordem = 0;
+        return;
+    }
+    no->ordem = noInicio ? --balde->primeiraOrdem : balde->proximaOrdem++;
+    balde->porOrdem[no->ordem] = no;
+    somarArvoreOrdem(balde, no->ordem, 1);
+}
+
+// Numera o nó que vai entrar no meio do balde, logo depois de 'anterior',
+// com um número livre entre os dois vizinhos - O(log n)
+// Retorna 0 se não há número livre (o balde precisa ser renumerado)
+static int numerarNoMeio(Balde* balde, No* no, const No* anterior) {
+    if (balde->arvore == NULL || anterior->prox->ordem - anterior->ordem < 2) return 0;
+    no->ordem = anterior->ordem + 1;
+    balde->porOrdem[no->ordem] = no;
+    somarArvoreOrdem(balde, no->ordem, 1);
+    return 1;
+}
+
+// Ordem do k-ésimo nó do balde (k a partir de 1) - O(log n)
+// Desce a árvore pelos bits de capArvore (sempre uma potência de 2)
+static uint32_t ordemDoK(const Balde* balde, uint32_t k) {
+    uint32_t pos = 0;
+    for (uint32_t passo = balde->capArvore; passo > 0; passo >>= 1) {
+        if (pos + passo <= balde->capArvore && (uint32_t) balde->arvore[pos + passo] < k) {
+            pos += passo;
+            k -= (uint32_t) balde->arvore[pos];
+        }
+    }
+    return pos;  // Posição pos + 1 da árvore (base 1)
+}
+
+// Desconta o nó que saiu do balde (já com a quantidade atualizada)
+static void desnumerarNo(Balde* balde, const No* no) {
+    if (balde->arvore == NULL) return;
+    somarArvoreOrdem(balde, no->ordem, -1);
+    // Balde vazio: a numeração recomeça do meio, sem renumerar
+    if (balde->quantidade == 0) balde->primeiraOrdem = balde->proximaOrdem = balde->capArvore / 4;
+}
+
+// Posição do paciente 'id' na ordem de atendimento (1 = próximo), ou 0 se
+// ele não está na fila - O(log n)
+// Vale para a fila como está: promoções do envelhecimento que já venceram
+// só são aplicadas na próxima inserção ou atendimento
+int posicaoNaFila(const Fila* fila, int id) {
+    No* no = (No*) buscarIndice(&fila->indice, id);
+    if (no == NULL) return 0;
+
+    int posicao = 0;
+    for (uint32_t i = 0; i < no->nivel; i++) posicao += fila->baldes[i].quantidade;
+
+    const Balde* balde = &fila->baldes[no->nivel];
+    if (balde->arvore != NULL) return posicao + (int) contarAteOrdem(balde, no->ordem);
+    for (No* atual = balde->inicio; atual != no; atual = atual->prox) posicao++;
+    return posicao + 1;
+}
+
+// ---------- Envelhecimento ----------
+// Com fila->envelhecimentoMs > 0, quem espera esse tempo no seu balde sobe
+// um nível de prioridade (duas vezes o tempo, dois níveis...), para que
+// pacientes Normais não fiquem esperando para sempre sob uma sequência
+// de emergências. Quem sobe vai para o fim do balde de destino com a
+// entrada no nível renovada, então cada balde continua ordenado pela
+// entrada: basta olhar o primeiro de cada balde, sem percorrer a fila.
+// A promoção é feita a cada inserção e atendimento (inserirFila e removerFila).
+
+// Move o primeiro paciente do balde 'origem' para o fim do balde 'destino'
+void promoverPrimeiro(Fila* fila, int origem, int destino, uint32_t agora) {
+    Balde* de = &fila->baldes[origem];
+    Balde* para = &fila->baldes[destino];
+    No* no = de->inicio;
+
+    de->inicio = no->prox;
+    if (de->inicio == NULL) {
+        de->fim = NULL;
+        fila->ocupados &= ~(1u << origem);
+    } else {
+        de->inicio->ant = NULL;
+    }
+    de->quantidade--;
+    desnumerarNo(de, no);
+
+    numerarNo(para, no, 0);
+    no->prox = NULL;
+    no->ant = para->fim;
+    no->nivel = (uint32_t) destino;
+    no->entradaNivel = agora;
+    if (para->fim == NULL) para->inicio = no;
+    else para->fim->prox = no;
+    para->fim = no;
+    para->quantidade++;
+    fila->ocupados |= 1u << destino;
+
+    if (fila->diario != NULL) {
+        unsigned char fixo[11] = {REG_PROMOVER, (unsigned char) origem, (unsigned char) destino};
+        int64_t parede = instanteParaParede(agora);
+        memcpy(fixo + 3, &parede, 8);
+        registrarDiario(fila->diario, fixo, sizeof(fixo), NULL, 0);
+    }
+}
+
+// Promove quem já esperou demais no seu nível
+static void envelhecerFila(Fila* fila) {
+    uint32_t agora = relogioMs();
+    for (int i = 1; i < NUM_PRIORIDADES; i++) {
+        Balde* balde = &fila->baldes[i];
+        while (balde->inicio != NULL) {
+            uint32_t espera = agora - balde->inicio->entradaNivel;
+            if (espera < fila->envelhecimentoMs) break;  // O primeiro é o mais antigo do balde
+            uint32_t niveis = espera / fila->envelhecimentoMs;
+            int destino = niveis >= (uint32_t) i ? 0 : i - (int) niveis;
+            promoverPrimeiro(fila, i, destino, agora);
+        }
+    }
+}
+
+// Insere o paciente no fim do balde 'nivel' - O(1)
+// Normalmente o nível é o da prioridade da triagem (ver inserirFila); a
+// recuperação do snapshot usa outro nível para pacientes já promovidos
+// Retorna 1 se conseguiu, 0 se faltou memória (o erro já foi impresso)
+int inserirFilaNoNivel(Fila* fila, Paciente paciente, int nivel) {
+    // PASSO 1: Aloca memória para um novo nó armazenar o paciente cadastrado
+    No* novo = (No*) alocarNo(fila->pool);
+    if (novo == NULL) {
+        printf("ERRO: Falha na alocação de memória para novo paciente.\n");
+        return 0;
+    }
+
+    novo->dados = paciente;
+    novo->chegada = relogioMs();
+    novo->entradaNivel = novo->chegada;
+    novo->nivel = (uint32_t) nivel;
+    novo->prox = NULL;
+
+    // Registra o paciente no índice de IDs da fila
+    if (!inserirIndice(&fila->indice, paciente.id, novo)) {
+        printf("ERRO: Falha na alocação de memória para o índice de IDs.\n");
+        liberarNo(fila->pool, novo);
+        return 0;
+    }
+
+    // Promove antes quem já esperou demais, para que o recém-chegado
+    // não passe à frente de quem subiu de nível
+    if (fila->envelhecimentoMs != 0) envelhecerFila(fila);
+
+    // PASSO 2: LOCALIZA O BALDE DA PRIORIDADE DO PACIENTE
+    Balde* balde = &fila->baldes[nivel];
+
+    // PASSO 3: DESCOBRE SE O NOVO PACIENTE SERÁ O PRÓXIMO A SER ATENDIDO
+    // Isso acontece quando nenhum balde de prioridade igual ou maior
+    // tem pacientes esperando (nenhum bit de 0 até 'nivel' no mapa)
+    int primeiro = (fila->ocupados & ((2u << nivel) - 1)) == 0;
+
+    // PASSO 4: INSERE NO FIM DO BALDE (mantém a ordem de chegada)
+    numerarNo(balde, novo, 0);
+    novo->ant = balde->fim;
+    if (balde->fim == NULL) {
+        balde->inicio = novo;   // Balde vazio: novo é o primeiro e o último
+    } else {
+        balde->fim->prox = novo;  // Último do balde aponta para o novo
+    }
+    balde->fim = novo;
+    balde->quantidade++;
+    fila->ocupados |= 1u << nivel;
+    fila->tamanho++;
+
+    // Registra a alteração no diário (se houver)
+    if (fila->diario != NULL) diarioInsercao(fila->diario, paciente, novo->chegada);
+    if (fila->nomes != NULL) indexarNome(fila->nomes, paciente.id, obterNome(paciente.nome));
+
+    if (saidaSilenciosa) {
+        return 1;
+    } else if (fila->tamanho == 1) {
+        printf("Paciente %s inserido na fila (primeira posição).\n", obterNome(paciente.nome));
+    } else if (primeiro) {
+        printf("Paciente %s inserido na fila (início - alta prioridade).\n", obterNome(paciente.nome));
+    } else {
+        printf("Paciente %s inserido na fila.\n", obterNome(paciente.nome));
+    }
+    return 1;
+}
+
+// Insere o paciente no fim do balde da sua prioridade - O(1)
+// Retorna 1 se conseguiu, 0 se faltou memória
+int inserirFila(Fila* fila, Paciente paciente) {
+    return inserirFilaNoNivel(fila, paciente, nivelDaPrioridade(paciente.prioridade));
+}
+
+// Insere de uma vez 'n' pacientes já validados (importação)
+// Em vez de n chamadas a inserirFila, os pacientes são distribuídos por
+// prioridade (ordenação por contagem: uma passada por nível, estável, então
+// a ordem do arquivo vale dentro de cada prioridade) e cada balde recebe
+// uma corrente de nós encadeada em sequência, sem diário nem mensagens.
+// O resultado é a mesma fila que as n inserções produziriam.
+// Quem tem um ID que já está na fila é pulado e fica marcado com id = -1;
+// pacientes com id = -1 na entrada também são ignorados
+// Retorna quantos pacientes entraram (para no meio se faltar memória)
+size_t inserirFilaEmLote(Fila* fila, Paciente* pacientes, size_t n) {
+    uint32_t agora = relogioMs();
+    size_t inseridos = 0;
+    if (!reservarIndice(&fila->indice, fila->indice.quantidade + n)) return 0;
+    for (int nivel = 0; nivel < NUM_PRIORIDADES; nivel++) {
+        Balde* balde = &fila->baldes[nivel];
+        for (size_t i = 0; i < n; i++) {
+            if (pacientes[i].id == -1 || nivelDaPrioridade(pacientes[i].prioridade) != nivel) continue;
+            if (buscarIndice(&fila->indice, pacientes[i].id) != NULL) {
+                pacientes[i].id = -1;  // Repetido
+                continue;
+            }
+            No* novo = (No*) alocarNo(fila->pool);
+            if (novo == NULL) return inseridos;
+            if (!inserirIndice(&fila->indice, pacientes[i].id, novo)) {
+                liberarNo(fila->pool, novo);
+                return inseridos;
+            }
+            novo->dados = pacientes[i];
+            novo->chegada = agora;
+            novo->entradaNivel = agora;
+            novo->nivel = (uint32_t) nivel;
+            numerarNo(balde, novo, 0);
+            novo->prox = NULL;
+            novo->ant = balde->fim;
+            if (balde->fim == NULL) balde->inicio = novo;
+            else balde->fim->prox = novo;
+            balde->fim = novo;
+            balde->quantidade++;
+            fila->ocupados |= 1u << nivel;
+            fila->tamanho++;
+            if (fila->nomes != NULL) indexarNome(fila->nomes, pacientes[i].id, obterNome(pacientes[i].nome));
+            inseridos++;
+        }
+    }
+    return inseridos;
+}
+
+// Devolve um paciente ao INÍCIO do balde 'nivel', com a chegada e a
+// entrada no nível que ele tinha - O(1)
+// Usado para desfazer um atendimento: o atendido era o primeiro do balde,
+// então volta exatamente para o lugar de onde saiu, à frente dos que têm
+// a mesma prioridade
+void reinserirFila(Fila* fila, Paciente paciente, int nivel, uint32_t chegada, uint32_t entradaNivel) {
+    No* novo = (No*) alocarNo(fila->pool);
+    if (novo == NULL) {
+        printf("ERRO: Falha na alocação de memória para novo paciente.\n");
+        return;
+    }
+    if (!inserirIndice(&fila->indice, paciente.id, novo)) {
+        printf("ERRO: Falha na alocação de memória para o índice de IDs.\n");
+        liberarNo(fila->pool, novo);
+        return;
+    }
+
+    Balde* balde = &fila->baldes[nivel];
+    novo->dados = paciente;
+    novo->chegada = chegada;
+    novo->entradaNivel = entradaNivel;
+    novo->nivel = (uint32_t) nivel;
+    numerarNo(balde, novo, 1);
+    novo->ant = NULL;
+    novo->prox = balde->inicio;
+    if (balde->inicio == NULL) balde->fim = novo;
+    else balde->inicio->ant = novo;
+    balde->inicio = novo;
+    balde->quantidade++;
+    fila->ocupados |= 1u << nivel;
+    fila->tamanho++;
+
+    if (fila->diario != NULL) {
+        unsigned char fixo[29];
+        const char* nome = obterNome(paciente.nome);
+        uint32_t tamNome = (uint32_t) strlen(nome);
+        int64_t horarios[2] = {instanteParaParede(chegada), instanteParaParede(entradaNivel)};
+        codificarPaciente(fixo, REG_REINSERIR, paciente, tamNome);
+        fixo[12] = (unsigned char) nivel;
+        memcpy(fixo + 13, horarios, sizeof(horarios));
+        registrarDiario(fila->diario, fixo, sizeof(fixo), nome, tamNome);
+    }
+    if (fila->nomes != NULL) indexarNome(fila->nomes, paciente.id, obterNome(paciente.nome));
+}
+
+// Tira o nó do seu balde, sem devolvê-lo ao pool, e guarda de onde ele
+// saiu (ultimoNivel, ultimaChegada...)
+// Pacientes à frente do nó no seu balde - O(log n) pela árvore
+static uint32_t pacientesAFrente(const Balde* balde, const No* no) {
+    uint32_t aFrente = 0;
+    if (no->ant != NULL && balde->arvore != NULL) aFrente = contarAteOrdem(balde, no->ordem) - 1;
+    else for (No* atual = no->ant; atual != NULL; atual = atual->ant) aFrente++;
+    return aFrente;
+}
+
+static void soltarNo(Fila* fila, No* no) {
+    Balde* balde = &fila->baldes[no->nivel];
+    uint32_t aFrente = pacientesAFrente(balde, no);
+
+    if (no->ant == NULL) balde->inicio = no->prox;
+    else no->ant->prox = no->prox;
+    if (no->prox == NULL) balde->fim = no->ant;
+    else no->prox->ant = no->ant;
+    balde->quantidade--;
+    if (balde->inicio == NULL) fila->ocupados &= ~(1u << no->nivel);
+    fila->tamanho--;
+    desnumerarNo(balde, no);
+
+    fila->ultimoNivel = (int) no->nivel;
+    fila->ultimaChegada = no->chegada;
+    fila->ultimaEntradaNivel = no->entradaNivel;
+    fila->ultimaPosicaoNivel = aFrente;
+    fila->ultimaEspera = relogioMs() - no->chegada;
+}
+
+// Tira o nó do seu balde (ver soltarNo) e o devolve ao pool
+static Paciente desligarNo(Fila* fila, No* no) {
+    soltarNo(fila, no);
+    Paciente paciente = no->dados;
+    removerIndice(&fila->indice, paciente.id);
+    liberarNo(fila->pool, no);
+    return paciente;
+}
+
+// Retira da fila o paciente 'id', esteja onde estiver - O(1) pelo índice
+// Retorna 1 e preenche 'paciente' se ele estava na fila, senão 0
+int retirarFila(Fila* fila, int id, Paciente* paciente) {
+    No* no = (No*) buscarIndice(&fila->indice, id);
+    if (no == NULL) return 0;
+
+    *paciente = desligarNo(fila, no);
+    if (fila->diario != NULL) {
+        unsigned char fixo[5] = {REG_RETIRAR};
+        memcpy(fixo + 1, &id, 4);
+        registrarDiario(fila->diario, fixo, sizeof(fixo), NULL, 0);
+    }
+    return 1;
+}
+
+// ---------- Retriagem e reposicionamento ----------
+// Um paciente em espera pode mudar de prioridade (retriagem) ou voltar a
+// um ponto do meio de um balde (desfazer uma retriagem ou uma
+// desistência). O nó é achado pelo índice de IDs, desligado do balde e
+// religado no outro, sem alocar nada.
+// Cada balde fica ordenado pela entrada no nível: quem muda de prioridade
+// entra no fim do novo balde com a entrada renovada, e quem volta é
+// religado com o mesmo número de pacientes à frente que tinha ao sair.
+// Se o envelhecimento mexeu no balde nesse meio tempo, o ponto é
+// corrigido pela entrada no nível (empates no mesmo ms ficam como estão).
+
+// Liga o nó ao balde 'nivel' logo depois de 'anterior' (NULL = início)
+// O(1) nas pontas, O(log n) no meio; sem número livre entre os vizinhos,
+// a numeração das posições é refeita (O(n))
+static void ligarNo(Fila* fila, No* no, int nivel, No* anterior) {
+    Balde* balde = &fila->baldes[nivel];
+    int noMeio = anterior != NULL && anterior != balde->fim;
+    if (!noMeio) numerarNo(balde, no, anterior == NULL);
+    else if (numerarNoMeio(balde, no, anterior)) noMeio = 0;
+
+    no->nivel = (uint32_t) nivel;
+    no->ant = anterior;
+    no->prox = anterior == NULL ? balde->inicio : anterior->prox;
+    if (no->prox == NULL) balde->fim = no;
+    else no->prox->ant = no;
+    if (anterior == NULL) balde->inicio = no;
+    else anterior->prox = no;
+    balde->quantidade++;
+    fila->ocupados |= 1u << nivel;
+    fila->tamanho++;
+
+    if (noMeio) renumerarBalde(balde);
+}
+
+// Nó do balde depois do qual fica a posição 'posicao' (NULL = início)
+// O(log n) pela árvore; sem ela, percorre a partir da ponta mais próxima
+static No* anteriorPorPosicao(Balde* balde, uint32_t posicao) {
+    uint32_t quantidade = (uint32_t) balde->quantidade;
+    if (posicao == 0) return NULL;
+    if (posicao >= quantidade) return balde->fim;
+    if (balde->arvore != NULL) return balde->porOrdem[ordemDoK(balde, posicao)];
+    No* anterior;
+    if (posicao <= quantidade / 2) {
+        anterior = balde->inicio;
+        for (uint32_t i = 1; i < posicao; i++) anterior = anterior->prox;
+    } else {
+        anterior = balde->fim;
+        for (uint32_t i = quantidade; i > posicao; i--) anterior = anterior->ant;
+    }
+    return anterior;
+}
+
+// Nó do balde depois do qual volta quem saiu com 'posicao' pacientes à
+// frente e entrou no nível em 'entradaNivel' (ver o início da seção)
+// Atualiza 'posicao' com a posição em que o nó vai entrar
+static No* anteriorParaVolta(Balde* balde, uint32_t* posicao, uint32_t entradaNivel) {
+    if (*posicao > (uint32_t) balde->quantidade) *posicao = (uint32_t) balde->quantidade;
+    No* anterior = anteriorPorPosicao(balde, *posicao);
+    // Diferença com sinal: o relógio em ms dá a volta a cada ~49 dias
+    while (anterior != NULL && (int32_t) (anterior->entradaNivel - entradaNivel) > 0) {
+        anterior = anterior->ant;
+        (*posicao)--;
+    }
+    for (;;) {
+        No* seguinte = anterior == NULL ? balde->inicio : anterior->prox;
+        if (seguinte == NULL || (int32_t) (seguinte->entradaNivel - entradaNivel) >= 0) break;
+        anterior = seguinte;
+        (*posicao)++;
+    }
+    return anterior;
+}
+
+// Quantos pacientes do balde entraram no nível até 'entradaNivel' (a
+// posição em que entra, depois dos empates, quem chega com essa entrada)
+// O(1) quando é o mais novo; senão busca binária pela árvore, O(log² n)
+static uint32_t posicaoPorEntrada(Balde* balde, uint32_t entradaNivel) {
+    uint32_t baixo = 0, alto = (uint32_t) balde->quantidade;
+    if (balde->fim == NULL || (int32_t) (balde->fim->entradaNivel - entradaNivel) <= 0) return alto;
+    alto--;  // O último entrou depois
+    while (baixo < alto) {
+        uint32_t meio = baixo + (alto - baixo + 1) / 2;
+        if ((int32_t) (anteriorPorPosicao(balde, meio)->entradaNivel - entradaNivel) <= 0) baixo = meio;
+        else alto = meio - 1;
+    }
+    return baixo;
+}
+
+// Registra no diário que o paciente 'id' tem a prioridade 'prioridade' e
+// está na posição 'posicao' do balde 'nivel', onde entrou em 'entradaNivel'
+static void diarioPrioridade(Fila* fila, int id, int prioridade, int nivel, uint32_t posicao,
+                             uint32_t entradaNivel) {
+    if (fila->diario == NULL) return;
+    unsigned char fixo[19] = {REG_PRIORIDADE};
+    int64_t parede = instanteParaParede(entradaNivel);
+    memcpy(fixo + 1, &id, 4);
+    fixo[5] = (unsigned char) prioridade;
+    fixo[6] = (unsigned char) nivel;
+    memcpy(fixo + 7, &posicao, 4);
+    memcpy(fixo + 11, &parede, 8);
+    registrarDiario(fila->diario, fixo, sizeof(fixo), NULL, 0);
+}
+
+// Retriagem: o paciente 'id' passa a ter a prioridade 'prioridade' e vai
+// para o fim do balde dela - O(1) pelo índice
+// Se o balde dela é o que ele já ocupa (o envelhecimento o trouxe para
+// cá), só a prioridade muda e ele fica onde está
+// Guarda de onde ele saiu (ultimoNivel...), para desfazer
+// Retorna 1 se conseguiu, 0 se ele não está na fila
+int alterarPrioridadeFila(Fila* fila, int id, int prioridade) {
+    No* no = (No*) buscarIndice(&fila->indice, id);
+    if (no == NULL) return 0;
+
+    int nivel = nivelDaPrioridade(prioridade);
+    if (nivel == (int) no->nivel) {
+        uint32_t posicao = pacientesAFrente(&fila->baldes[nivel], no);
+        fila->ultimoNivel = nivel;
+        fila->ultimaChegada = no->chegada;
+        fila->ultimaEntradaNivel = no->entradaNivel;
+        fila->ultimaPosicaoNivel = posicao;
+        no->dados.prioridade = (int8_t) prioridade;
+        diarioPrioridade(fila, id, prioridade, nivel, posicao, no->entradaNivel);
+        return 1;
+    }
+    soltarNo(fila, no);
+    no->dados.prioridade = (int8_t) prioridade;
+    no->entradaNivel = relogioMs();
+    uint32_t posicao = (uint32_t) fila->baldes[nivel].quantidade;
+    ligarNo(fila, no, nivel, fila->baldes[nivel].fim);
+    diarioPrioridade(fila, id, prioridade, nivel, posicao, no->entradaNivel);
+    return 1;
+}
+
+// Devolve o paciente 'id', que está na fila, à prioridade 'prioridade' e
+// ao balde 'nivel', com 'posicao' pacientes à frente e a entrada no nível
+// 'entradaNivel' (desfazer uma retriagem) - O(log n) (ver ligarNo)
+// Retorna 1 se conseguiu, 0 se ele não está na fila
+int reposicionarFila(Fila* fila, int id, int prioridade, int nivel, uint32_t posicao, uint32_t entradaNivel) {
+    No* no = (No*) buscarIndice(&fila->indice, id);
+    if (no == NULL) return 0;
+
+    soltarNo(fila, no);
+    no->dados.prioridade = (int8_t) prioridade;
+    no->entradaNivel = entradaNivel;
+    No* anterior = anteriorParaVolta(&fila->baldes[nivel], &posicao, entradaNivel);
+    ligarNo(fila, no, nivel, anterior);
+    diarioPrioridade(fila, id, prioridade, nivel, posicao, entradaNivel);
+    return 1;
+}
+
+// Reproduz um REG_PRIORIDADE do diário: o paciente vai para a posição
+// registrada, com a entrada no nível registrada
+static void reproduzirPrioridade(Fila* fila, int id, int prioridade, int nivel, uint32_t posicao,
+                                 uint32_t entradaNivel) {
+    No* no = (No*) buscarIndice(&fila->indice, id);
+    if (no == NULL || nivel >= NUM_PRIORIDADES) return;
+    soltarNo(fila, no);
+    no->dados.prioridade = (int8_t) prioridade;
+    no->entradaNivel = entradaNivel;
+    ligarNo(fila, no, nivel, anteriorPorPosicao(&fila->baldes[nivel], posicao));
+}
+
+// Devolve à fila um paciente que tinha saído (desfazer uma desistência),
+// no balde 'nivel', com 'posicao' pacientes à frente (ver reposicionarFila)
+void restaurarFila(Fila* fila, Paciente paciente, int nivel, uint32_t posicao,
+                   uint32_t chegada, uint32_t entradaNivel) {
+    No* novo = (No*) alocarNo(fila->pool);
+    if (novo == NULL) {
+        printf("ERRO: Falha na alocação de memória para novo paciente.\n");
+        return;
+    }
+    if (!inserirIndice(&fila->indice, paciente.id, novo)) {
+        printf("ERRO: Falha na alocação de memória para o índice de IDs.\n");
+        liberarNo(fila->pool, novo);
+        return;
+    }
+
+    novo->dados = paciente;
+    novo->chegada = chegada;
+    novo->entradaNivel = entradaNivel;
+    No* anterior = anteriorParaVolta(&fila->baldes[nivel], &posicao, entradaNivel);
+    ligarNo(fila, novo, nivel, anterior);
+
+    // No diário: inserção no fim do balde da prioridade e mudança de lugar
+    if (fila->diario != NULL) {
+        diarioInsercao(fila->diario, paciente, chegada);
+        diarioPrioridade(fila, paciente.id, paciente.prioridade, nivel, posicao, entradaNivel);
+    }
+    if (fila->nomes != NULL) indexarNome(fila->nomes, paciente.id, obterNome(paciente.nome));
+}
+
+// Remove e retorna o primeiro paciente da fila (o de maior prioridade)
+// Esta é a operação de atendimento: sempre atendemos quem tem prioridade
+Paciente removerFila(Fila* fila) {
+    // Define um paciente "vazio" com ID=-1 como marcador de erro
+    Paciente vazio = {-1, 0, 0, PRIORIDADE_INVALIDA, 0};
+    
+    // Verifica se fila está vazia
+    if (fila->tamanho == 0) {
+        if (!saidaSilenciosa)
+            printf("ERRO: Fila vazia. Nenhum paciente para atender.\n");
+        return vazio;
+    }
+
+    if (fila->envelhecimentoMs != 0) envelhecerFila(fila);
+
+    // Primeiro balde não vazio (maior prioridade com espera): o bit ligado
+    // mais baixo do mapa de baldes ocupados
+    Balde* balde = &fila->baldes[__builtin_ctz(fila->ocupados)];
+    
+    // Desliga o primeiro nó do balde: o segundo passa a ser o primeiro
+    // (se o balde ficar vazio, o fim também é atualizado) e o nó volta ao pool
+    Paciente paciente = desligarNo(fila, balde->inicio);
+    if (fila->diario != NULL) diarioSimples(fila->diario, REG_REMOVER);
+
+    return paciente;  // Retorna os dados do paciente atendido
+}
+
+// ============= ARQUIVO DO HISTÓRICO =============
+// Os atendimentos mais antigos saem da pilha em memória e são anexados a
+// um arquivo de registros de tamanho fixo. O índice de IDs do histórico
+// continua apontando para eles: em vez do endereço de um nó, a entrada
+// guarda (posição no arquivo << 1) | 1. Nós reais nunca têm o bit 0 ligado,
+// então o bit distingue os dois casos.
+// Só os nós saem da memória: a entrada no índice de IDs, o nome no
+// armazém e no índice de nomes continuam lá para cada atendimento
+// arquivado, então a memória ainda cresce com o histórico (mais devagar)
+
+#define MAGICO_HISTORICO 0x54534948u  // "HIST"
+#define MAGICO_NOMES_HIST 0x4D4F4E48u // "HNOM"
+#define VERSAO_HISTORICO 1
+// Cabeçalho dos dois arquivos: mágico, versão e um contador de 64 bits
+#define TAM_CABECALHO_HIST 16
+
+// Converte uma posição do arquivo em valor do índice, e vice-versa
+#define POSICAO_PARA_INDICE(pos) ((void*) (uintptr_t) (((uint64_t) (pos) << 1) | 1u))
+#define NO_ESTA_NO_ARQUIVO(valor) (((uintptr_t) (valor)) & 1u)
+#define INDICE_PARA_POSICAO(valor) ((uint64_t) ((uintptr_t) (valor) >> 1))
+
+// Registro da posição 'pos' (0 = mais antigo)
+static RegistroHistorico* registroHistorico(ArquivoHistorico* a, uint64_t pos) {
+    return (RegistroHistorico*) (a->mapaRegistros + TAM_CABECALHO_HIST) + pos;
+}
+
+// Texto do nome de um registro (aponta para dentro do mapeamento)
+static const char* nomeRegistro(ArquivoHistorico* a, const RegistroHistorico* r) {
+    return (const char*) a->mapaNomes + TAM_CABECALHO_HIST + r->posNome;
+}
+
+// Grava os contadores nos cabeçalhos dos dois arquivos
+// Depois de desfazer atendimentos do arquivo, o cabeçalho continua com os
+// registros protegidos: numa queda, a recuperação encontra o que o
+// snapshot espera e o diário refaz as retiradas
+static void atualizarCabecalhosHistorico(ArquivoHistorico* a) {
+    int abaixo = a->quantidade < a->protegidos;
+    memcpy(a->mapaRegistros + 8, abaixo ? &a->protegidos : &a->quantidade, 8);
+    memcpy(a->mapaNomes + 8, abaixo ? &a->nomesProtegidos : &a->usadoNomes, 8);
+}
+
+// O snapshot que acabou de ser gravado cobre os registros atuais
+static void protegerArquivoHistorico(ArquivoHistorico* a) {
+    a->protegidos = a->quantidade;
+    a->nomesProtegidos = a->usadoNomes;
+    atualizarCabecalhosHistorico(a);
+}
+
+#ifndef _WIN32
+
+// Garante que o arquivo tenha pelo menos 'minimo' bytes mapeados
+// O tamanho dobra a cada crescimento, então o custo de remapear é diluído
+static int crescerMapa(int fd, unsigned char** mapa, size_t* tamMapa, size_t minimo) {
+    if (minimo <= *tamMapa) return 1;
+    size_t novo = *tamMapa == 0 ? 64 * 1024 : *tamMapa;
+    while (novo < minimo) novo *= 2;
+
+    if (ftruncate(fd, (off_t) novo) != 0) return 0;
+    unsigned char* m = (unsigned char*) mmap(NULL, novo, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) return 0;
+    if (*mapa != NULL) munmap(*mapa, *tamMapa);
+    *mapa = m;
+    *tamMapa = novo;
+    return 1;
+}
+
+// Abre (ou cria) um dos arquivos e mapeia todo o seu conteúdo
+// Em 'contador' devolve o valor gravado no cabeçalho
+// 'somenteLeitura': o arquivo precisa existir e o mapeamento é privado
+// (o que o programa escrever nele não chega ao disco)
+static int abrirMapa(const char* caminho, uint32_t magico, int somenteLeitura, int* fd,
+                     unsigned char** mapa, size_t* tamMapa, uint64_t* contador) {
+    *fd = somenteLeitura ? open(caminho, O_RDONLY) : open(caminho, O_RDWR | O_CREAT, 0644);
+    *mapa = NULL;
+    *tamMapa = 0;
+    if (*fd < 0) return 0;
+    struct stat info;
+    if (fstat(*fd, &info) != 0) return 0;
+
+    if (info.st_size >= TAM_CABECALHO_HIST) {
+        // Arquivo existente: mapeia o tamanho atual e confere o cabeçalho
+        *tamMapa = (size_t) info.st_size;
+        *mapa = (unsigned char*) mmap(NULL, *tamMapa, PROT_READ | PROT_WRITE,
+                                      somenteLeitura ? MAP_PRIVATE : MAP_SHARED, *fd, 0);
+        if (*mapa == MAP_FAILED) return 0;
+        uint32_t cab[2];
+        memcpy(cab, *mapa, 8);
+        if (cab[0] != magico || cab[1] != VERSAO_HISTORICO) return 0;
+        memcpy(contador, *mapa + 8, 8);
+    } else {
+        // Arquivo novo: cria o cabeçalho
+        if (somenteLeitura) return 0;
+        if (!crescerMapa(*fd, mapa, tamMapa, TAM_CABECALHO_HIST)) return 0;
+        uint32_t cab[2] = {magico, VERSAO_HISTORICO};
+        memcpy(*mapa, cab, 8);
+        *contador = 0;
+        memcpy(*mapa + 8, contador, 8);
+    }
+    return 1;
+}
+
+// Abre o arquivo de histórico <prefixo>.hist / <prefixo>.nomes
+// 'somenteLeitura': só consulta os arquivos existentes (ver abrirMapa)
+// Retorna NULL se não for possível abrir ou se os arquivos forem inválidos
+ArquivoHistorico* abrirArquivoHistorico(const char* prefixo, int somenteLeitura) {
+    ArquivoHistorico* a = (ArquivoHistorico*) calloc(1, sizeof(ArquivoHistorico));
+    if (a == NULL) return NULL;
+    a->fdRegistros = -1;
+    a->fdNomes = -1;
+
+    char caminho[TAM_CAMINHO + 8];
+    snprintf(caminho, sizeof(caminho), "%s.hist", prefixo);
+    int ok = abrirMapa(caminho, MAGICO_HISTORICO, somenteLeitura, &a->fdRegistros,
+                       &a->mapaRegistros, &a->tamMapaRegistros, &a->quantidade);
+    if (ok) {
+        snprintf(caminho, sizeof(caminho), "%s.nomes", prefixo);
+        ok = abrirMapa(caminho, MAGICO_NOMES_HIST, somenteLeitura, &a->fdNomes,
+                       &a->mapaNomes, &a->tamMapaNomes, &a->usadoNomes);
+    }
+    // Confere se os contadores cabem nos arquivos (arquivo truncado)
+    if (ok && (TAM_CABECALHO_HIST + a->quantidade * sizeof(RegistroHistorico) > a->tamMapaRegistros ||
+               TAM_CABECALHO_HIST + a->usadoNomes > a->tamMapaNomes)) {
+        ok = 0;
+    }
+    if (!ok) {
+        if (a->mapaRegistros != NULL && a->mapaRegistros != MAP_FAILED) munmap(a->mapaRegistros, a->tamMapaRegistros);
+        if (a->mapaNomes != NULL && a->mapaNomes != MAP_FAILED) munmap(a->mapaNomes, a->tamMapaNomes);
+        if (a->fdRegistros >= 0) close(a->fdRegistros);
+        if (a->fdNomes >= 0) close(a->fdNomes);
+        free(a);
+        return NULL;
+    }
+    return a;
+}
+
+// Anexa um atendimento ao fim do arquivo; retorna sua posição ou -1
+static long long anexarArquivoHistorico(ArquivoHistorico* a, Paciente p) {
+    const char* nome = obterNome(p.nome);
+    uint32_t tamNome = (uint32_t) strlen(nome);
+
+    size_t fimRegistros = TAM_CABECALHO_HIST + (size_t) (a->quantidade + 1) * sizeof(RegistroHistorico);
+    size_t fimNomes = TAM_CABECALHO_HIST + (size_t) a->usadoNomes + tamNome + 1;
+    if (!crescerMapa(a->fdRegistros, &a->mapaRegistros, &a->tamMapaRegistros, fimRegistros) ||
+        !crescerMapa(a->fdNomes, &a->mapaNomes, &a->tamMapaNomes, fimNomes))
+        return -1;
+
+    memcpy(a->mapaNomes + TAM_CABECALHO_HIST + a->usadoNomes, nome, tamNome + 1);
+
+    RegistroHistorico* r = registroHistorico(a, a->quantidade);
+    r->id = p.id;
+    r->idade = p.idade;
+    r->prioridade = p.prioridade;
+    r->reservado = 0;
+    r->tamNome = tamNome;
+    r->reservado2 = 0;
+    r->posNome = a->usadoNomes;
+
+    a->usadoNomes += tamNome + 1;
+    a->quantidade++;
+    atualizarCabecalhosHistorico(a);
+    return (long long) (a->quantidade - 1);
+}
+
+// Garante que o conteúdo mapeado foi gravado no disco
+void sincronizarArquivoHistorico(ArquivoHistorico* a) {
+    msync(a->mapaRegistros, a->tamMapaRegistros, MS_SYNC);
+    msync(a->mapaNomes, a->tamMapaNomes, MS_SYNC);
+}
+
+// Fecha o arquivo de histórico (os dados continuam no disco)
+void fecharArquivoHistorico(ArquivoHistorico* a) {
+    if (a == NULL) return;
+    atualizarCabecalhosHistorico(a);
+    sincronizarArquivoHistorico(a);
+    munmap(a->mapaRegistros, a->tamMapaRegistros);
+    munmap(a->mapaNomes, a->tamMapaNomes);
+    close(a->fdRegistros);
+    close(a->fdNomes);
+    free(a);
+}
+
+#else  // _WIN32: arquivo de histórico indisponível (sem mmap POSIX)
+
+ArquivoHistorico* abrirArquivoHistorico(const char* prefixo, int somenteLeitura) {
+    (void) prefixo;
+    if (somenteLeitura) return NULL;
+    fprintf(stderr, "AVISO: Arquivo de histórico não suportado no Windows.\n");
+    return NULL;
+}
+static long long anexarArquivoHistorico(ArquivoHistorico* a, Paciente p) {
+    (void) a; (void) p;
+    return -1;
+}
+void sincronizarArquivoHistorico(ArquivoHistorico* a) { (void) a; }
+void fecharArquivoHistorico(ArquivoHistorico* a) { (void) a; }
+
+#endif
+
+// Descarta os registros a partir da posição 'quantidade' (e seus nomes)
+// Usado ao desfazer atendimentos que já estavam no arquivo e ao
+// recuperar o estado de um snapshot
+void truncarArquivoHistorico(ArquivoHistorico* a, uint64_t quantidade) {
+    if (quantidade >= a->quantidade) return;
+    a->quantidade = quantidade;
+    a->usadoNomes = quantidade == 0 ? 0
+                  : registroHistorico(a, quantidade - 1)->posNome +
+                    registroHistorico(a, quantidade - 1)->tamNome + 1;
+    atualizarCabecalhosHistorico(a);
+}
+
+// Converte o registro da posição 'pos' em Paciente
+// O nome é gravado no armazém de nomes (nomes repetidos não ocupam espaço)
+static Paciente pacienteDoArquivo(ArquivoHistorico* a, uint64_t pos) {
+    RegistroHistorico* r = registroHistorico(a, pos);
+    Paciente p;
+    p.id = r->id;
+    p.idade = r->idade;
+    p.prioridade = r->prioridade;
+    p.reservado = 0;
+    p.nome = internarNome(nomeRegistro(a, r));
+    if (p.nome == NOME_FALHA) p.nome = 0;
+    return p;
+}
+
+// Liga um arquivo de histórico à pilha; atendimentos já gravados nele
+// passam a fazer parte do histórico (abaixo dos que estão em memória)
+// Retorna 1 se conseguiu, 0 se faltou memória para o índice
+int ligarArquivoHistorico(Pilha* p, ArquivoHistorico* a) {
+    p->arquivo = a;
+    for (uint64_t i = 0; i < a->quantidade; i++) {
+        if (!inserirIndice(&p->indice, registroHistorico(a, i)->id, POSICAO_PARA_INDICE(i)))
+            return 0;
+    }
+    return 1;
+}
+
+// Move os atendimentos mais antigos em memória para o arquivo até que
+// restem no máximo 'limiteQuentes' nós
+// Enquanto houver registros protegidos retirados (ver
+// atualizarCabecalhosHistorico), nada desce: anexar sobrescreveria um
+// deles, e os nós esperam em memória pelo próximo snapshot
+static void descerParaArquivo(Pilha* p) {
+    while (p->quentes > p->limiteQuentes && p->arquivo->quantidade >= p->arquivo->protegidos) {
+        NoPilha* velho = p->base;
+        long long pos = anexarArquivoHistorico(p->arquivo, velho->dados);
+        if (pos < 0) {
+            fprintf(stderr, "AVISO: Falha ao gravar o arquivo de histórico.\n");
+            return;  // Mantém em memória
+        }
+        // O índice passa a apontar para a posição no arquivo
+        inserirIndice(&p->indice, velho->dados.id, POSICAO_PARA_INDICE(pos));
+
+        p->base = velho->ant;
+        p->base->prox = NULL;
+        p->quentes--;
+        liberarNo(p->pool, velho);
+    }
+}
+
+// Quantidade total de atendimentos no histórico (memória + arquivo)
+size_t tamanhoPilha(const Pilha* p) {
+    return p->quentes + (p->arquivo != NULL ? (size_t) p->arquivo->quantidade : 0);
+}
+
+// ============= FUNÇÕES DE PILHA =============
+// Pilha é usada para manter histórico de atendimentos (LIFO)
+
+// Adiciona um novo atendimento ao topo da pilha
+void push(Pilha* p, Paciente paciente) {
+    // Aloca memória para um novo nó no histórico
+    NoPilha* novo = (NoPilha*) alocarNo(p->pool);
+    if (novo == NULL) {
+        printf("Erro de alocação.\n");
+        return;
+    }
+
+    // Registra o atendimento no índice de IDs do histórico
+    if (!inserirIndice(&p->indice, paciente.id, novo)) {
+        printf("Erro de alocação.\n");
+        liberarNo(p->pool, novo);
+        return;
+    }
+
+    novo->dados = paciente;      // Armazena o paciente atendido
+    novo->prox = p->topo;        // Novo aponta para o antigo topo
+    novo->ant = NULL;
+    if (p->topo != NULL)
+        p->topo->ant = novo;     // Antigo topo aponta de volta para o novo
+    else
+        p->base = novo;          // Pilha estava vazia: novo também é a base
+    p->topo = novo;              // Novo se torna o topo
+    p->quentes++;
+
+    if (p->diario != NULL) diarioPaciente(p->diario, REG_PUSH, paciente);
+    if (p->nomes != NULL) indexarNome(p->nomes, paciente.id, obterNome(paciente.nome));
+
+    // Com arquivo, a memória guarda só os atendimentos mais recentes
+    if (p->arquivo != NULL && p->quentes > p->limiteQuentes) descerParaArquivo(p);
+}
+
+// Remove e retorna o elemento do topo da pilha
+// Retorna 1 se bem-sucedido, 0 se pilha vazia
+// Se não houver atendimentos em memória, o último do arquivo é retirado
+int pop(Pilha* p, Paciente* paciente) {
+    // Verifica se pilha está vazia
+    if (p->topo == NULL) {
+        if (p->arquivo == NULL || p->arquivo->quantidade == 0) return 0;
+
+        uint64_t ultimo = p->arquivo->quantidade - 1;
+        *paciente = pacienteDoArquivo(p->arquivo, ultimo);
+        truncarArquivoHistorico(p->arquivo, ultimo);
+        removerIndice(&p->indice, paciente->id);
+        if (p->diario != NULL) diarioSimples(p->diario, REG_POP);
+        return 1;
+    }
+
+    // Salva o topo atual
+    NoPilha* temp = p->topo;
+    // Copia os dados para o ponteiro fornecido
+    *paciente = temp->dados;
+    // Atualiza topo para o próximo nó
+    p->topo = temp->prox;
+    if (p->topo != NULL)
+        p->topo->ant = NULL;
+    else
+        p->base = NULL;          // Não restou nada em memória
+    p->quentes--;
+    removerIndice(&p->indice, paciente->id);
+    if (p->diario != NULL) diarioSimples(p->diario, REG_POP);
+
+    // Devolve o nó removido ao pool
+    liberarNo(p->pool, temp);
+    return 1;  // Sucesso
+}
+
+// Consulta o último atendimento sem retirá-lo da pilha
+// Retorna 1 se havia algum, 0 se a pilha está vazia
+int topoPilha(Pilha* p, Paciente* paciente) {
+    if (p->topo != NULL) {
+        *paciente = p->topo->dados;
+        return 1;
+    }
+    if (p->arquivo == NULL || p->arquivo->quantidade == 0) return 0;
+    *paciente = pacienteDoArquivo(p->arquivo, p->arquivo->quantidade - 1);
+    return 1;
+}
+
+// ============= HISTÓRICO PAGINADO =============
+// O histórico é percorrido por faixas: primeiro os nós em memória (do
+// topo para a base), depois o arquivo (do mais recente para o mais
+// antigo), sem nunca montar a lista completa
+
+// Iterador sobre o histórico, do atendimento mais recente para o mais antigo
+typedef struct {
+    Pilha* pilha;
+    NoPilha* no;        // Próximo nó em memória (NULL = já no arquivo)
+    uint64_t restantes; // Registros do arquivo ainda não visitados
+} IteradorHistorico;
+
+// Posiciona o iterador no atendimento de número 'inicio' (0 = mais recente)
+void iniciarIteradorHistorico(IteradorHistorico* it, Pilha* p, size_t inicio) {
+    it->pilha = p;
+    it->no = p->topo;
+    it->restantes = p->arquivo != NULL ? p->arquivo->quantidade : 0;
+
+    // Pula os nós em memória (no máximo limiteQuentes) ...
+    while (inicio > 0 && it->no != NULL) {
+        it->no = it->no->prox;
+        inicio--;
+    }
+    // ... e salta direto para a posição no arquivo
+    it->restantes = inicio < it->restantes ? it->restantes - inicio : 0;
+}
+
+// Avança o iterador; preenche o paciente e o texto do nome
+// Retorna 0 quando o histórico terminou
+int proximoHistorico(IteradorHistorico* it, Paciente* p, const char** nome) {
+    if (it->no != NULL) {
+        *p = it->no->dados;
+        *nome = obterNome(p->nome);
+        it->no = it->no->prox;
+        return 1;
+    }
+    if (it->restantes == 0) return 0;
+
+    // O nome vem direto do arquivo mapeado, sem passar pelo armazém
+    ArquivoHistorico* a = it->pilha->arquivo;
+    RegistroHistorico* r = registroHistorico(a, --it->restantes);
+    p->id = r->id;
+    p->idade = r->idade;
+    p->prioridade = r->prioridade;
+    p->reservado = 0;
+    p->nome = 0;
+    *nome = nomeRegistro(a, r);
+    return 1;
+}
+
+// Lista o histórico do mais recente para o mais antigo, com filtros e
+// paginação (ver listarFila). Sem filtro de prioridade, 'inicio' é pulado
+// direto (ver iniciarIteradorHistorico); com filtro, os atendimentos são
+// percorridos até completar o limite
+// Retorna quantos atendimentos foram listados
+size_t listarHistorico(Pilha* p, const OpcoesListagem* op) {
+    SaidaFormatada s;
+    iniciarSaida(&s, op->formato, "HISTÓRICO DE ATENDIMENTOS");
+
+    IteradorHistorico it;
+    Paciente paciente;
+    const char* nome;
+    size_t pular = op->prioridade != 0 ? op->inicio : 0;
+    size_t listados = 0;
+    iniciarIteradorHistorico(&it, p, op->prioridade != 0 ? 0 : op->inicio);
+    while ((op->limite == 0 || listados < op->limite) && proximoHistorico(&it, &paciente, &nome)) {
+        if (op->prioridade != 0 && paciente.prioridade != op->prioridade) continue;
+        if (pular > 0) {
+            pular--;
+            continue;
+        }
+        anexarPaciente(&s, paciente, nome, -1);
+        listados++;
+    }
+    finalizarSaida(&s);
+    return listados;
+}
+
+// Imprime em tabela os próximos 'quantidade' atendimentos do iterador, que
+// fica no seguinte: a página seguinte continua dali sem refazer o percurso
+// Retorna quantos foram impressos
+size_t imprimirPaginaHistorico(IteradorHistorico* it, size_t quantidade) {
+    SaidaFormatada s;
+    iniciarSaida(&s, FORMATO_TABELA, "HISTÓRICO DE ATENDIMENTOS");
+
+    Paciente paciente;
+    const char* nome;
+    size_t impressos = 0;
+    while (impressos < quantidade && proximoHistorico(it, &paciente, &nome)) {
+        anexarPaciente(&s, paciente, nome, -1);
+        impressos++;
+    }
+    finalizarSaida(&s);
+    return impressos;
+}
+
+// ============= FUNÇÕES DE LIMPEZA (LIBERAR MEMÓRIA) =============
+// Importante: evitar vazamento de memória ao encerrar o programa
+
+// Libera toda a memória da fila
+// Se a fila for a única estrutura ligada ao pool, todos os nós restantes
+// são dela e os slabs inteiros são liberados de uma vez; caso contrário
+// os nós são devolvidos um a um para o pool
+void destruirFila(Fila* fila) {
+    if (fila == NULL) return;
+
+    if (fila->pool->usuarios == 1) {
+        liberarSlabs(fila->pool);  // Libera todos os slabs de uma vez
+    } else {
+        // Percorre cada balde do início até o fim
+        for (int i = 0; i < NUM_PRIORIDADES; i++) {
+            No* atual = fila->baldes[i].inicio;
+            while (atual != NULL) {
+                No* temp = atual;      // Guarda referência ao nó atual
+                atual = atual->prox;   // Avança para o próximo antes de liberar
+                liberarNo(fila->pool, temp);  // Devolve o nó ao pool
+            }
+        }
+    }
+    fila->pool->usuarios--;
+
+    // Limpa os ponteiros e o índice
+    destruirIndice(&fila->indice);
+    for (int i = 0; i < NUM_PRIORIDADES; i++) {
+        fila->baldes[i].inicio = NULL;
+        fila->baldes[i].fim = NULL;
+        fila->baldes[i].quantidade = 0;
+        free(fila->baldes[i].arvore);
+        free(fila->baldes[i].porOrdem);
+        fila->baldes[i].arvore = NULL;
+        fila->baldes[i].porOrdem = NULL;
+        fila->baldes[i].capArvore = 0;
+        fila->baldes[i].primeiraOrdem = 0;
+        fila->baldes[i].proximaOrdem = 0;
+    }
+    fila->ocupados = 0;
+    fila->tamanho = 0;
+}
+
+// Libera toda a memória da pilha (histórico)
+// Mesma regra da fila: slabs inteiros quando for a última usuária do pool
+void destruirPilha(Pilha* p) {
+    if (p == NULL) return;
+
+    if (p->pool->usuarios == 1) {
+        liberarSlabs(p->pool);  // Libera todos os slabs de uma vez
+    } else {
+        // Percorre toda a pilha do topo até a base
+        NoPilha* atual = p->topo;
+        while (atual != NULL) {
+            NoPilha* temp = atual;  // Guarda referência ao nó atual
+            atual = atual->prox;    // Avança para o próximo antes de liberar
+            liberarNo(p->pool, temp);  // Devolve o nó ao pool
+        }
+    }
+    p->pool->usuarios--;
+
+    // Os atendimentos do arquivo continuam no disco
+    fecharArquivoHistorico(p->arquivo);
+
+    destruirIndice(&p->indice);
+    free(p);  // Libera a estrutura da pilha em si
+}
+
+// ============= FUNÇÕES DE BUSCA =============
+
+// Busca um paciente pelo ID na fila de espera e no histórico de atendimentos
+// Retorna os dados do paciente se encontrado, senão retorna um paciente vazio (ID=-1)
+// Consulta os índices hash da fila e da pilha: O(1) médio
+Paciente buscarPacientePorID(Fila* fila, Pilha* historico, int id) {
+    // Paciente marcador para "não encontrado"
+    Paciente vazio = {-1, 0, 0, PRIORIDADE_INVALIDA, 0};
+
+    // Primeiro procura entre os pacientes em espera
+    No* naFila = (No*) buscarIndice(&fila->indice, id);
+    if (naFila != NULL)
+        return naFila->dados;
+
+    // Depois procura no histórico de atendimentos
+    if (historico != NULL) {
+        void* valor = buscarIndice(&historico->indice, id);
+        if (valor != NULL && NO_ESTA_NO_ARQUIVO(valor))
+            return pacienteDoArquivo(historico->arquivo, INDICE_PARA_POSICAO(valor));
+        if (valor != NULL)
+            return ((NoPilha*) valor)->dados;
+    }
+
+    // Se chegou aqui, não encontrou - retorna paciente vazio
+    return vazio;
+}
+
+// Verifica se o ID já pertence a algum paciente (em espera ou atendido)
+int idCadastrado(Fila* fila, Pilha* historico, int id) {
+    return buscarPacientePorID(fila, historico, id).id != -1;
+}
+
+// Busca um paciente por ID registrando a operação nas métricas
+// (usada pelas buscas pedidas pelo usuário, não pelas verificações internas)
+Paciente consultarPaciente(Fila* fila, Pilha* historico, int id) {
+    uint64_t inicio = relogioNs();
+    Paciente p = buscarPacientePorID(fila, historico, id);
+    registrarOperacao(OPERACAO_BUSCAR, inicio, p.id != -1);
+    return p;
+}
+
+// Posição na fila registrando a operação nas métricas (0 = não está na fila)
+int consultarPosicao(Fila* fila, int id) {
+    uint64_t inicio = relogioNs();
+    int posicao = posicaoNaFila(fila, id);
+    registrarOperacao(OPERACAO_POSICAO, inicio, posicao != 0);
+    return posicao;
+}
+
+// ---------- Busca por nome ----------
+
+// Quantidade máxima de resultados de uma busca por nome
+#define MAX_RESULTADOS_NOME 20
+
+// Nome candidato de uma busca, com a sua pontuação
+typedef struct {
+    uint32_t nid;
+    int pontuacao;
+} CandidatoNome;
+
+// Ordena candidatos da maior para a menor pontuação; no empate, o nome
+// internado primeiro vem antes (nomes curtos já ganham em pontuarNome)
+static int compararCandidatos(const void* a, const void* b) {
+    const CandidatoNome* x = (const CandidatoNome*) a;
+    const CandidatoNome* y = (const CandidatoNome*) b;
+    if (x->pontuacao != y->pontuacao) return y->pontuacao > x->pontuacao ? 1 : -1;
+    return x->nid < y->nid ? -1 : (x->nid > y->nid);
+}
+
+// Ordena listas de trigramas da menor para a maior
+static int compararListas(const void* a, const void* b) {
+    uint32_t x = (*(ListaNids* const*) a)->quantidade;
+    uint32_t y = (*(ListaNids* const*) b)->quantidade;
+    return x < y ? -1 : (x > y);
+}
+
+// Trigramas de uma consulta: a lista e um mapa de bits para testar
+// rapidamente se um trigrama do nome pertence à consulta
+typedef struct {
+    uint32_t itens[TAM_NOME_NORMALIZADO];
+    int quantidade;
+    uint64_t mapa[(NUM_TRIGRAMAS + 63) / 64];
+} TrigramasConsulta;
+
+// Pontua o texto normalizado de um nome para a consulta (0 = descartado)
+// Os trigramas da consulta presentes no nome valem até 1000 pontos no
+// total; a consulta inteira dentro do nome soma 1000 (3000 no início do
+// nome, 2000 no início de uma palavra)
+// Com 'minimo' igual ao total de trigramas o chamador já sabe que todos
+// estão no nome (interseção das listas) e a contagem é pulada
+static int pontuarNome(const char* texto, const char* consulta,
+                       const TrigramasConsulta* tc, int minimo) {
+    uint64_t achados[(TAM_NOME_NORMALIZADO + 63) / 64] = {0};  // Por posição em tc->itens
+    int comuns = minimo == tc->quantidade ? minimo : 0;
+    size_t tamTexto = strlen(texto);
+    for (size_t i = 0; comuns < tc->quantidade && i + 3 <= tamTexto; i++) {
+        uint32_t t = numeroTrigrama(texto + i);
+        if (!(tc->mapa[t >> 6] & (1ull << (t & 63)))) continue;
+        for (int j = 0; j < tc->quantidade; j++) {
+            if (tc->itens[j] == t && !(achados[j >> 6] & (1ull << (j & 63)))) {
+                achados[j >> 6] |= 1ull << (j & 63);
+                comuns++;
+                break;
+            }
+        }
+    }
+    if (comuns < minimo) return 0;
+
+    int pontuacao = 1000 * comuns / tc->quantidade;
+    const char* achou = strstr(texto, consulta);
+    if (achou != NULL) {
+        // Primeira letra encontrada (a consulta pode começar com o espaço)
+        const char* letra = consulta[0] == ' ' ? achou + 1 : achou;
+        if (letra == texto + 1) pontuacao += 3000;       // Início do nome
+        else if (letra[-1] == ' ') pontuacao += 2000;    // Início de palavra
+        else pontuacao += 1000;
+    }
+    return pontuacao - (int) (tamTexto > 100 ? 100 : tamTexto);    // Nomes curtos primeiro
+}
+
+// Vetor de candidatos de uma busca
+typedef struct {
+    CandidatoNome* itens;
+    size_t quantidade;
+    size_t capacidade;
+} ListaCandidatos;
+
+// Pontua o nome 'nid' e, se ele passar, o inclui entre os candidatos
+static void avaliarCandidato(IndiceNomes* ix, ListaCandidatos* lista, uint32_t nid,
+                             const char* texto, const TrigramasConsulta* tc, int minimo) {
+    if (ix->marca[nid] == ix->geracaoBusca) return;  // Já avaliado nesta busca
+    ix->marca[nid] = ix->geracaoBusca;
+    if (ix->primeiroPaciente[nid] == 0) return;
+
+    int pontuacao = pontuarNome(ix->textos + ix->inicioTexto[nid], texto, tc, minimo);
+    if (pontuacao <= 0) return;
+    if (lista->quantidade == lista->capacidade) {
+        size_t nova = lista->capacidade == 0 ? 64 : lista->capacidade * 2;
+        CandidatoNome* maior = (CandidatoNome*) realloc(lista->itens, nova * sizeof(CandidatoNome));
+        if (maior == NULL) return;
+        lista->itens = maior;
+        lista->capacidade = nova;
+    }
+    lista->itens[lista->quantidade].nid = nid;
+    lista->itens[lista->quantidade].pontuacao = pontuacao;
+    lista->quantidade++;
+}
+
+// Primeira posição de 'lista' a partir de 'inicio' com valor >= nid
+// (as listas de trigramas são crescentes: nids novos vão para o fim)
+static uint32_t buscarNaLista(const ListaNids* lista, uint32_t inicio, uint32_t nid) {
+    uint32_t fim = lista->quantidade;
+    while (inicio < fim) {
+        uint32_t meio = inicio + (fim - inicio) / 2;
+        if (lista->itens[meio] < nid) inicio = meio + 1;
+        else fim = meio;
+    }
+    return inicio;
+}
+
+// Copia para 'resultados' os pacientes dos melhores nomes, conferidos no
+// índice de IDs: quem saiu do sistema ou foi recadastrado com outro nome
+// é ignorado
+// Como cada nome tem ao menos um paciente, quase sempre bastam os
+// 'maximo' melhores: só eles são ordenados de início, e o resto só se
+// faltarem resultados
+static int expandirCandidatos(Fila* fila, Pilha* historico, ListaCandidatos* lista,
+                              Paciente* resultados, int encontrados, int maximo) {
+    IndiceNomes* ix = fila->nomes;
+    size_t melhores = (size_t) (maximo - encontrados);
+    if (melhores > lista->quantidade) melhores = lista->quantidade;
+
+    // Seleção por inserção: itens[0..melhores) ficam com os melhores, em ordem
+    for (size_t i = 0; i < lista->quantidade; i++) {
+        CandidatoNome c = lista->itens[i];
+        size_t j = i;
+        if (i >= melhores) {
+            if (melhores == 0 || compararCandidatos(&c, &lista->itens[melhores - 1]) >= 0)
+                continue;  // Não entra entre os melhores
+            lista->itens[i] = lista->itens[melhores - 1];  // O pior volta para o resto
+            j = melhores - 1;
+        }
+        while (j > 0 && compararCandidatos(&c, &lista->itens[j - 1]) < 0) {
+            lista->itens[j] = lista->itens[j - 1];
+            j--;
+        }
+        lista->itens[j] = c;
+    }
+
+    for (size_t c = 0; c < lista->quantidade && encontrados < maximo; c++) {
+        if (c == melhores && lista->quantidade - melhores > 1)
+            qsort(lista->itens + melhores, lista->quantidade - melhores, sizeof(CandidatoNome), compararCandidatos);
+        uint32_t pos = ix->primeiroPaciente[lista->itens[c].nid];
+        while (pos != 0 && encontrados < maximo) {
+            PacienteNome* entrada = &ix->pacientes[pos - 1];
+            uint32_t posEntrada = pos;
+            pos = entrada->prox;
+            if ((uintptr_t) buscarIndice(&ix->ids, entrada->id) != posEntrada) continue;  // Entrada velha
+            Paciente p = buscarPacientePorID(fila, historico, entrada->id);
+            if (p.id == -1) continue;
+            resultados[encontrados++] = p;
+        }
+    }
+    return encontrados;
+}
+
+// Busca pacientes (na fila e no histórico) pelo nome ou parte dele, sem
+// diferenciar maiúsculas nem acentos e tolerando pequenos erros
+// Preenche até 'maximo' resultados, do mais parecido para o menos
+// Retorna quantos encontrou, ou -1 se a consulta tiver menos de 2 letras
+//
+// Fase 1: só os nomes com todos os trigramas da consulta, achados pela
+// interseção das listas (partindo da mais curta). Costuma bastar e custa
+// proporcionalmente aos nomes que batem, não ao tamanho do índice.
+// Fase 2 (se faltarem resultados): nomes com pelo menos um terço dos
+// trigramas, para tolerar erros de digitação.
+int buscarPorNome(Fila* fila, Pilha* historico, const char* consulta,
+                  Paciente* resultados, int maximo) {
+    IndiceNomes* ix = fila->nomes;
+    char normalizada[TAM_NOME_NORMALIZADO];
+    size_t tamanho = normalizarNome(consulta, normalizada);
+    if (tamanho < 3 || ix == NULL) return tamanho < 3 ? -1 : 0;
+
+    // Com 2 letras, só nomes com uma palavra começando por elas (" jo");
+    // senão, qualquer parte do nome (sem o espaço inicial)
+    const char* texto = tamanho == 3 ? normalizada : normalizada + 1;
+    size_t tamTexto = tamanho == 3 ? tamanho : tamanho - 1;
+
+    // Trigramas distintos da consulta
+    static TrigramasConsulta tc;
+    memset(tc.mapa, 0, sizeof(tc.mapa));
+    tc.quantidade = 0;
+    for (size_t i = 0; i + 3 <= tamTexto; i++) {
+        uint32_t t = numeroTrigrama(texto + i);
+        if (tc.mapa[t >> 6] & (1ull << (t & 63))) continue;  // Repetido
+        tc.mapa[t >> 6] |= 1ull << (t & 63);
+        tc.itens[tc.quantidade++] = t;
+    }
+    int numTrigramas = tc.quantidade;
+    if (numTrigramas == 0) return 0;
+
+    ListaNids* listas[TAM_NOME_NORMALIZADO];
+    for (int t = 0; t < numTrigramas; t++) listas[t] = &ix->trigramas[tc.itens[t]];
+    qsort(listas, (size_t) numTrigramas, sizeof(ListaNids*), compararListas);
+
+    ListaCandidatos candidatos = {NULL, 0, 0};
+    ix->geracaoBusca++;
+
+    // ---------- Fase 1: interseção ----------
+    uint32_t posicoes[TAM_NOME_NORMALIZADO] = {0};
+    for (uint32_t k = 0; k < listas[0]->quantidade; k++) {
+        uint32_t nid = listas[0]->itens[k];
+        int emTodas = 1;
+        for (int l = 1; l < numTrigramas && emTodas; l++) {
+            posicoes[l] = buscarNaLista(listas[l], posicoes[l], nid);
+            emTodas = posicoes[l] < listas[l]->quantidade && listas[l]->itens[posicoes[l]] == nid;
+        }
+        if (emTodas) avaliarCandidato(ix, &candidatos, nid, texto, &tc, numTrigramas);
+    }
+    int encontrados = expandirCandidatos(fila, historico, &candidatos, resultados, 0, maximo);
+
+    // ---------- Fase 2: aproximada ----------
+    // Um nome precisa ter pelo menos um terço dos trigramas da consulta
+    // (um erro de digitação estraga até três). Então ele aparece em alguma
+    // das (n - minimo + 1) listas mais curtas: só elas geram candidatos
+    if (encontrados < maximo && numTrigramas > 1) {
+        int minimo = (numTrigramas + 2) / 3;
+        candidatos.quantidade = 0;
+        for (int l = 0; l <= numTrigramas - minimo; l++) {
+            for (uint32_t k = 0; k < listas[l]->quantidade; k++)
+                avaliarCandidato(ix, &candidatos, listas[l]->itens[k], texto, &tc, minimo);
+        }
+        encontrados = expandirCandidatos(fila, historico, &candidatos, resultados, encontrados, maximo);
+    }
+    free(candidatos.itens);
+    return encontrados;
+}
+
+// Busca por nome registrando a operação nas métricas
+int consultarPorNome(Fila* fila, Pilha* historico, const char* consulta,
+                     Paciente* resultados, int maximo) {
+    uint64_t inicio = relogioNs();
+    int encontrados = buscarPorNome(fila, historico, consulta, resultados, maximo);
+    registrarOperacao(OPERACAO_BUSCAR, inicio, encontrados > 0);
+    return encontrados;
+}
+
+// Liga um índice de nomes à fila e ao histórico, indexando quem já está
+// neles (inclusive os atendimentos no arquivo, lidos direto do mapeamento)
+// Retorna 0 se faltar memória
+int ligarIndiceNomes(IndiceNomes* ix, Fila* fila, Pilha* historico) {
+    for (int i = 0; i < NUM_PRIORIDADES; i++) {
+        for (No* atual = fila->baldes[i].inicio; atual != NULL; atual = atual->prox) {
+            if (!indexarNome(ix, atual->dados.id, obterNome(atual->dados.nome))) return 0;
+        }
+    }
+    IteradorHistorico it;
+    Paciente p;
+    const char* nome;
+    iniciarIteradorHistorico(&it, historico, 0);
+    while (proximoHistorico(&it, &p, &nome)) {
+        if (!indexarNome(ix, p.id, nome)) return 0;
+    }
+    fila->nomes = ix;
+    historico->nomes = ix;
+    return 1;
+}
+
+// Exibe o menu principal do sistema com todas as opções disponíveis
+void menu() {
+    printf("\n===== SISTEMA HOSPITALAR =====\n");
+    printf("1 - Inserir paciente na fila\n");
+    printf("2 - Atender paciente\n");
+    printf("3 - Desfazer última ação\n");
+    printf("4 - Buscar paciente por ID ou nome\n");
+    printf("5 - Mostrar fila de espera\n");
+    printf("6 - Mostrar histórico de atendimentos\n");
+    printf("7 - Exibir relatório do sistema\n");
+    printf("8 - Exibir métricas de desempenho\n");
+    printf("9 - Refazer ação desfeita\n");
+    printf("10 - Alterar prioridade (retriagem)\n");
+    printf("11 - Registrar desistência\n");
+    printf("0 - Sair\n");
+    printf("Escolha: ");
+}
+
+// ============= RASTRO DE COMANDOS =============
+// Com --gravar <arquivo>, cada comando executado pelo menu, pelo modo em
+// lote ou pelo servidor é anotado num rastro binário, com o instante em
+// que foi executado. --reproduzir passa o rastro de novo pelas mesmas
+// funções (ver REPRODUÇÃO DO RASTRO) e confere se a fila, o histórico e as
+// métricas terminam iguais: uma sessão real vira um teste de regressão.
+//
+// Formato (inteiros de 32/64 bits na ordem de bytes da máquina, como o diário):
+//   cabeçalho: [u32 mágico][u32 versão][u32 envelhecimento (ms)]
+//              [u32 profundidade do desfazer][u32 relógio inicial (ms)]
+//              [resumo do estado inicial: 3 x u64]
+//   comando:   [u8 letra do modo em lote][varint ms desde o anterior][campos]
+//              I: id, idade, prioridade e o nome terminado em '\0'
+//              T: id, prioridade   D, F, P: id   N: texto terminado em '\0'
+//              A, U, Y, R, M: sem campos
+//   fim:       ['Z'][varint ms][varint comandos][resumo do estado final]
+// Os campos são varints (7 bits por byte) em zigzag, pois os comandos
+// recusados, com valores negativos, também são anotados: um comando
+// típico ocupa de 2 a 10 bytes mais o nome.
+//
+// Enquanto grava, o relógio (relogioMs) fica parado no instante anotado
+// durante cada comando, e a reprodução liga o relógio virtual nos mesmos
+// instantes: envelhecimento e tempo de espera se repetem iguais.
+
+#define MAGICO_RASTRO 0x54534152u  // "RAST"
+#define VERSAO_RASTRO (1u | (VERSAO_DIARIO & 0xFFFF0000u))  // Muda com a escala de prioridades
+#define FIM_RASTRO 'Z'
+#define MAX_REGISTRO_RASTRO 32     // Maior comando sem o texto (letra + 4 varints)
+
+// Resumo (hash FNV-1a de 64 bits) do estado que a reprodução precisa repetir
+typedef struct {
+    uint64_t fila;      // Pacientes em espera, balde a balde, na ordem de atendimento
+    uint64_t historico; // Atendimentos, do mais recente ao mais antigo
+    uint64_t metricas;  // Contadores e operações realizadas/recusadas (sem latências)
+} ResumoEstado;
+
+// Rastro sendo gravado
+typedef struct {
+    FILE* arquivo;
+    uint32_t ultimoMs;     // Instante do comando anterior
+    uint64_t comandos;     // Comandos anotados
+} RastroComandos;
+
+// Rastro da sessão (NULL = não grava)
+RastroComandos* rastro = NULL;
+
+// Continua o hash FNV-1a de 64 bits 'h' com mais bytes
+static uint64_t somaResumo(uint64_t h, const void* dados, size_t tamanho) {
+    const unsigned char* p = (const unsigned char*) dados;
+    for (size_t i = 0; i < tamanho; i++) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// Campos do paciente que entram no resumo (a chegada não entra: a
+// reprodução repete o relógio, mas o resumo não deve depender dele)
+static uint64_t resumirPaciente(uint64_t h, Paciente p, const char* nome) {
+    h = somaResumo(h, &p.id, sizeof(p.id));
+    h = somaResumo(h, &p.idade, sizeof(p.idade));
+    h = somaResumo(h, &p.prioridade, sizeof(p.prioridade));
+    return somaResumo(h, nome, strlen(nome) + 1);
+}
+
+// Resumo da fila, do histórico (inclusive o arquivo) e das métricas
+ResumoEstado resumirEstado(const Fila* fila, Pilha* historico) {
+    const uint64_t base = 14695981039346656037ull;
+    ResumoEstado r;
+
+    uint64_t h = base;
+    for (int i = 0; i < NUM_PRIORIDADES; i++) {
+        h = somaResumo(h, &fila->baldes[i].quantidade, sizeof(int));
+        for (No* atual = fila->baldes[i].inicio; atual != NULL; atual = atual->prox) {
+            h = resumirPaciente(h, atual->dados, obterNome(atual->dados.nome));
+        }
+    }
+    r.fila = h;
+
+    h = base;
+    IteradorHistorico it;
+    Paciente p;
+    const char* nome;
+    iniciarIteradorHistorico(&it, historico, 0);
+    while (proximoHistorico(&it, &p, &nome)) h = resumirPaciente(h, p, nome);
+    r.historico = h;
+
+    h = base;
+    for (int i = 0; i < NUM_CONTADORES; i++) {
+        int v = metricas.contadores[i];
+        h = somaResumo(h, &v, sizeof(v));
+    }
+    for (int i = 0; i < NUM_OPERACOES; i++) {
+        uint64_t v[2] = {metricas.realizadas[i], metricas.recusadas[i]};
+        h = somaResumo(h, v, sizeof(v));
+    }
+    r.metricas = h;
+    return r;
+}
+
+// Escreve 'valor' com 7 bits por byte (bit alto ligado = há mais bytes)
+// Retorna quantos bytes usou (no máximo 10)
+static size_t codificarVarint(unsigned char* destino, uint64_t valor) {
+    size_t n = 0;
+    while (valor >= 0x80) {
+        destino[n++] = (unsigned char) (valor | 0x80);
+        valor >>= 7;
+    }
+    destino[n++] = (unsigned char) valor;
+    return n;
+}
+
+// Inteiro com sinal em zigzag: 0, -1, 1, -2... viram 0, 1, 2, 3...
+static uint32_t zigzag(int valor) {
+    return ((uint32_t) valor << 1) ^ (uint32_t) (valor >> 31);
+}
+
+// Abre o rastro e para o relógio até iniciarRastro, para que os pacientes
+// carregados do disco (chegada = relogioMs) recebam o instante inicial
+// que vai no cabeçalho. Retorna 0 se o arquivo não pôde ser criado
+int abrirRastro(const char* caminho) {
+    FILE* f = fopen(caminho, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "ERRO: Não foi possível criar o rastro '%s'.\n", caminho);
+        return 0;
+    }
+    RastroComandos* r = (RastroComandos*) calloc(1, sizeof(RastroComandos));
+    if (r == NULL) {
+        fclose(f);
+        fprintf(stderr, "ERRO: Memória insuficiente para o rastro.\n");
+        return 0;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+    r->arquivo = f;
+    r->ultimoMs = relogioMs();
+    agoraSimuladoMs = r->ultimoMs;
+    relogioSimulado = 1;
+    rastro = r;
+    return 1;
+}
+
+// Grava o cabeçalho com o estado já carregado e solta o relógio
+void iniciarRastro(Fila* fila, Pilha* historico) {
+    if (rastro == NULL) return;
+    uint32_t cabecalho[5] = {MAGICO_RASTRO, VERSAO_RASTRO, fila->envelhecimentoMs,
+                             (uint32_t) comandos.capacidade, rastro->ultimoMs};
+    ResumoEstado inicial = resumirEstado(fila, historico);
+    fwrite(cabecalho, sizeof(cabecalho), 1, rastro->arquivo);
+    fwrite(&inicial, sizeof(inicial), 1, rastro->arquivo);
+    relogioSimulado = 0;
+}
+
+// Anota um comando (antes de executá-lo) e para o relógio no instante
+// anotado até concluirComandoRastro. 'letra' é a do modo em lote; os
+// campos que o comando não usa são ignorados
+void anotarRastro(char letra, int id, int idade, int prioridade, const char* texto) {
+    if (rastro == NULL) return;
+    uint32_t agora = relogioMs();
+    unsigned char buf[MAX_REGISTRO_RASTRO];
+    size_t n = 0;
+    buf[n++] = (unsigned char) letra;
+    n += codificarVarint(buf + n, (uint32_t) (agora - rastro->ultimoMs));
+    switch (letra) {
+        case 'I':
+            n += codificarVarint(buf + n, zigzag(id));
+            n += codificarVarint(buf + n, zigzag(idade));
+            n += codificarVarint(buf + n, zigzag(prioridade));
+            break;
+        case 'T':
+            n += codificarVarint(buf + n, zigzag(id));
+            n += codificarVarint(buf + n, zigzag(prioridade));
+            break;
+        case 'D': case 'F': case 'P':
+            n += codificarVarint(buf + n, zigzag(id));
+            break;
+    }
+    fwrite(buf, 1, n, rastro->arquivo);
+    if (letra == 'I' || letra == 'N') {
+        if (texto == NULL) texto = "";
+        fwrite(texto, 1, strlen(texto) + 1, rastro->arquivo);
+    }
+    rastro->ultimoMs = agora;
+    rastro->comandos++;
+    agoraSimuladoMs = agora;
+    relogioSimulado = 1;
+}
+
+// Solta o relógio depois do comando anotado (nada a fazer sem rastro)
+void concluirComandoRastro() {
+    if (rastro != NULL) relogioSimulado = 0;
+}
+
+// Manda para o disco os comandos anotados até aqui; o menu e o servidor
+// chamam a cada volta do laço, junto com confirmarDiario, para que uma
+// sessão interrompida deixe o rastro até o último comando
+void descarregarRastro() {
+    if (rastro != NULL) fflush(rastro->arquivo);
+}
+
+// Grava o registro de fim com o estado final e fecha o rastro
+void encerrarRastro(Fila* fila, Pilha* historico) {
+    if (rastro == NULL) return;
+    unsigned char buf[MAX_REGISTRO_RASTRO];
+    size_t n = 0;
+    uint32_t agora = relogioMs();
+    buf[n++] = FIM_RASTRO;
+    n += codificarVarint(buf + n, (uint32_t) (agora - rastro->ultimoMs));
+    n += codificarVarint(buf + n, rastro->comandos);
+    ResumoEstado final = resumirEstado(fila, historico);
+    fwrite(buf, 1, n, rastro->arquivo);
+    fwrite(&final, sizeof(final), 1, rastro->arquivo);
+    int ok = fflush(rastro->arquivo) == 0 && !ferror(rastro->arquivo);
+    if (fclose(rastro->arquivo) != 0 || !ok) {
+        fprintf(stderr, "ERRO: Falha ao gravar o rastro de comandos.\n");
+    }
+    free(rastro);
+    rastro = NULL;
+    relogioSimulado = 0;
+}
+
+// ============= FUNÇÕES DE ENTRADA SEGURA =============
+// Estas funções tratam erros de entrada prevaimente e validam os dados
+// A entrada do console é lida linha a linha num buffer reaproveitado e
+// convertida sem scanf: cada resposta custa uma leitura, sem consumir o
+// resto da linha caractere por caractere
+
+// Indica que a entrada padrão terminou (Ctrl+D, Ctrl+Z ou fim do arquivo
+// redirecionado): o menu encerra o sistema em vez de repetir a pergunta
+int entradaEncerrada = 0;
+
+// Pula espaços e tabulações
+static char* pularEspacos(char* p) {
+    while (*p == ' ' || *p == '\t') p++;
+    return p;
+}
+
+// Lê um inteiro decimal a partir de *p e avança o ponteiro
+// Retorna 1 se havia um número, 0 caso contrário
+static int lerCampoInteiro(char** p, int* valor) {
+    char* c = pularEspacos(*p);
+    int negativo = 0;
+    if (*c == '-') {
+        negativo = 1;
+        c++;
+    }
+    if (*c < '0' || *c > '9') return 0;
+
+    long long v = 0;
+    while (*c >= '0' && *c <= '9') {
+        v = v * 10 + (*c - '0');
+        if (v > INT_MAX) return 0;  // Evita estouro
+        c++;
+    }
+    *valor = (int) (negativo ? -v : v);
+    *p = c;
+    return 1;
+}
+
+// Quando a última linha foi entregue (relogioNs; 0 = nenhuma ainda)
+// O tempo entre a entrega de uma linha e o pedido da seguinte é o tempo de
+// resposta do console (processar a linha e mostrar a próxima pergunta),
+// registrado nas métricas sem contar o tempo de digitação
+static uint64_t linhaEntregueEm = 0;
+
+// Lê uma linha inteira, de qualquer tamanho, sem o \n final, no buffer
+// informado (aumentado quando necessário). Retorna NULL se a entrada terminou.
+static char* lerLinhaNoBuffer(char** bufferLinha, size_t* capacidadeLinha) {
+    char* buffer = *bufferLinha;
+    size_t capacidade = *capacidadeLinha;
+    size_t usado = 0;
+
+    fflush(stdout);  // A pergunta precisa aparecer antes da espera
+    if (linhaEntregueEm != 0) registrarLatencia(&metricas.resposta, relogioNs() - linhaEntregueEm);
+
+    for (;;) {
+        // Garante espaço para mais um pedaço da linha
+        if (capacidade - usado < 128) {
+            size_t nova = capacidade == 0 ? 128 : capacidade * 2;
+            char* maior = (char*) realloc(buffer, nova);
+            if (maior == NULL) return NULL;
+            buffer = *bufferLinha = maior;
+            capacidade = *capacidadeLinha = nova;
+        }
+        if (fgets(buffer + usado, (int) (capacidade - usado), stdin) == NULL) {
+            if (usado == 0) {  // Fim da entrada sem nada lido
+                entradaEncerrada = 1;
+                linhaEntregueEm = 0;
+                return NULL;
+            }
+            break;
+        }
+        usado += strlen(buffer + usado);
+        // A linha terminou quando fgets encontrou o \n
+        if (usado > 0 && buffer[usado - 1] == '\n') {
+            buffer[--usado] = '\0';
+            break;
+        }
+    }
+    linhaEntregueEm = relogioNs();
+    return buffer;
+}
+
+// Lê uma linha inteira, de qualquer tamanho, sem o \n final
+// O texto fica num buffer interno reaproveitado: ele é válido até a
+// próxima chamada (lerInteiro usa outro buffer, então um nome lido aqui
+// continua válido enquanto a idade e a prioridade são lidas).
+// Retorna NULL se a entrada terminou.
+char* lerLinha() {
+    static char* buffer = NULL;
+    static size_t capacidade = 0;
+    return lerLinhaNoBuffer(&buffer, &capacidade);
+}
+
+// Lê um inteiro com validação de entrada e valor mínimo
+// A linha inteira deve ser o número (espaços em volta são aceitos)
+// Retorna -1 se houver erro (entrada inválida, valor abaixo do mínimo ou
+// fim da entrada, que também liga entradaEncerrada)
+int lerInteiro(int minimo) {
+    static char* buffer = NULL;
+    static size_t capacidade = 0;
+    char* linha = lerLinhaNoBuffer(&buffer, &capacidade);
+    if (linha == NULL) return -1;  // Fim da entrada: não há o que reclamar
+
+    int valor;
+    char* resto = linha;
+    if (!lerCampoInteiro(&resto, &valor) || *pularEspacos(resto) != '\0') {
+        printf("ERRO: Entrada inválida. Digite um número inteiro.\n");
+        return -1;
+    }
+
+    // Valida o valor mínimo
+    if (valor < minimo) {
+        printf("ERRO: Valor deve ser >= %d.\n", minimo);
+        return -1;
+    }
+
+    return valor;  // Retorna o valor lido e validado
+}
+
+// Pacientes exibidos por página no menu (fila e histórico)
+#define PACIENTES_POR_PAGINA 20
+
+// Imprime os pacientes em espera, ordenados por prioridade, página por
+// página (ver imprimirPilha)
+void imprimirFila(Fila* fila) {
+    if (fila->tamanho == 0) {
+        printf("Fila vazia.\n");
+        return;
+    }
+
+    // Cada página continua do nó em que a anterior parou
+    OpcoesListagem op = {FORMATO_TABELA, 0, PACIENTES_POR_PAGINA, 0};
+    No* proximo = NULL;
+    for (;;) {
+        op.inicio += listarFilaDesde(fila, &op, &proximo);
+        if (op.inicio >= (size_t) fila->tamanho) break;
+
+        printf("Mostrando %zu de %d. [Enter] próxima página, 0 para voltar: ", op.inicio, fila->tamanho);
+        const char* resposta = lerLinha();
+        if (resposta == NULL || resposta[0] == '0') break;
+    }
+}
+
+// Imprime o histórico de atendimentos (do mais recente para o mais antigo)
+// página por página; o usuário decide se quer ver a próxima
+void imprimirPilha(Pilha* p) {
+    if (p == NULL || tamanhoPilha(p) == 0) {
+        printf("Pilha vazia.\n");
+        return;
+    }
+
+    // Um só iterador para todas as páginas
+    IteradorHistorico it;
+    iniciarIteradorHistorico(&it, p, 0);
+    size_t total = tamanhoPilha(p);
+    size_t inicio = 0;
+    for (;;) {
+        inicio += imprimirPaginaHistorico(&it, PACIENTES_POR_PAGINA);
+        if (inicio >= total) break;
+
+        // Pergunta antes de mostrar a próxima página
+        printf("Mostrando %zu de %zu. [Enter] próxima página, 0 para voltar: ", inicio, total);
+        const char* resposta = lerLinha();
+        if (resposta == NULL || resposta[0] == '0') break;
+    }
+}
+
+// Interface de busca: solicita o ID ou parte do nome e exibe os pacientes
+void buscarPaciente(Fila* fila, Pilha* historico) {
+    printf("\nID ou nome do paciente: ");
+    char* entrada = lerLinha();
+    if (entrada == NULL) return;
+
+    // Só um número (espaços em volta são aceitos): busca por ID
+    char* c = pularEspacos(entrada);
+    char* resto = c;
+    int id;
+    int ehID = *c >= '0' && *c <= '9' && lerCampoInteiro(&resto, &id) && *pularEspacos(resto) == '\0';
+
+    if (ehID) {
+        anotarRastro('F', id, 0, 0, NULL);
+        Paciente p = consultarPaciente(fila, historico, id);
+        // Verifica se foi encontrado (ID=-1 significa não encontrado)
+        if (p.id == -1) {
+            printf("Paciente não encontrado.\n");
+        } else {
+            imprimirPaciente(p);  // Exibe os dados do paciente encontrado
+            // Informa onde o paciente está: aguardando ou já atendido
+            anotarRastro('P', id, 0, 0, NULL);
+            int posicao = consultarPosicao(fila, id);
+            if (posicao != 0)
+                printf("SITUAÇÃO: Aguardando na fila (posição %d de %d)\n", posicao, fila->tamanho);
+            else
+                printf("SITUAÇÃO: Já atendido (histórico)\n");
+        }
+        return;
+    }
+
+    // Busca por nome: lista os mais parecidos, um por linha
+    Paciente resultados[MAX_RESULTADOS_NOME];
+    anotarRastro('N', 0, 0, 0, c);
+    int encontrados = consultarPorNome(fila, historico, c, resultados, MAX_RESULTADOS_NOME);
+    if (encontrados < 0) {
+        printf("ERRO: Digite pelo menos 2 letras do nome.\n");
+    } else if (encontrados == 0) {
+        printf("Nenhum paciente encontrado.\n");
+    } else {
+        printf("\n=== PACIENTES ENCONTRADOS (%d) ===\n", encontrados);
+        for (int i = 0; i < encontrados; i++) {
+            Paciente p = resultados[i];
+            printf("ID %d | %s | %d anos | %s | %s\n", p.id, obterNome(p.nome), p.idade,
+                   obterNomePrioridade(p.prioridade),
+                   buscarIndice(&fila->indice, p.id) != NULL ? "Aguardando" : "Atendido");
+        }
+    }
+}
+
+// ============= OPERAÇÕES DO SISTEMA =============
+// Regras comuns ao menu interativo e ao modo em lote
+
+// ---------- Histórico de comandos (desfazer/refazer) ----------
+// Cadastros e atendimentos são anotados num anel de tamanho fixo
+// (comandos.capacidade), então desfazer e refazer custam O(1) e a memória
+// não cresce com o uso. O histórico vale só para a sessão: depois de uma
+// recuperação ele começa vazio, e desfazer volta a agir direto sobre o
+// último atendimento da pilha (desfazerAtendimento).
+
+// Define a profundidade do desfazer/refazer, descartando o histórico atual
+// Retorna 0 se faltar memória
+int configurarDesfazer(size_t profundidade) {
+    AcaoComando* acoes = NULL;
+    if (profundidade > 0) {
+        acoes = (AcaoComando*) malloc(profundidade * sizeof(AcaoComando));
+        if (acoes == NULL) return 0;
+    }
+    free(comandos.acoes);
+    comandos.acoes = acoes;
+    comandos.capacidade = profundidade;
+    comandos.inicio = 0;
+    comandos.desfaziveis = 0;
+    comandos.refaziveis = 0;
+    return 1;
+}
+
+// Libera o histórico de comandos
+void destruirComandos() {
+    free(comandos.acoes);
+    comandos.acoes = NULL;
+    comandos.capacidade = 0;
+    comandos.desfaziveis = 0;
+    comandos.refaziveis = 0;
+}
+
+// Ação na posição 'i' contada a partir da mais antiga
+static AcaoComando* acaoComando(size_t i) {
+    return &comandos.acoes[(comandos.inicio + i) % comandos.capacidade];
+}
+
+// Anota uma ação nova: as refazíveis deixam de valer e, com o anel cheio,
+// a mais antiga é esquecida
+// No atendimento, guarda de onde o paciente saiu da fila (ultimoNivel...)
+// Retorna a ação anotada, ou NULL se o histórico estiver desligado
+static AcaoComando* anotarComando(int tipo, Paciente p, const Fila* fila) {
+    if (comandos.capacidade == 0) return NULL;
+    if (comandos.desfaziveis == comandos.capacidade) {
+        comandos.inicio = (comandos.inicio + 1) % comandos.capacidade;
+        comandos.desfaziveis--;
+    }
+    AcaoComando* acao = acaoComando(comandos.desfaziveis);
+    acao->paciente = p;
+    acao->tipo = (int8_t) tipo;
+    acao->nivel = (int8_t) fila->ultimoNivel;
+    acao->chegada = fila->ultimaChegada;
+    acao->entradaNivel = fila->ultimaEntradaNivel;
+    acao->posicaoNivel = fila->ultimaPosicaoNivel;
+    comandos.desfaziveis++;
+    comandos.refaziveis = 0;
+    return acao;
+}
+
+// Insere um paciente já validado na fila e atualiza os contadores
+// Retorna 1 se conseguiu, 0 se o ID já estava em uso ou faltou memória
+// (nesse caso nada é contado nem anotado para desfazer)
+int registrarPaciente(Fila* fila, Pilha* historico, Paciente p) {
+    uint64_t inicio = relogioNs();
+    // Rejeita IDs já usados por pacientes em espera ou já atendidos; a
+    // inserção respeita a ordem de prioridade automaticamente
+    if (idCadastrado(fila, historico, p.id) || !inserirFila(fila, p)) {
+        registrarOperacao(OPERACAO_INSERIR, inicio, 0);
+        return 0;
+    }
+
+    // Incrementa counter global de pacientes cadastrados
+    alterarEstatistica(fila->diario, CONTADOR_CADASTRADOS, 1);
+    anotarComando(ACAO_CADASTRO, p, fila);
+    registrarOperacao(OPERACAO_INSERIR, inicio, 1);
+    return 1;
+}
+
+// Atende o próximo paciente: remove da fila e registra no histórico
+// Retorna 1 e preenche 'atendido' se havia alguém na fila, senão 0
+int atenderPaciente(Fila* fila, Pilha* historico, Paciente* atendido) {
+    uint64_t inicio = relogioNs();
+    // Remove o primeiro paciente (maior prioridade) da fila
+    *atendido = removerFila(fila);
+    // Verifica se conseguiu remover (ID != -1 significa sucesso)
+    if (atendido->id == -1) {
+        registrarOperacao(OPERACAO_ATENDER, inicio, 0);
+        return 0;
+    }
+
+    // Adiciona ao histórico (pilha) para permitir desfazer
+    push(historico, *atendido);
+
+    // Incrementa contador global de atendidos
+    alterarEstatistica(fila->diario, CONTADOR_ATENDIDOS, 1);
+    anotarComando(ACAO_ATENDIMENTO, *atendido, fila);
+    registrarOperacao(OPERACAO_ATENDER, inicio, 1);
+    registrarEspera(atendido->prioridade, fila->ultimaEspera);
+    return 1;
+}
+
+// Retriagem: muda a prioridade de um paciente em espera; ele vai para o
+// fim da nova prioridade (a espera continua contando desde a chegada), ou
+// fica onde está se já ocupa o balde dela (ver alterarPrioridadeFila)
+// Retorna 1 se conseguiu, 2 se ele já tinha essa prioridade (nada muda,
+// nem ele perde a vez), 0 se o paciente não está na fila
+int retriarPaciente(Fila* fila, int id, int prioridade) {
+    uint64_t inicio = relogioNs();
+    No* no = (No*) buscarIndice(&fila->indice, id);
+    if (no == NULL || !validarPrioridade(prioridade)) {
+        registrarOperacao(OPERACAO_PRIORIDADE, inicio, 0);
+        return 0;
+    }
+
+    if (no->dados.prioridade == prioridade) {
+        if (!saidaSilenciosa)
+            printf("Paciente %s já tem a prioridade %s.\n", obterNome(no->dados.nome),
+                   obterNomePrioridade(prioridade));
+        return 2;
+    }
+
+    Paciente antes = no->dados;
+    alterarPrioridadeFila(fila, id, prioridade);
+    AcaoComando* acao = anotarComando(ACAO_PRIORIDADE, antes, fila);
+    if (acao != NULL) acao->prioridade = (int8_t) prioridade;
+    registrarOperacao(OPERACAO_PRIORIDADE, inicio, 1);
+
+    if (!saidaSilenciosa)
+        printf("Paciente %s passou de %s para %s.\n", obterNome(antes.nome),
+               obterNomePrioridade(antes.prioridade), obterNomePrioridade(prioridade));
+    return 1;
+}
+
+// Desistência: o paciente sai da fila sem ser atendido, esteja onde estiver
+// Retorna 1 se conseguiu, 0 se o paciente não está na fila
+int registrarDesistencia(Fila* fila, int id) {
+    uint64_t inicio = relogioNs();
+    Paciente p;
+    if (!retirarFila(fila, id, &p)) {
+        registrarOperacao(OPERACAO_DESISTENCIA, inicio, 0);
+        return 0;
+    }
+    if (fila->nomes != NULL) esquecerNome(fila->nomes, id);
+    anotarComando(ACAO_DESISTENCIA, p, fila);
+    registrarOperacao(OPERACAO_DESISTENCIA, inicio, 1);
+
+    if (!saidaSilenciosa)
+        printf("Desistência de %s registrada.\n", obterNome(p.nome));
+    return 1;
+}
+
+// Interface da retriagem: pede o ID e a nova prioridade
+void retriarInterativo(Fila* fila) {
+    printf("\n=== RETRIAGEM ===\nID do paciente: ");
+    int id = lerInteiro(ID_MIN);
+    if (id == -1) return;
+    if (buscarIndice(&fila->indice, id) == NULL) {
+        printf("ERRO: O paciente %d não está na fila.\n", id);
+        anotarRastro('T', id, 0, 0, NULL);  // Recusada também na reprodução
+        recusarOperacao(OPERACAO_PRIORIDADE);
+        return;
+    }
+    printf("Nova prioridade ");
+    imprimirOpcoesPrioridade();
+    printf(": ");
+    int prioridade = lerInteiro(PRIORIDADE_MAXIMA);
+    if (prioridade == -1 || !validarPrioridade(prioridade)) {
+        printf("ERRO: Prioridade deve estar entre %d e %d.\n", PRIORIDADE_MAXIMA, PRIORIDADE_MINIMA);
+        return;
+    }
+    anotarRastro('T', id, 0, prioridade, NULL);
+    retriarPaciente(fila, id, prioridade);
+}
+
+// Interface da desistência: pede o ID
+void desistenciaInterativa(Fila* fila) {
+    printf("\n=== DESISTÊNCIA ===\nID do paciente: ");
+    int id = lerInteiro(ID_MIN);
+    if (id == -1) return;
+    anotarRastro('D', id, 0, 0, NULL);
+    if (!registrarDesistencia(fila, id))
+        printf("ERRO: O paciente %d não está na fila.\n", id);
+}
+
+// Coleta dados de um novo paciente via entrada do usuário e o insere na fila
+void cadastrarPaciente(Fila* fila, Pilha* historico) {
+    Paciente p;  // Cria estrutura local para armazenar os dados
+    p.reservado = 0;
+
+    printf("\n=== CADASTRO DE PACIENTE ===\n");
+
+    // ========== LER E VALIDAR ID ==========
+    printf("ID do paciente: ");
+    p.id = lerInteiro(ID_MIN);
+    if (p.id == -1) return;  // Se houve erro, aborta o cadastro
+
+    // Rejeita IDs já usados por pacientes em espera ou já atendidos
+    if (idCadastrado(fila, historico, p.id)) {
+        printf("ERRO: Já existe um paciente com o ID %d.\n", p.id);
+        anotarRastro('I', p.id, 0, 0, "");  // Recusado também na reprodução
+        recusarOperacao(OPERACAO_INSERIR);
+        return;
+    }
+
+    // ========== LER E VALIDAR NOME ==========
+    // O nome pode ter qualquer tamanho; ele só é gravado no armazém de
+    // nomes depois que todos os campos forem validados
+    printf("Nome do paciente: ");
+    const char* nome = lerLinha();
+    if (nome == NULL || strlen(nome) == 0) {  // Valida se nome não está vazio
+        printf("ERRO: Nome não pode ser vazio.\n");
+        return;
+    }
+
+    // ========== LER E VALIDAR IDADE ==========
+    printf("Idade do paciente: ");
+    int idade = lerInteiro(IDADE_MIN);
+    if (idade == -1 || !validarIdade(idade)) {  // Valida intervalo (1-150 anos)
+        printf("ERRO: Idade deve estar entre %d e %d anos.\n", IDADE_MIN, IDADE_MAX);
+        return;
+    }
+    p.idade = (uint16_t) idade;
+
+    // ========== LER E VALIDAR PRIORIDADE ==========
+    printf("Prioridade ");
+    imprimirOpcoesPrioridade();
+    printf(": ");
+    int prioridade = lerInteiro(PRIORIDADE_MAXIMA);
+    if (prioridade == -1 || !validarPrioridade(prioridade)) {  // Valida se está na escala
+        printf("ERRO: Prioridade deve estar entre %d e %d.\n", PRIORIDADE_MAXIMA, PRIORIDADE_MINIMA);
+        return;
+    }
+    p.prioridade = (int8_t) prioridade;
+
+    // ========== GRAVAR O NOME NO ARMAZÉM ==========
+    p.nome = internarNome(nome);
+    if (p.nome == NOME_FALHA) {
+        printf("ERRO: Falha na alocação de memória para o nome.\n");
+        return;
+    }
+
+    // ========== INSERIR NA FILA COM PRIORIDADE ==========
+    anotarRastro('I', p.id, p.idade, p.prioridade, nome);
+    registrarPaciente(fila, historico, p);
+}
+
+// Desfaz o último atendimento: remove da pilha e reinsere na fila
+// Útil quando houver engano no atendimento
+// Age direto sobre a pilha, sem o histórico de comandos: o paciente volta
+// ao início do balde da sua prioridade (atendidos saem sempre do início)
+int desfazerAtendimento(Fila* fila, Pilha* historico) {
+    uint64_t inicio = relogioNs();
+    // Valida se há algo para desfazer (histórico vazio)
+    if (historico == NULL || tamanhoPilha(historico) == 0) {
+        if (!saidaSilenciosa)
+            printf("Nao ha atendimentos para desfazer.\n");
+        registrarOperacao(OPERACAO_DESFAZER, inicio, 0);
+        return 0;
+    }
+
+    Paciente pacienteDesfeito;
+
+    // Remove o último atendimento da pilha (operação pop)
+    if (!pop(historico, &pacienteDesfeito)) {
+        registrarOperacao(OPERACAO_DESFAZER, inicio, 0);
+        return 0;
+    }
+
+    // Reinsere o paciente na frente dos demais da sua prioridade
+    uint32_t agora = relogioMs();
+    reinserirFila(fila, pacienteDesfeito, nivelDaPrioridade(pacienteDesfeito.prioridade), agora, agora);
+
+    if (!saidaSilenciosa)
+        printf("Atendimento de %s desfeito com sucesso.\n", obterNome(pacienteDesfeito.nome));
+
+    // Atualiza os contadores do sistema
+    alterarEstatistica(fila->diario, CONTADOR_ATENDIDOS, -1);  // Decrementa contador de atendidos
+    alterarEstatistica(fila->diario, CONTADOR_DESFEITOS, 1);   // Incrementa contador de desfeitos
+    registrarOperacao(OPERACAO_DESFAZER, inicio, 1);
+
+    return 1;  // Sucesso
+}
+
+// O histórico de comandos não corresponde mais à fila e à pilha: descarta
+static void descartarComandos() {
+    if (!saidaSilenciosa)
+        printf("ERRO: Histórico de desfazer inconsistente com a fila; ele foi descartado.\n");
+    comandos.desfaziveis = 0;
+    comandos.refaziveis = 0;
+}
+
+// Desfaz a última ação do histórico de comandos
+// - Atendimento: o paciente sai do topo da pilha e volta exatamente para
+//   o lugar de onde saiu (início do mesmo balde, com a mesma chegada) - O(1)
+// - Cadastro: o paciente sai da fila, esteja onde estiver - O(1)
+// - Retriagem e desistência: o paciente volta à prioridade e ao balde de
+//   antes, no lugar da sua entrada no nível - O(n) no balde
+// Sem ações no histórico, desfaz o último atendimento da pilha
+// Retorna 1 se algo foi desfeito, 0 caso contrário
+int desfazerComando(Fila* fila, Pilha* historico) {
+    if (comandos.desfaziveis == 0) {
+        comandos.refaziveis = 0;  // A pilha muda fora do histórico
+        return desfazerAtendimento(fila, historico);
+    }
+
+    uint64_t inicio = relogioNs();
+    AcaoComando* acao = acaoComando(comandos.desfaziveis - 1);
+    Paciente p;
+
+    if (acao->tipo == ACAO_ATENDIMENTO) {
+        if (!topoPilha(historico, &p) || p.id != acao->paciente.id) {
+            descartarComandos();
+            registrarOperacao(OPERACAO_DESFAZER, inicio, 0);
+            return 0;
+        }
+        pop(historico, &p);
+        reinserirFila(fila, p, acao->nivel, acao->chegada, acao->entradaNivel);
+        alterarEstatistica(fila->diario, CONTADOR_ATENDIDOS, -1);
+        if (!saidaSilenciosa)
+            printf("Atendimento de %s desfeito com sucesso.\n", obterNome(p.nome));
+    } else if (acao->tipo == ACAO_PRIORIDADE) {
+        No* no = (No*) buscarIndice(&fila->indice, acao->paciente.id);
+        if (no == NULL || no->dados.prioridade != acao->prioridade) {
+            descartarComandos();
+            registrarOperacao(OPERACAO_DESFAZER, inicio, 0);
+            return 0;
+        }
+        reposicionarFila(fila, acao->paciente.id, acao->paciente.prioridade, acao->nivel,
+                         acao->posicaoNivel, acao->entradaNivel);
+        if (!saidaSilenciosa)
+            printf("Retriagem de %s desfeita com sucesso.\n", obterNome(acao->paciente.nome));
+    } else if (acao->tipo == ACAO_DESISTENCIA) {
+        if (idCadastrado(fila, historico, acao->paciente.id)) {
+            descartarComandos();
+            registrarOperacao(OPERACAO_DESFAZER, inicio, 0);
+            return 0;
+        }
+        restaurarFila(fila, acao->paciente, acao->nivel, acao->posicaoNivel, acao->chegada, acao->entradaNivel);
+        if (!saidaSilenciosa)
+            printf("Desistência de %s desfeita com sucesso.\n", obterNome(acao->paciente.nome));
+    } else {
+        if (!retirarFila(fila, acao->paciente.id, &p)) {
+            descartarComandos();
+            registrarOperacao(OPERACAO_DESFAZER, inicio, 0);
+            return 0;
+        }
+        if (fila->nomes != NULL) esquecerNome(fila->nomes, p.id);
+        alterarEstatistica(fila->diario, CONTADOR_CADASTRADOS, -1);
+        if (!saidaSilenciosa)
+            printf("Cadastro de %s desfeito com sucesso.\n", obterNome(p.nome));
+    }
+    alterarEstatistica(fila->diario, CONTADOR_DESFEITOS, 1);
+
+    comandos.desfaziveis--;
+    comandos.refaziveis++;
+    registrarOperacao(OPERACAO_DESFAZER, inicio, 1);
+    return 1;
+}
+
+// Refaz a última ação desfeita - O(1)
+// O atendimento e a desistência refeitos tiram da fila o mesmo paciente
+// (pelo índice de IDs), mesmo que outro tenha passado à frente nesse meio
+// tempo; a retriagem refeita o leva de novo ao fim da nova prioridade
+// Retorna 1 se algo foi refeito, 0 caso contrário
+int refazerComando(Fila* fila, Pilha* historico) {
+    uint64_t inicio = relogioNs();
+    if (comandos.refaziveis == 0) {
+        if (!saidaSilenciosa)
+            printf("Não há ações para refazer.\n");
+        registrarOperacao(OPERACAO_REFAZER, inicio, 0);
+        return 0;
+    }
+
+    AcaoComando* acao = acaoComando(comandos.desfaziveis);
+    Paciente p = acao->paciente;
+
+    if (acao->tipo == ACAO_ATENDIMENTO) {
+        if (!retirarFila(fila, p.id, &p)) {
+            descartarComandos();
+            registrarOperacao(OPERACAO_REFAZER, inicio, 0);
+            return 0;
+        }
+        push(historico, p);
+        // De onde ele saiu agora, para um próximo desfazer
+        acao->nivel = (int8_t) fila->ultimoNivel;
+        acao->chegada = fila->ultimaChegada;
+        acao->entradaNivel = fila->ultimaEntradaNivel;
+        acao->posicaoNivel = fila->ultimaPosicaoNivel;
+        alterarEstatistica(fila->diario, CONTADOR_ATENDIDOS, 1);
+        if (!saidaSilenciosa)
+            printf("Atendimento de %s refeito com sucesso.\n", obterNome(p.nome));
+    } else if (acao->tipo == ACAO_PRIORIDADE || acao->tipo == ACAO_DESISTENCIA) {
+        int refeito = acao->tipo == ACAO_PRIORIDADE ? alterarPrioridadeFila(fila, p.id, acao->prioridade)
+                                                    : retirarFila(fila, p.id, &p);
+        if (!refeito) {
+            descartarComandos();
+            registrarOperacao(OPERACAO_REFAZER, inicio, 0);
+            return 0;
+        }
+        if (acao->tipo == ACAO_DESISTENCIA && fila->nomes != NULL) esquecerNome(fila->nomes, p.id);
+        // De onde ele saiu agora, para um próximo desfazer
+        acao->nivel = (int8_t) fila->ultimoNivel;
+        acao->chegada = fila->ultimaChegada;
+        acao->entradaNivel = fila->ultimaEntradaNivel;
+        acao->posicaoNivel = fila->ultimaPosicaoNivel;
+        if (!saidaSilenciosa)
+            printf("%s de %s refeita com sucesso.\n",
+                   acao->tipo == ACAO_PRIORIDADE ? "Retriagem" : "Desistência", obterNome(p.nome));
+    } else {
+        if (idCadastrado(fila, historico, p.id) || !inserirFila(fila, p)) {
+            descartarComandos();
+            registrarOperacao(OPERACAO_REFAZER, inicio, 0);
+            return 0;
+        }
+        alterarEstatistica(fila->diario, CONTADOR_CADASTRADOS, 1);
+        if (!saidaSilenciosa)
+            printf("Cadastro de %s refeito com sucesso.\n", obterNome(p.nome));
+    }
+
+    comandos.desfaziveis++;
+    comandos.refaziveis--;
+    registrarOperacao(OPERACAO_REFAZER, inicio, 1);
+    return 1;
+}
+
+// ============= PERSISTÊNCIA: SNAPSHOT E RECUPERAÇÃO =============
+// O estado é gravado em dois arquivos:
+//   <prefixo>.snap - cópia completa da fila, do histórico e dos contadores
+//   <prefixo>.wal  - alterações feitas depois do último snapshot
+// Cada .wal tem um número de geração. O snapshot guarda a geração do .wal
+// que ele já incorpora; ao iniciar, um .wal com geração menor ou igual é
+// descartado (o snapshot já contém suas alterações) e um .wal mais novo é
+// reproduzido sobre o snapshot.
+
+// fsync a cada N registros no menu interativo (cada operação é durável)
+#define DIARIO_LOTE_SYNC_INTERATIVO 1
+// fsync a cada N registros no modo em lote
+#define DIARIO_LOTE_SYNC_LOTE 256
+// Snapshot a cada N registros do diário
+#define DIARIO_INTERVALO_SNAPSHOT 100000
+
+// Escreve o cabeçalho de um .wal novo (vazio) com a geração atual
+static int iniciarArquivoWal(DiarioWAL* d) {
+    if (d->fd >= 0) close(d->fd);
+    d->fd = open(d->caminhoWal, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (d->fd < 0) return 0;
+
+    uint32_t cabecalho[2] = {MAGICO_WAL, VERSAO_DIARIO};
+    d->usado = 0;
+    anexarDiario(d, cabecalho, sizeof(cabecalho));
+    anexarDiario(d, &d->geracao, sizeof(d->geracao));
+    descarregarDiario(d);
+    fsync(d->fd);
+    d->pendentesSync = 0;
+    d->registrosDesdeSnapshot = 0;
+    return !d->falhou;
+}
+
+// Escreve um registro de paciente (parte fixa + nome) num arquivo
+// Com o nome passado à parte, serve também para atendimentos que estão no
+// arquivo de histórico, cujo nome não passa pelo armazém
+static void escreverRegistroPaciente(FILE* arq, Paciente p, int tipo, const char* nome) {
+    unsigned char fixo[12];
+    uint32_t tamNome = (uint32_t) strlen(nome);
+    fwrite(fixo, 1, codificarPaciente(fixo, tipo, p, tamNome), arq);
+    fwrite(nome, 1, tamNome, arq);
+}
+
+// Escreve um paciente no snapshot: parte fixa + nome
+// O primeiro byte (o tipo, nos registros do diário) guarda 1 + o balde em
+// que um paciente da fila está, para manter promoções do envelhecimento;
+// no histórico ele é 0. Os da fila são seguidos pelos seus horários (ver
+// gravarSnapshot)
+static void escreverPacienteSnapshot(FILE* arq, Paciente p, int balde) {
+    escreverRegistroPaciente(arq, p, balde, obterNome(p.nome));
+}
+
+// Grava o estado completo no .snap e recomeça o .wal na geração seguinte
+// Retorna 1 se conseguiu, 0 em caso de erro (o .wal atual é mantido)
+int gravarSnapshot(DiarioWAL* d, Fila* fila, Pilha* historico) {
+    // Tudo o que já foi registrado precisa estar no disco antes
+    descarregarDiario(d);
+    fsync(d->fd);
+    d->pendentesSync = 0;
+
+    // Grava num arquivo temporário e só depois troca pelo definitivo,
+    // assim uma queda no meio da gravação não estraga o snapshot anterior
+    char temporario[TAM_CAMINHO + 8];
+    snprintf(temporario, sizeof(temporario), "%s.tmp", d->caminhoSnap);
+    FILE* arq = fopen(temporario, "wb");
+    if (arq == NULL) return 0;
+    setvbuf(arq, NULL, _IOFBF, 1 << 20);
+
+    // O arquivo de histórico precisa estar no disco antes do snapshot que
+    // o referencia
+    if (historico->arquivo != NULL) sincronizarArquivoHistorico(historico->arquivo);
+
+    // Quantidades: fila, histórico em memória, histórico no arquivo
+    uint32_t cabecalho[2] = {MAGICO_SNAP, VERSAO_DIARIO};
+    uint64_t quantidades[3] = {(uint64_t) fila->tamanho, (uint64_t) historico->quentes,
+                               historico->arquivo != NULL ? historico->arquivo->quantidade : 0};
+    fwrite(cabecalho, sizeof(cabecalho), 1, arq);
+    fwrite(&d->geracao, sizeof(d->geracao), 1, arq);
+    int contadores[NUM_CONTADORES];
+    for (int i = 0; i < NUM_CONTADORES; i++) contadores[i] = metricas.contadores[i];
+    fwrite(contadores, sizeof(contadores), 1, arq);
+    fwrite(quantidades, sizeof(quantidades), 1, arq);
+
+    // Fila na ordem de atendimento (balde por balde), cada paciente com a
+    // chegada e a entrada no nível, para a espera e o envelhecimento
+    // continuarem de onde pararam
+    for (int i = 0; i < NUM_PRIORIDADES; i++) {
+        for (No* atual = fila->baldes[i].inicio; atual != NULL; atual = atual->prox) {
+            int64_t horarios[2] = {instanteParaParede(atual->chegada), instanteParaParede(atual->entradaNivel)};
+            escreverPacienteSnapshot(arq, atual->dados, 1 + i);
+            fwrite(horarios, sizeof(horarios), 1, arq);
+        }
+    }
+    // Histórico em memória do topo até a base (o restante está no arquivo)
+    for (NoPilha* atual = historico->topo; atual != NULL; atual = atual->prox) {
+        escreverPacienteSnapshot(arq, atual->dados, 0);
+    }
+
+    int ok = fflush(arq) == 0 && !ferror(arq);
+    if (ok) fsync(fileno(arq));
+    fclose(arq);
+    if (!ok) {
+        remove(temporario);
+        return 0;
+    }
+#ifdef _WIN32
+    remove(d->caminhoSnap);  // rename não substitui arquivos no Windows
+#endif
+    if (rename(temporario, d->caminhoSnap) != 0) return 0;
+    if (historico->arquivo != NULL) protegerArquivoHistorico(historico->arquivo);
+
+    // O snapshot já contém esta geração: o .wal recomeça vazio na próxima
+    d->geracao++;
+    return iniciarArquivoWal(d);
+}
+
+// Lê um paciente do snapshot; retorna 1 se conseguiu
+// Em *balde devolve o primeiro byte do registro (ver escreverPacienteSnapshot)
+// 'nome' é um buffer reaproveitado, aumentado conforme necessário
+static int lerPacienteSnapshot(FILE* arq, Paciente* p, int* balde, char** nome, size_t* capNome) {
+    unsigned char fixo[12];
+    uint32_t tamNome;
+    if (fread(fixo, 1, 12, arq) != 12) return 0;
+    *balde = fixo[0];
+    memcpy(&p->id, fixo + 1, 4);
+    memcpy(&p->idade, fixo + 5, 2);
+    p->prioridade = (int8_t) fixo[7];
+    p->reservado = 0;
+    memcpy(&tamNome, fixo + 8, 4);
+
+    if (tamNome + 1 > *capNome) {
+        char* maior = (char*) realloc(*nome, tamNome + 1);
+        if (maior == NULL) return 0;
+        *nome = maior;
+        *capNome = tamNome + 1;
+    }
+    if (fread(*nome, 1, tamNome, arq) != tamNome) return 0;
+    (*nome)[tamNome] = '\0';
+    p->nome = internarNome(*nome);
+    return p->nome != NOME_FALHA;
+}
+
+// Carrega o .snap (se existir) na fila e no histórico vazios
+// Em *arquivados devolve quantos atendimentos o snapshot espera encontrar
+// no arquivo de histórico
+// Retorna a geração incorporada pelo snapshot (0 se não havia snapshot)
+// ou -1 se o arquivo existe mas está corrompido
+static long long carregarSnapshot(DiarioWAL* d, Fila* fila, Pilha* historico, uint64_t* arquivados) {
+    *arquivados = 0;
+    FILE* arq = fopen(d->caminhoSnap, "rb");
+    if (arq == NULL) return 0;
+    setvbuf(arq, NULL, _IOFBF, 1 << 20);
+
+    uint32_t cabecalho[2];
+    uint64_t geracao;
+    int contadores[NUM_CONTADORES];
+    uint64_t quantidades[3];
+    if (fread(cabecalho, sizeof(cabecalho), 1, arq) != 1) {
+        fclose(arq);
+        return -1;  // Vazio ou truncado antes do cabeçalho
+    }
+    if (cabecalho[0] == MAGICO_SNAP && cabecalho[1] != VERSAO_DIARIO) {
+        fclose(arq);
+        return VERSAO_ESTRANHA;
+    }
+    if (cabecalho[0] != MAGICO_SNAP ||
+        fread(&geracao, sizeof(geracao), 1, arq) != 1 ||
+        fread(contadores, sizeof(contadores), 1, arq) != 1 ||
+        fread(quantidades, sizeof(quantidades), 1, arq) != 1) {
+        fclose(arq);
+        return -1;
+    }
+
+    char* nome = NULL;
+    size_t capNome = 0;
+    Paciente p;
+    int ok = 1;
+
+    // Fila: reinserir na mesma ordem mantém a ordem dentro de cada balde
+    int balde;
+    int64_t horarios[2];
+    for (uint64_t i = 0; ok && i < quantidades[0]; i++) {
+        ok = lerPacienteSnapshot(arq, &p, &balde, &nome, &capNome) &&
+             fread(horarios, sizeof(horarios), 1, arq) == 1;
+        if (!ok) break;
+        if (balde >= 1 && balde <= NUM_PRIORIDADES) inserirFilaNoNivel(fila, p, balde - 1);
+        else inserirFila(fila, p);
+        No* no = (No*) buscarIndice(&fila->indice, p.id);
+        if (no != NULL) {
+            no->chegada = paredeParaInstante(horarios[0]);
+            no->entradaNivel = paredeParaInstante(horarios[1]);
+        }
+    }
+
+    // Histórico: os registros vêm do topo para a base, então cada nó novo
+    // é ligado abaixo do anterior
+    for (uint64_t i = 0; ok && i < quantidades[1]; i++) {
+        ok = lerPacienteSnapshot(arq, &p, &balde, &nome, &capNome);
+        if (!ok) break;
+        NoPilha* novo = (NoPilha*) alocarNo(historico->pool);
+        if (novo == NULL || !inserirIndice(&historico->indice, p.id, novo)) {
+            ok = 0;
+            break;
+        }
+        novo->dados = p;
+        novo->prox = NULL;
+        novo->ant = historico->base;
+        if (historico->base != NULL)
+            historico->base->prox = novo;
+        else
+            historico->topo = novo;
+        historico->base = novo;
+        historico->quentes++;
+    }
+
+    free(nome);
+    fclose(arq);
+    if (!ok) return -1;
+
+    for (int i = 0; i < NUM_CONTADORES; i++) metricas.contadores[i] = contadores[i];
+    *arquivados = quantidades[2];
+    return (long long) geracao;
+}
+
+// Reproduz os registros do .wal sobre o estado carregado do snapshot
+// Retorna a quantidade de registros aplicados e, em *validoAte, o tamanho
+// do trecho íntegro do arquivo (o resto é um registro incompleto)
+// Retorna -1 se o arquivo não existe, é inválido ou é de uma geração antiga
+static long long reproduzirWal(DiarioWAL* d, Fila* fila, Pilha* historico,
+                               uint64_t geracaoSnapshot, size_t* validoAte) {
+    FILE* arq = fopen(d->caminhoWal, "rb");
+    if (arq == NULL) return -1;
+
+    // Lê o arquivo inteiro de uma vez: a reprodução fica limitada pela
+    // memória, não por chamadas de leitura
+    fseek(arq, 0, SEEK_END);
+    long tamanho = ftell(arq);
+    fseek(arq, 0, SEEK_SET);
+    unsigned char* dados = tamanho > 0 ? (unsigned char*) malloc((size_t) tamanho + 1) : NULL;
+    if (dados == NULL || fread(dados, 1, (size_t) tamanho, arq) != (size_t) tamanho) {
+        free(dados);
+        fclose(arq);
+        return -1;
+    }
+    fclose(arq);
+
+    uint32_t cabecalho[2];
+    uint64_t geracao;
+    size_t tamCabecalho = sizeof(cabecalho) + sizeof(geracao);
+    if ((size_t) tamanho < tamCabecalho) {
+        free(dados);
+        return -1;
+    }
+    memcpy(cabecalho, dados, sizeof(cabecalho));
+    memcpy(&geracao, dados + sizeof(cabecalho), sizeof(geracao));
+    if (cabecalho[0] == MAGICO_WAL && cabecalho[1] != VERSAO_DIARIO) {
+        free(dados);
+        return VERSAO_ESTRANHA;
+    }
+    if (cabecalho[0] != MAGICO_WAL ||
+        geracao <= geracaoSnapshot) {
+        free(dados);
+        return -1;
+    }
+    d->geracao = geracao;
+
+    long long aplicados = 0;
+    size_t pos = tamCabecalho;
+    Paciente p;
+    while (pos + 8 <= (size_t) tamanho) {
+        uint32_t tam, soma;
+        memcpy(&tam, dados + pos, 4);
+        memcpy(&soma, dados + pos + 4, 4);
+        unsigned char* conteudo = dados + pos + 8;
+        if (tam == 0 || pos + 8 + tam > (size_t) tamanho) break;      // Registro incompleto
+        if (somaDiario(2166136261u, conteudo, tam) != soma) break;     // Registro corrompido
+
+        switch (conteudo[0]) {
+            case REG_INSERIR:
+            case REG_PUSH:
+            case REG_REINSERIR: {
+                uint32_t tamNome;
+                // Antes do nome, REG_INSERIR tem a chegada, e REG_REINSERIR
+                // tem o nível, a chegada e a entrada no nível
+                size_t tamFixo = conteudo[0] == REG_REINSERIR ? 29 : conteudo[0] == REG_INSERIR ? 20 : 12;
+                if (tam < tamFixo) break;
+                memcpy(&p.id, conteudo + 1, 4);
+                memcpy(&p.idade, conteudo + 5, 2);
+                p.prioridade = (int8_t) conteudo[7];
+                p.reservado = 0;
+                memcpy(&tamNome, conteudo + 8, 4);
+                // Nome além do registro, prioridade ou nível fora da escala:
+                // o registro é ignorado (a prioridade e o nível indexam baldes)
+                if ((uint64_t) tamFixo + tamNome > tam || !validarPrioridade(p.prioridade)) break;
+                if (conteudo[0] == REG_REINSERIR && conteudo[12] >= NUM_PRIORIDADES) break;
+                // Termina o nome temporariamente dentro do próprio buffer
+                char* nome = (char*) conteudo + tamFixo;
+                char salvo = nome[tamNome];
+                nome[tamNome] = '\0';
+                p.nome = internarNome(nome);
+                nome[tamNome] = salvo;
+                int64_t horarios[2] = {0, 0};
+                if (conteudo[0] == REG_INSERIR) memcpy(horarios, conteudo + 12, 8);
+                else if (conteudo[0] == REG_REINSERIR) memcpy(horarios, conteudo + 13, 16);
+                if (conteudo[0] == REG_INSERIR) {
+                    inserirFila(fila, p);
+                    No* no = (No*) buscarIndice(&fila->indice, p.id);
+                    if (no != NULL) no->chegada = no->entradaNivel = paredeParaInstante(horarios[0]);
+                } else if (conteudo[0] == REG_PUSH) {
+                    push(historico, p);
+                } else {
+                    reinserirFila(fila, p, conteudo[12], paredeParaInstante(horarios[0]),
+                                  paredeParaInstante(horarios[1]));
+                }
+                break;
+            }
+            case REG_RETIRAR: {
+                int id;
+                if (tam < 5) break;
+                memcpy(&id, conteudo + 1, 4);
+                retirarFila(fila, id, &p);
+                break;
+            }
+            case REG_PRIORIDADE: {
+                int id;
+                uint32_t posicao;
+                int64_t entradaNivel;
+                if (tam < 19 || !validarPrioridade((int8_t) conteudo[5])) break;
+                memcpy(&id, conteudo + 1, 4);
+                memcpy(&posicao, conteudo + 7, 4);
+                memcpy(&entradaNivel, conteudo + 11, 8);
+                reproduzirPrioridade(fila, id, (int8_t) conteudo[5], conteudo[6], posicao,
+                                     paredeParaInstante(entradaNivel));
+                break;
+            }
+            case REG_REMOVER:
+                removerFila(fila);
+                break;
+            case REG_POP:
+                pop(historico, &p);
+                break;
+            case REG_PROMOVER: {
+                int64_t agora;
+                if (tam < 11) break;
+                memcpy(&agora, conteudo + 3, 8);
+                if (conteudo[1] < NUM_PRIORIDADES && conteudo[2] < NUM_PRIORIDADES &&
+                    fila->baldes[conteudo[1]].inicio != NULL)
+                    promoverPrimeiro(fila, conteudo[1], conteudo[2], paredeParaInstante(agora));
+                break;
+            }
+            case REG_CONTADOR:
+                if (conteudo[1] < NUM_CONTADORES)
+                    metricas.contadores[conteudo[1]] += (signed char) conteudo[2];
+                break;
+        }
+        aplicados++;
+        pos += 8 + tam;
+    }
+
+    *validoAte = pos;
+    free(dados);
+    return aplicados;
+}
+
+// Falha de carregarDados (a mensagem já foi escrita)
+#define CARGA_FALHOU (-3)
+
+// Carrega o estado salvo em 'd' (caminhos já preenchidos) na fila e no
+// histórico vazios: snapshot, arquivo de histórico e o restante do .wal
+// 'somenteLeitura' (--listar): nenhum arquivo é alterado; o histórico é
+// mapeado em modo privado e todo atendimento novo fica em memória
+// Retorna os registros do .wal aplicados (-1 = sem .wal aproveitável) e,
+// em *validoAte, o trecho íntegro do .wal; ou CARGA_FALHOU
+static long long carregarDados(DiarioWAL* d, const char* prefixo, Fila* fila, Pilha* historico,
+                               int somenteLeitura, size_t* validoAte) {
+    uint64_t arquivados;
+    long long geracaoSnapshot = carregarSnapshot(d, fila, historico, &arquivados);
+    if (geracaoSnapshot < 0) {
+        if (geracaoSnapshot == VERSAO_ESTRANHA)
+            fprintf(stderr, "ERRO: Snapshot %s gravado por outra versão ou escala de prioridades.\n", d->caminhoSnap);
+        else
+            fprintf(stderr, "ERRO: Snapshot %s corrompido.\n", d->caminhoSnap);
+        return CARGA_FALHOU;
+    }
+
+    // Atendimentos antigos ficam no arquivo de histórico <prefixo>.hist.
+    // Registros gravados depois do snapshot são descartados: eles voltam
+    // a ser gravados quando o diário for reproduzido
+    ArquivoHistorico* arquivo = abrirArquivoHistorico(prefixo, somenteLeitura);
+    if (arquivo != NULL) {
+        if (arquivo->quantidade < arquivados) {
+            fprintf(stderr, "ERRO: Arquivo de histórico de %s incompleto.\n", prefixo);
+            fecharArquivoHistorico(arquivo);
+            return CARGA_FALHOU;
+        }
+        truncarArquivoHistorico(arquivo, arquivados);
+        protegerArquivoHistorico(arquivo);
+        if (!ligarArquivoHistorico(historico, arquivo)) return CARGA_FALHOU;
+        if (somenteLeitura) historico->limiteQuentes = SIZE_MAX;
+    } else if (somenteLeitura && arquivados > 0) {
+        fprintf(stderr, "ERRO: Arquivo de histórico de %s incompleto.\n", prefixo);
+        return CARGA_FALHOU;
+    }
+
+    long long aplicados = reproduzirWal(d, fila, historico, (uint64_t) geracaoSnapshot, validoAte);
+    if (aplicados == VERSAO_ESTRANHA) {
+        // Não descarta o diário: outro programa ainda pode reproduzi-lo
+        fprintf(stderr, "ERRO: Diário %s gravado por outra versão ou escala de prioridades.\n", d->caminhoWal);
+        return CARGA_FALHOU;
+    }
+    if (aplicados < 0) d->geracao = (uint64_t) geracaoSnapshot + 1;
+    return aplicados;
+}
+
+// Carrega o estado salvo com o prefixo informado sem alterar os arquivos
+// e sem ligar o diário (--listar): o que mudar depois fica só em memória
+// Retorna 0 se os dados não puderam ser carregados
+int carregarSomenteLeitura(const char* prefixo, Fila* fila, Pilha* historico) {
+    DiarioWAL* d = (DiarioWAL*) calloc(1, sizeof(DiarioWAL));
+    if (d == NULL) return 0;
+    snprintf(d->caminhoWal, TAM_CAMINHO, "%s.wal", prefixo);
+    snprintf(d->caminhoSnap, TAM_CAMINHO, "%s.snap", prefixo);
+    size_t validoAte;
+    int silenciosaAntes = saidaSilenciosa;
+    saidaSilenciosa = 1;
+    long long aplicados = carregarDados(d, prefixo, fila, historico, 1, &validoAte);
+    saidaSilenciosa = silenciosaAntes;
+    free(d);
+    return aplicados != CARGA_FALHOU;
+}
+
+// Abre (ou cria) o diário com o prefixo informado, recuperando o estado
+// salvo na fila e no histórico (que devem estar vazios) e ligando o
+// diário a eles. Retorna NULL se não for possível abrir os arquivos.
+DiarioWAL* abrirDiario(const char* prefixo, Fila* fila, Pilha* historico, size_t loteSync) {
+    DiarioWAL* d = (DiarioWAL*) malloc(sizeof(DiarioWAL));
+    if (d == NULL) return NULL;
+    memset(d, 0, sizeof(*d));
+    d->fd = -1;
+    d->loteSync = loteSync;
+    d->intervaloSnapshot = DIARIO_INTERVALO_SNAPSHOT;
+    snprintf(d->caminhoWal, TAM_CAMINHO, "%s.wal", prefixo);
+    snprintf(d->caminhoSnap, TAM_CAMINHO, "%s.snap", prefixo);
+
+    clock_t inicio = clock();
+    int silenciosaAntes = saidaSilenciosa;
+    saidaSilenciosa = 1;
+    size_t validoAte = 0;
+    long long aplicados = carregarDados(d, prefixo, fila, historico, 0, &validoAte);
+    saidaSilenciosa = silenciosaAntes;
+    if (aplicados == CARGA_FALHOU) {
+        free(d);
+        return NULL;
+    }
+
+    if (aplicados >= 0) {
+        // Continua anexando ao .wal existente, descartando um registro
+        // incompleto no fim (queda durante a última escrita)
+        d->fd = open(d->caminhoWal, O_WRONLY | O_BINARY);
+        if (d->fd < 0 || ftruncate(d->fd, (long) validoAte) != 0 ||
+            lseek(d->fd, 0, SEEK_END) < 0) {
+            if (d->fd >= 0) close(d->fd);
+            free(d);
+            return NULL;
+        }
+        d->registrosDesdeSnapshot = (size_t) aplicados;
+    } else {
+        // Sem .wal aproveitável: começa um novo depois do snapshot
+        aplicados = 0;
+        if (!iniciarArquivoWal(d)) {
+            free(d);
+            return NULL;
+        }
+    }
+
+    double ms = (double) (clock() - inicio) * 1000.0 / CLOCKS_PER_SEC;
+    if (!saidaSilenciosa && !semBanners)
+        printf("Dados recuperados de %s: %d na fila, %u no histórico, %lld alterações reproduzidas (%.1f ms).\n",
+           prefixo, fila->tamanho, (unsigned) tamanhoPilha(historico), aplicados, ms);
+
+    fila->diario = d;
+    historico->diario = d;
+    return d;
+}
+
+// Chamado ao fim de cada comando: faz o fsync em grupo quando o lote de
+// registros pendentes enche e grava um snapshot quando o diário cresce
+void confirmarDiario(DiarioWAL* d, Fila* fila, Pilha* historico) {
+    if (d->pendentesSync >= d->loteSync) {
+        descarregarDiario(d);
+        fsync(d->fd);
+        d->pendentesSync = 0;
+    }
+    if (d->registrosDesdeSnapshot >= d->intervaloSnapshot) {
+        if (!gravarSnapshot(d, fila, historico))
+            fprintf(stderr, "AVISO: Falha ao gravar o snapshot %s.\n", d->caminhoSnap);
+    }
+    if (d->falhou) {
+        fprintf(stderr, "AVISO: Falha ao escrever no diário %s.\n", d->caminhoWal);
+        d->falhou = 0;
+    }
+}
+
+// Grava um snapshot final, fecha o diário e o desliga da fila e do histórico
+void fecharDiario(DiarioWAL* d, Fila* fila, Pilha* historico) {
+    if (!gravarSnapshot(d, fila, historico)) {
+        // Sem snapshot, ao menos garante que o diário está no disco
+        descarregarDiario(d);
+        fsync(d->fd);
+    }
+    if (d->fd >= 0) close(d->fd);
+    fila->diario = NULL;
+    historico->diario = NULL;
+    free(d);
+}
+
+// ============= IMPORTAÇÃO E EXPORTAÇÃO =============
+// Carga e descarga de pacientes em lote, para transferir a fila de uma
+// unidade para outra sem redigitar cadastro por cadastro. Dois formatos:
+//   CSV:     id,nome,idade,prioridade[,situacao]
+//            situacao = fila (padrão) ou historico. O nome vai entre aspas
+//            se tiver vírgula ou aspas (com as aspas dobradas). Uma
+//            primeira linha começando por "id" é tomada como cabeçalho.
+//   Binário: [u32 "HPAC"][u32 versão] e, para cada paciente, o mesmo
+//            registro do snapshot, com REG_INSERIR (fila) ou REG_PUSH
+//            (histórico) no primeiro byte.
+// Na importação o formato é reconhecido pelo início do arquivo; na
+// exportação, pela extensão (.csv = CSV, qualquer outra = binário).
+// A exportação grava a fila na ordem de atendimento e o histórico do mais
+// antigo para o mais recente, então importar o arquivo refaz os dois.
+
+#define MAGICO_IMPORTACAO 0x43415048u  // "HPAC"
+#define VERSAO_IMPORTACAO 1
+
+// Tamanho do buffer de leitura do CSV (também é o maior tamanho de linha)
+#define TAM_BUFFER_IMPORTACAO (1 << 20)
+
+// Resultado de uma importação
+typedef struct {
+    size_t fila;        // Pacientes que entraram na fila
+    size_t historico;   // Atendimentos que entraram no histórico
+    size_t recusados;   // Registros inválidos ou com ID repetido
+} ResultadoImportacao;
+
+// Estado de uma importação em andamento
+typedef struct {
+    Fila* fila;
+    Pilha* historico;
+    Paciente* pendentes;    // Pacientes da fila, ligados todos de uma vez no fim
+    size_t* numeros;        // Linha ou registro de cada pendente (mensagens)
+    size_t numPendentes;
+    size_t capPendentes;
+    const char* unidade;    // "linha" (CSV) ou "registro" (binário), nas mensagens
+    ResultadoImportacao* res;
+} Importacao;
+
+// Valida um paciente lido com as regras do cadastro e o encaminha: um
+// atendimento entra no histórico na hora (na ordem do arquivo); um paciente
+// da fila espera o fim da leitura, e só então os IDs repetidos entre os
+// pacientes da fila são detectados (ver importarPacientes)
+static void aceitarImportado(Importacao* imp, int id, int idade, int prioridade,
+                             const char* nome, int historico, size_t numero) {
+    const char* motivo = NULL;
+    if (!validarID(id)) motivo = "ID inválido";
+    else if (!validarIdade(idade)) motivo = "idade inválida";
+    else if (!validarPrioridade(prioridade)) motivo = "prioridade inválida";
+    else if (nome[0] == '\0') motivo = "nome vazio";
+    else if (idCadastrado(imp->fila, imp->historico, id)) motivo = "ID repetido";
+
+    Paciente p = {id, 0, (uint16_t) idade, (int8_t) prioridade, 0};
+    if (motivo == NULL) {
+        p.nome = internarNome(nome);
+        if (p.nome == NOME_FALHA) motivo = "memória insuficiente";
+    }
+    if (motivo == NULL && !historico && imp->numPendentes == imp->capPendentes) {
+        size_t nova = imp->capPendentes == 0 ? 1024 : imp->capPendentes * 2;
+        Paciente* maior = (Paciente*) realloc(imp->pendentes, nova * sizeof(Paciente));
+        if (maior != NULL) imp->pendentes = maior;
+        size_t* maiores = maior == NULL ? NULL : (size_t*) realloc(imp->numeros, nova * sizeof(size_t));
+        if (maiores == NULL) motivo = "memória insuficiente";
+        else {
+            imp->numeros = maiores;
+            imp->capPendentes = nova;
+        }
+    }
+    if (motivo != NULL) {
+        fprintf(stderr, "importação, %s %zu: %s\n", imp->unidade, numero, motivo);
+        imp->res->recusados++;
+        return;
+    }
+
+    if (historico) {
+        push(imp->historico, p);
+        imp->res->historico++;
+    } else {
+        imp->pendentes[imp->numPendentes] = p;
+        imp->numeros[imp->numPendentes++] = numero;
+    }
+}
+
+// Converte um campo numérico inteiro (sem sobras); retorna 1 se conseguiu
+static int campoInteiroCSV(const char* texto, int* valor) {
+    char* fim;
+    long v = strtol(texto, &fim, 10);
+    if (fim == texto || *fim != '\0' || v < INT_MIN || v > INT_MAX) return 0;
+    *valor = (int) v;
+    return 1;
+}
+
+// Separa o próximo campo da linha em *p, terminando-o com \0 no próprio
+// buffer, e avança *p para o campo seguinte (NULL depois do último)
+// Campos entre aspas podem conter vírgulas; "" dentro deles vira "
+static char* lerCampoCSV(char** p) {
+    char* c = *p;
+    if (c == NULL) return NULL;
+    while (*c == ' ' || *c == '\t') c++;
+
+    char* campo = c;
+    char* fimCampo;
+    if (*c == '"') {
+        // Copia o conteúdo para trás, desfazendo as aspas dobradas
+        campo = ++c;
+        char* destino = c;
+        while (*c != '\0') {
+            if (*c == '"') {
+                if (c[1] != '"') {
+                    c++;
+                    break;
+                }
+                c++;  // Aspas dobradas: fica uma
+            }
+            *destino++ = *c++;
+        }
+        fimCampo = destino;
+        while (*c != '\0' && *c != ',') c++;
+    } else {
+        while (*c != '\0' && *c != ',') c++;
+        fimCampo = c;
+        while (fimCampo > campo && (fimCampo[-1] == ' ' || fimCampo[-1] == '\t')) fimCampo--;
+    }
+
+    *p = *c == ',' ? c + 1 : NULL;
+    *fimCampo = '\0';  // Depois de olhar *c: o fim do campo pode ser a própria vírgula
+    return campo;
+}
+
+// Interpreta uma linha do CSV (já terminada em \0)
+static void importarLinhaCSV(Importacao* imp, char* linha, size_t numLinha) {
+    char* p = linha;
+    char* campos[5];
+    int numCampos = 0;
+    while (p != NULL && numCampos < 5) campos[numCampos++] = lerCampoCSV(&p);
+    if (numCampos == 1 && campos[0][0] == '\0') return;  // Linha vazia
+
+    // Cabeçalho opcional na primeira linha
+    if (numLinha == 1 && (campos[0][0] == 'i' || campos[0][0] == 'I') &&
+        (campos[0][1] == 'd' || campos[0][1] == 'D') && campos[0][2] == '\0')
+        return;
+
+    int id, idade, prioridade, historico = 0;
+    int valida = p == NULL && numCampos >= 4 &&
+                 campoInteiroCSV(campos[0], &id) &&
+                 campoInteiroCSV(campos[2], &idade) &&
+                 campoInteiroCSV(campos[3], &prioridade);
+    if (valida && numCampos == 5) {
+        if (strcmp(campos[4], "historico") == 0 || strcmp(campos[4], "histórico") == 0) historico = 1;
+        else if (strcmp(campos[4], "fila") != 0 && campos[4][0] != '\0') valida = 0;
+    }
+    if (!valida) {
+        fprintf(stderr, "importação, linha %zu: formato inválido\n", numLinha);
+        imp->res->recusados++;
+        return;
+    }
+    aceitarImportado(imp, id, idade, prioridade, campos[1], historico, numLinha);
+}
+
+// Lê o CSV em blocos num único buffer reaproveitado (como o modo em lote)
+// Retorna 0 se alguma linha não coube no buffer
+static int importarCSV(Importacao* imp, FILE* arq) {
+    char* buffer = (char*) malloc(TAM_BUFFER_IMPORTACAO + 1);
+    if (buffer == NULL) return 0;
+    size_t pendente = 0;
+    size_t numLinha = 0;
+    int fimArquivo = 0;
+    int ok = 1;
+
+    while (!fimArquivo) {
+        size_t lidos = fread(buffer + pendente, 1, TAM_BUFFER_IMPORTACAO - pendente, arq);
+        if (lidos == 0) fimArquivo = 1;
+        size_t total = pendente + lidos;
+        if (total == 0) break;
+
+        char* inicio = buffer;
+        char* limite = buffer + total;
+        for (;;) {
+            char* quebra = (char*) memchr(inicio, '\n', (size_t) (limite - inicio));
+            if (quebra == NULL) {
+                if (!fimArquivo) {
+                    if (inicio == buffer && total == TAM_BUFFER_IMPORTACAO) {
+                        fprintf(stderr, "importação, linha %zu: linha longa demais\n", numLinha + 1);
+                        ok = 0;
+                        fimArquivo = 1;
+                        inicio = limite;
+                    }
+                    break;
+                }
+                if (inicio == limite) break;
+                quebra = limite;  // Última linha sem \n
+            }
+            *quebra = '\0';
+            numLinha++;
+            if (quebra > inicio && quebra[-1] == '\r') quebra[-1] = '\0';
+            importarLinhaCSV(imp, inicio, numLinha);
+            inicio = quebra + 1;
+            if (inicio >= limite) break;
+        }
+
+        pendente = inicio < limite ? (size_t) (limite - inicio) : 0;
+        memmove(buffer, inicio, pendente);
+    }
+    free(buffer);
+    return ok;
+}
+
+// Lê os registros binários até o fim do arquivo
+// Retorna 0 se o arquivo terminar no meio de um registro
+static int importarBinario(Importacao* imp, FILE* arq) {
+    uint32_t versao;
+    if (fread(&versao, sizeof(versao), 1, arq) != 1 || versao != VERSAO_IMPORTACAO) {
+        fprintf(stderr, "importação: versão do arquivo não suportada\n");
+        return 0;
+    }
+
+    Paciente p;
+    int tipo;
+    char* nome = NULL;
+    size_t capNome = 0;
+    size_t numero = 0;
+    while (lerPacienteSnapshot(arq, &p, &tipo, &nome, &capNome)) {
+        numero++;
+        if (tipo != REG_INSERIR && tipo != REG_PUSH) {
+            fprintf(stderr, "importação, registro %zu: tipo inválido\n", numero);
+            imp->res->recusados++;
+            continue;
+        }
+        aceitarImportado(imp, p.id, p.idade, p.prioridade, nome, tipo == REG_PUSH, numero);
+    }
+    int completo = feof(arq) && !ferror(arq);
+    free(nome);
+    return completo;
+}
+
+// Registra no diário o que a importação acabou de carregar, quando o
+// snapshot que a salvaria falhou: os atendimentos (os res->historico do
+// topo da pilha, do mais antigo ao mais recente), os pacientes que
+// entraram na fila, balde a balde como em inserirFilaEmLote, e os contadores
+// Retorna 0 se faltou memória
+static int registrarImportacaoNoDiario(DiarioWAL* d, Fila* fila, Pilha* historico, const ResultadoImportacao* res,
+                                       const Paciente* pendentes, size_t numPendentes) {
+    Paciente* atendidos = (Paciente*) malloc((res->historico + 1) * sizeof(Paciente));
+    const char** nomes = (const char**) malloc((res->historico + 1) * sizeof(const char*));
+    if (atendidos == NULL || nomes == NULL) {
+        free(atendidos);
+        free(nomes);
+        return 0;
+    }
+    IteradorHistorico it;
+    size_t n = 0;
+    iniciarIteradorHistorico(&it, historico, 0);
+    while (n < res->historico && proximoHistorico(&it, &atendidos[n], &nomes[n])) n++;
+    while (n > 0) {
+        n--;
+        unsigned char fixo[12];
+        uint32_t tamNome = (uint32_t) strlen(nomes[n]);
+        registrarDiario(d, fixo, codificarPaciente(fixo, REG_PUSH, atendidos[n], tamNome), nomes[n], tamNome);
+    }
+    free(atendidos);
+    free(nomes);
+
+    for (int nivel = 0; nivel < NUM_PRIORIDADES; nivel++) {
+        for (size_t i = 0; i < numPendentes; i++) {
+            if (pendentes[i].id == -1 || nivelDaPrioridade(pendentes[i].prioridade) != nivel) continue;
+            No* no = (No*) buscarIndice(&fila->indice, pendentes[i].id);
+            if (no != NULL) diarioInsercao(d, pendentes[i], no->chegada);
+        }
+    }
+
+    // O registro do contador leva um delta de 8 bits
+    size_t deltas[2] = {res->fila + res->historico, res->historico};
+    int indices[2] = {CONTADOR_CADASTRADOS, CONTADOR_ATENDIDOS};
+    for (int k = 0; k < 2; k++) {
+        for (size_t resta = deltas[k]; resta > 0;) {
+            int parte = resta > 127 ? 127 : (int) resta;
+            unsigned char fixo[3] = {REG_CONTADOR, (unsigned char) indices[k], (unsigned char) parte};
+            registrarDiario(d, fixo, sizeof(fixo), NULL, 0);
+            resta -= (size_t) parte;
+        }
+    }
+    return 1;
+}
+
+// Importa os pacientes de 'caminho' (CSV ou binário) para a fila e o histórico
+// Os atendimentos entram no histórico durante a leitura; os pacientes da
+// fila são ligados todos juntos no fim (inserirFilaEmLote). Com diário,
+// nada é registrado item a item: um snapshot ao final grava tudo de uma vez
+// (se ele falhar, a importação vai para o diário).
+// Retorna 1 se o arquivo foi lido até o fim (registros recusados são
+// apenas contados), 0 se não pôde ser aberto ou está truncado
+int importarPacientes(const char* caminho, Fila* fila, Pilha* historico, ResultadoImportacao* res) {
+    memset(res, 0, sizeof(*res));
+    FILE* arq = fopen(caminho, "rb");
+    if (arq == NULL) {
+        fprintf(stderr, "ERRO: Não foi possível abrir o arquivo %s.\n", caminho);
+        return 0;
+    }
+    setvbuf(arq, NULL, _IOFBF, 1 << 20);
+
+    Importacao imp;
+    memset(&imp, 0, sizeof(imp));
+    imp.fila = fila;
+    imp.historico = historico;
+    imp.res = res;
+
+    DiarioWAL* diario = fila->diario;
+    fila->diario = NULL;
+    historico->diario = NULL;
+
+    uint32_t magico = 0;
+    int ok;
+    if (fread(&magico, sizeof(magico), 1, arq) == 1 && magico == MAGICO_IMPORTACAO) {
+        imp.unidade = "registro";
+        ok = importarBinario(&imp, arq);
+    } else {
+        rewind(arq);
+        imp.unidade = "linha";
+        ok = importarCSV(&imp, arq);
+    }
+    fclose(arq);
+
+    // Pacientes da fila que repetem um atendimento lido depois deles
+    for (size_t i = 0; i < imp.numPendentes; i++) {
+        if (buscarIndice(&historico->indice, imp.pendentes[i].id) != NULL) imp.pendentes[i].id = -1;
+    }
+    res->fila = inserirFilaEmLote(fila, imp.pendentes, imp.numPendentes);
+    size_t repetidos = 0;
+    for (size_t i = 0; i < imp.numPendentes; i++) {
+        if (imp.pendentes[i].id != -1) continue;
+        fprintf(stderr, "importação, %s %zu: ID repetido\n", imp.unidade, imp.numeros[i]);
+        repetidos++;
+    }
+    res->recusados += repetidos;
+    if (res->fila + repetidos < imp.numPendentes) {
+        fprintf(stderr, "ERRO: Falha na alocação de memória durante a importação.\n");
+        ok = 0;
+    }
+
+    metricas.contadores[CONTADOR_CADASTRADOS] += (int) (res->fila + res->historico);
+    metricas.contadores[CONTADOR_ATENDIDOS] += (int) res->historico;
+
+    fila->diario = diario;
+    historico->diario = diario;
+    if (diario != NULL && res->fila + res->historico > 0 && !gravarSnapshot(diario, fila, historico)) {
+        // Sem o snapshot, os registros seguintes do diário citariam
+        // pacientes que nenhum arquivo guarda: a importação vai para o diário
+        fprintf(stderr, "AVISO: Falha ao gravar o snapshot %s; a importação foi registrada no diário.\n",
+                diario->caminhoSnap);
+        if (!registrarImportacaoNoDiario(diario, fila, historico, res, imp.pendentes, imp.numPendentes)) {
+            fprintf(stderr, "ERRO: Falha na alocação de memória ao registrar a importação.\n");
+            ok = 0;
+        }
+    }
+    free(imp.pendentes);
+    free(imp.numeros);
+    return ok;
+}
+
+// Escreve um paciente como linha do CSV
+static void escreverLinhaCSV(FILE* arq, Paciente p, const char* nome, const char* situacao) {
+    fprintf(arq, "%d,", p.id);
+    if (strpbrk(nome, ",\"") != NULL) {
+        fputc('"', arq);
+        for (const char* c = nome; *c != '\0'; c++) {
+            if (*c == '"') fputc('"', arq);
+            fputc(*c, arq);
+        }
+        fputc('"', arq);
+    } else {
+        fputs(nome, arq);
+    }
+    fprintf(arq, ",%d,%d,%s\n", p.idade, p.prioridade, situacao);
+}
+
+// Escreve um paciente no formato escolhido
+static void exportarPaciente(FILE* arq, int csv, Paciente p, const char* nome, int historico) {
+    if (csv) escreverLinhaCSV(arq, p, nome, historico ? "historico" : "fila");
+    else escreverRegistroPaciente(arq, p, historico ? REG_PUSH : REG_INSERIR, nome);
+}
+
+// Exporta a fila e o histórico para 'caminho' (.csv = CSV, senão binário)
+// Retorna quantos pacientes foram gravados, ou -1 em caso de erro
+long long exportarPacientes(const char* caminho, Fila* fila, Pilha* historico) {
+    size_t tamCaminho = strlen(caminho);
+    int csv = tamCaminho >= 4 && (strcmp(caminho + tamCaminho - 4, ".csv") == 0 ||
+                                  strcmp(caminho + tamCaminho - 4, ".CSV") == 0);
+    FILE* arq = fopen(caminho, "wb");
+    if (arq == NULL) return -1;
+    setvbuf(arq, NULL, _IOFBF, 1 << 20);
+
+    if (csv) {
+        fprintf(arq, "id,nome,idade,prioridade,situacao\n");
+    } else {
+        uint32_t cabecalho[2] = {MAGICO_IMPORTACAO, VERSAO_IMPORTACAO};
+        fwrite(cabecalho, sizeof(cabecalho), 1, arq);
+    }
+
+    long long gravados = 0;
+    // Fila na ordem de atendimento
+    for (int i = 0; i < NUM_PRIORIDADES; i++) {
+        for (No* atual = fila->baldes[i].inicio; atual != NULL; atual = atual->prox) {
+            exportarPaciente(arq, csv, atual->dados, obterNome(atual->dados.nome), 0);
+            gravados++;
+        }
+    }
+    // Histórico do mais antigo (arquivo) para o mais recente (base -> topo)
+    if (historico->arquivo != NULL) {
+        ArquivoHistorico* a = historico->arquivo;
+        for (uint64_t pos = 0; pos < a->quantidade; pos++) {
+            RegistroHistorico* r = registroHistorico(a, pos);
+            Paciente p = {r->id, 0, r->idade, r->prioridade, 0};
+            exportarPaciente(arq, csv, p, nomeRegistro(a, r), 1);
+            gravados++;
+        }
+    }
+    for (NoPilha* atual = historico->base; atual != NULL; atual = atual->ant) {
+        exportarPaciente(arq, csv, atual->dados, obterNome(atual->dados.nome), 1);
+        gravados++;
+    }
+
+    int ok = fflush(arq) == 0 && !ferror(arq);
+    fclose(arq);
+    return ok ? gravados : -1;
+}
+
+// Importa 'caminho' e mostra o resumo (opção --importar)
+// Retorna 1 se o arquivo foi lido até o fim
+int importarComResumo(const char* caminho, Fila* fila, Pilha* historico) {
+    ResultadoImportacao res;
+    uint64_t inicio = relogioNs();
+    int ok = importarPacientes(caminho, fila, historico, &res);
+    printf("Importados de %s: %zu na fila, %zu no histórico, %zu recusados (%.1f ms).\n",
+           caminho, res.fila, res.historico, res.recusados, (double) (relogioNs() - inicio) / 1e6);
+    return ok;
+}
+
+// Exporta para 'caminho' e mostra o resumo (opção --exportar)
+// Retorna 1 se conseguiu
+int exportarComResumo(const char* caminho, Fila* fila, Pilha* historico) {
+    long long gravados = exportarPacientes(caminho, fila, historico);
+    if (gravados < 0) {
+        fprintf(stderr, "ERRO: Não foi possível gravar o arquivo %s.\n", caminho);
+        return 0;
+    }
+    printf("Exportados %lld pacientes para %s.\n", gravados, caminho);
+    return 1;
+}
+
+// ============= FILA CONCORRENTE =============
+// Variante da fila e do histórico para várias mesas de cadastro e vários
+// médicos trabalhando ao mesmo tempo, cada um na sua thread.
+//
+// Cada nível de prioridade é uma Fila própria, com trava e pool próprios:
+// cadastros de prioridades diferentes não disputam a mesma trava, e a
+// ordem de chegada dentro de cada nível continua garantida pela trava do
+// nível. O atendimento procura o primeiro nível com pacientes (pelos
+// contadores atômicos, sem travar os níveis vazios) e, se não houver
+// ninguém, o médico dorme até chegar um paciente.
+
+// Quantidade de partes do conjunto de IDs usados (cada parte tem sua trava)
+#define PARTES_IDS_CONCORRENTE 64
+
+// Um nível de prioridade da fila concorrente
+typedef struct {
+    pthread_mutex_t trava;   // Protege 'fila' e 'pool'
+    Fila fila;               // Pacientes deste nível (um único balde usado)
+    PoolNos pool;            // Nós deste nível
+    atomic_int tamanho;      // Cópia de fila.tamanho lida sem trava
+} NivelConcorrente;
+
+// Parte do conjunto de IDs já usados (fila + histórico)
+typedef struct {
+    pthread_mutex_t trava;
+    IndiceID ids;
+} ParteIDs;
+
+// Fila e histórico compartilhados entre threads
+typedef struct {
+    NivelConcorrente niveis[NUM_PRIORIDADES];
+    ParteIDs partesIDs[PARTES_IDS_CONCORRENTE];  // Rejeição de IDs duplicados
+    atomic_int total;               // Pacientes em espera (todos os níveis)
+    atomic_int esperando;           // Médicos dormindo à espera de pacientes
+    atomic_int encerrada;           // 1 = não chegam mais pacientes
+    pthread_mutex_t travaEspera;    // Usada só para dormir/acordar médicos
+    pthread_cond_t temPaciente;
+    pthread_mutex_t travaHistorico; // Protege 'historico' e 'poolHistorico'
+    Pilha* historico;
+    PoolNos poolHistorico;
+} FilaConcorrente;
+
+// Inicializa a fila concorrente; retorna 1 se conseguiu
+int inicializaFilaConcorrente(FilaConcorrente* fc) {
+    for (int i = 0; i < NUM_PRIORIDADES; i++) {
+        pthread_mutex_init(&fc->niveis[i].trava, NULL);
+        inicializaPool(&fc->niveis[i].pool);
+        inicializaFilaComPool(&fc->niveis[i].fila, &fc->niveis[i].pool);
+        atomic_init(&fc->niveis[i].tamanho, 0);
+    }
+    for (int i = 0; i < PARTES_IDS_CONCORRENTE; i++) {
+        pthread_mutex_init(&fc->partesIDs[i].trava, NULL);
+        inicializaIndice(&fc->partesIDs[i].ids);
+    }
+    atomic_init(&fc->total, 0);
+    atomic_init(&fc->esperando, 0);
+    atomic_init(&fc->encerrada, 0);
+    pthread_mutex_init(&fc->travaEspera, NULL);
+    pthread_cond_init(&fc->temPaciente, NULL);
+    pthread_mutex_init(&fc->travaHistorico, NULL);
+    inicializaPool(&fc->poolHistorico);
+    fc->historico = inicializaPilhaComPool(&fc->poolHistorico);
+    return fc->historico != NULL;
+}
+
+// Libera a memória da fila concorrente (nenhuma thread pode estar usando)
+void destruirFilaConcorrente(FilaConcorrente* fc) {
+    for (int i = 0; i < NUM_PRIORIDADES; i++) {
+        destruirFila(&fc->niveis[i].fila);
+        pthread_mutex_destroy(&fc->niveis[i].trava);
+    }
+    for (int i = 0; i < PARTES_IDS_CONCORRENTE; i++) {
+        destruirIndice(&fc->partesIDs[i].ids);
+        pthread_mutex_destroy(&fc->partesIDs[i].trava);
+    }
+    destruirPilha(fc->historico);
+    pthread_mutex_destroy(&fc->travaEspera);
+    pthread_cond_destroy(&fc->temPaciente);
+    pthread_mutex_destroy(&fc->travaHistorico);
+}
+
+// Reserva o ID no conjunto de IDs usados (dividido em
+// PARTES_IDS_CONCORRENTE partes); retorna 0 se já estava em uso
+static int reservarIDPartes(ParteIDs* partes, int id) {
+    ParteIDs* parte = &partes[(uint32_t) id % PARTES_IDS_CONCORRENTE];
+    pthread_mutex_lock(&parte->trava);
+    int livre = buscarIndice(&parte->ids, id) == NULL;
+    if (livre) livre = inserirIndice(&parte->ids, id, parte);
+    pthread_mutex_unlock(&parte->trava);
+    return livre;
+}
+
+// Cadastra um paciente (chamado pelas mesas de cadastro)
+// Retorna 1 se conseguiu, 0 se a prioridade é inválida, o ID já estava em
+// uso ou faltou memória
+int cadastrarConcorrente(FilaConcorrente* fc, Paciente p) {
+    // A prioridade escolhe o nível: fora da escala, sairia de niveis[]
+    if (!validarPrioridade(p.prioridade)) {
+        recusarOperacao(OPERACAO_INSERIR);
+        return 0;
+    }
+    uint64_t inicio = relogioNs();
+    if (!reservarIDPartes(fc->partesIDs, p.id)) {
+        registrarOperacao(OPERACAO_INSERIR, inicio, 0);
+        return 0;
+    }
+
+    NivelConcorrente* nivel = &fc->niveis[nivelDaPrioridade(p.prioridade)];
+    pthread_mutex_lock(&nivel->trava);
+    int inserido = inserirFila(&nivel->fila, p);
+    atomic_store(&nivel->tamanho, nivel->fila.tamanho);
+    pthread_mutex_unlock(&nivel->trava);
+    if (!inserido) {  // Sem memória: o ID fica reservado, mas ninguém é contado
+        registrarOperacao(OPERACAO_INSERIR, inicio, 0);
+        return 0;
+    }
+
+    atomic_fetch_add(&fc->total, 1);
+    metricas.contadores[CONTADOR_CADASTRADOS]++;
+    registrarOperacao(OPERACAO_INSERIR, inicio, 1);
+
+    // Acorda um médico, se houver algum dormindo
+    if (atomic_load(&fc->esperando) > 0) {
+        pthread_mutex_lock(&fc->travaEspera);
+        pthread_cond_signal(&fc->temPaciente);
+        pthread_mutex_unlock(&fc->travaEspera);
+    }
+    return 1;
+}
+
+// Tenta retirar o próximo paciente sem esperar; retorna 0 se não havia
+static int tentarRetirarConcorrente(FilaConcorrente* fc, Paciente* paciente) {
+    for (int i = 0; i < NUM_PRIORIDADES; i++) {
+        NivelConcorrente* nivel = &fc->niveis[i];
+        if (atomic_load(&nivel->tamanho) == 0) continue;  // Não trava níveis vazios
+
+        pthread_mutex_lock(&nivel->trava);
+        int havia = nivel->fila.tamanho > 0;
+        uint32_t espera = 0;
+        if (havia) {
+            *paciente = removerFila(&nivel->fila);
+            espera = nivel->fila.ultimaEspera;
+            atomic_store(&nivel->tamanho, nivel->fila.tamanho);
+        }
+        pthread_mutex_unlock(&nivel->trava);
+
+        if (havia) {
+            atomic_fetch_sub(&fc->total, 1);
+            registrarEspera(paciente->prioridade, espera);
+            return 1;
+        }
+        // Outro médico levou o paciente: tenta o próximo nível
+    }
+    return 0;
+}
+
+// Atende o próximo paciente (chamado pelos médicos)
+// Se 'esperar' for 1, dorme até chegar um paciente ou a fila ser encerrada
+// Retorna 1 e preenche 'atendido', ou 0 se não havia paciente
+int atenderConcorrente(FilaConcorrente* fc, Paciente* atendido, int esperar) {
+    uint64_t inicio = relogioNs();
+    for (;;) {
+        if (tentarRetirarConcorrente(fc, atendido)) break;
+        if (!esperar) {
+            registrarOperacao(OPERACAO_ATENDER, inicio, 0);
+            return 0;
+        }
+
+        pthread_mutex_lock(&fc->travaEspera);
+        atomic_fetch_add(&fc->esperando, 1);
+        while (atomic_load(&fc->total) == 0 && !atomic_load(&fc->encerrada)) {
+            pthread_cond_wait(&fc->temPaciente, &fc->travaEspera);
+        }
+        atomic_fetch_sub(&fc->esperando, 1);
+        int acabou = atomic_load(&fc->total) == 0 && atomic_load(&fc->encerrada);
+        pthread_mutex_unlock(&fc->travaEspera);
+        if (acabou) return 0;
+        inicio = relogioNs();  // O tempo dormindo não conta como latência
+    }
+
+    pthread_mutex_lock(&fc->travaHistorico);
+    push(fc->historico, *atendido);
+    pthread_mutex_unlock(&fc->travaHistorico);
+
+    metricas.contadores[CONTADOR_ATENDIDOS]++;
+    registrarOperacao(OPERACAO_ATENDER, inicio, 1);
+    return 1;
+}
+
+// Avisa que não chegarão mais pacientes: médicos dormindo acordam e
+// terminam quando a fila esvaziar
+void encerrarFilaConcorrente(FilaConcorrente* fc) {
+    pthread_mutex_lock(&fc->travaEspera);
+    atomic_store(&fc->encerrada, 1);
+    pthread_cond_broadcast(&fc->temPaciente);
+    pthread_mutex_unlock(&fc->travaEspera);
+}
+
+// ---------- Teste de estresse da fila concorrente ----------
+// Várias mesas cadastram pacientes com IDs distintos enquanto vários
+// médicos atendem. No fim, cada ID precisa ter sido atendido exatamente
+// uma vez e o histórico precisa conter todos os pacientes.
+
+// Dados compartilhados pelas threads do teste
+typedef struct {
+    FilaConcorrente* fila;
+    int pacientes;          // Total de pacientes do teste
+    int mesas;              // Quantidade de mesas de cadastro
+    atomic_uchar* vistos;   // vistos[id] = vezes que o ID foi atendido
+    atomic_int duplicados;
+    atomic_int recusados;
+} TesteEstresse;
+
+// Parâmetros de uma thread do teste
+typedef struct {
+    TesteEstresse* teste;
+    int numero;             // Número da mesa ou do médico
+    int atendidos;          // Pacientes atendidos por este médico
+} ThreadEstresse;
+
+// Mesa de cadastro: cadastra os IDs numero+1, numero+1+mesas, ...
+static void* mesaEstresse(void* arg) {
+    ThreadEstresse* t = (ThreadEstresse*) arg;
+    TesteEstresse* teste = t->teste;
+    char nome[32];
+    snprintf(nome, sizeof(nome), "Mesa %d", t->numero + 1);
+    NomeRef ref = internarNome(nome);
+
+    uint32_t semente = 2463534242u + (uint32_t) t->numero;
+    for (int id = t->numero + 1; id <= teste->pacientes; id += teste->mesas) {
+        // Gerador xorshift local: sem estado compartilhado entre threads
+        semente ^= semente << 13;
+        semente ^= semente >> 17;
+        semente ^= semente << 5;
+        Paciente p = {id, ref, (uint16_t) (IDADE_MIN + semente % IDADE_MAX),
+                      (int8_t) (PRIORIDADE_MAXIMA + semente % NUM_PRIORIDADES), 0};
+        if (!cadastrarConcorrente(teste->fila, p)) atomic_fetch_add(&teste->recusados, 1);
+    }
+    return NULL;
+}
+
+// Médico: atende até a fila ser encerrada e esvaziar
+static void* medicoEstresse(void* arg) {
+    ThreadEstresse* t = (ThreadEstresse*) arg;
+    TesteEstresse* teste = t->teste;
+    Paciente p;
+    while (atenderConcorrente(teste->fila, &p, 1)) {
+        if (atomic_fetch_add(&teste->vistos[p.id], 1) != 0)
+            atomic_fetch_add(&teste->duplicados, 1);
+        t->atendidos++;
+    }
+    return NULL;
+}
+
+// Executa o teste de estresse; retorna 0 se nenhum paciente foi perdido
+// ou duplicado
+int executarEstresse(int mesas, int medicos, int pacientes) {
+    if (mesas < 1 || medicos < 1 || pacientes < 1) {
+        fprintf(stderr, "ERRO: Mesas, médicos e pacientes devem ser >= 1.\n");
+        return 1;
+    }
+
+    FilaConcorrente fc;
+    TesteEstresse teste;
+    teste.fila = &fc;
+    teste.pacientes = pacientes;
+    teste.mesas = mesas;
+    teste.vistos = (atomic_uchar*) calloc((size_t) pacientes + 1, sizeof(atomic_uchar));
+    ThreadEstresse* threads = (ThreadEstresse*) calloc((size_t) (mesas + medicos), sizeof(ThreadEstresse));
+    pthread_t* ids = (pthread_t*) calloc((size_t) (mesas + medicos), sizeof(pthread_t));
+    int alocados = teste.vistos != NULL && threads != NULL && ids != NULL;
+    if (!alocados || !inicializaFilaConcorrente(&fc)) {
+        fprintf(stderr, "ERRO: Falha de alocação no teste de estresse.\n");
+        if (alocados) destruirFilaConcorrente(&fc);
+        free(teste.vistos);
+        free(threads);
+        free(ids);
+        return 1;
+    }
+    atomic_init(&teste.duplicados, 0);
+    atomic_init(&teste.recusados, 0);
+
+    int silenciosaAntes = saidaSilenciosa;
+    saidaSilenciosa = 1;
+    double inicio = tempoAgora();
+
+    // Médicos começam antes das mesas: dormem até chegar o primeiro paciente
+    // Só as threads iniciadas entram em 'ids' (os médicos primeiro); os
+    // pacientes de uma mesa que não foi iniciada aparecem como perdidos
+    int iniciadas = 0, medicosIniciados = 0;
+    for (int i = 0; i < mesas + medicos; i++) {
+        threads[i].teste = &teste;
+        threads[i].numero = i < medicos ? i : i - medicos;
+        if (pthread_create(&ids[iniciadas], NULL, i < medicos ? medicoEstresse : mesaEstresse, &threads[i]) != 0)
+            continue;
+        iniciadas++;
+        if (i < medicos) medicosIniciados++;
+    }
+    if (iniciadas < mesas + medicos)
+        fprintf(stderr, "AVISO: Só %d de %d threads foram iniciadas.\n", iniciadas, mesas + medicos);
+    for (int i = medicosIniciados; i < iniciadas; i++) pthread_join(ids[i], NULL);
+    encerrarFilaConcorrente(&fc);
+    for (int i = 0; i < medicosIniciados; i++) pthread_join(ids[i], NULL);
+
+    double segundos = tempoAgora() - inicio;
+    saidaSilenciosa = silenciosaAntes;
+
+    // Conferência: todo ID atendido exatamente uma vez
+    int perdidos = 0;
+    for (int id = 1; id <= pacientes; id++) {
+        if (atomic_load(&teste.vistos[id]) == 0) perdidos++;
+    }
+    int duplicados = atomic_load(&teste.duplicados);
+    size_t noHistorico = tamanhoPilha(fc.historico);
+
+    printf("ESTRESSE: %d mesas, %d médicos, %d pacientes\n", mesas, medicos, pacientes);
+    printf("Tempo: %.3f s (%.0f operações/s)\n", segundos, 2.0 * pacientes / segundos);
+    for (int i = 0; i < medicos; i++) {
+        printf("  Médico %d: %d atendimentos\n", i + 1, threads[i].atendidos);
+    }
+    printf("Perdidos: %d | Duplicados: %d | Recusados: %d | No histórico: %zu\n",
+           perdidos, duplicados, atomic_load(&teste.recusados), noHistorico);
+
+    int ok = perdidos == 0 && duplicados == 0 && noHistorico == (size_t) pacientes;
+    printf("%s\n", ok ? "OK: nenhum paciente perdido ou duplicado." : "FALHA!");
+
+    destruirFilaConcorrente(&fc);
+    free(teste.vistos);
+    free(threads);
+    free(ids);
+    return ok ? 0 : 1;
+}
+
+// ============= DEPARTAMENTOS =============
+// Várias alas de emergência num único processo. Cada departamento tem a
+// sua fila, o seu histórico e o seu pool, protegidos por uma trava só
+// dele: cadastros e atendimentos de departamentos diferentes não disputam
+// nada e cada departamento pode ser atendido por uma thread no seu próprio
+// núcleo. Só o conjunto de IDs é compartilhado (um ID vale para o
+// hospital inteiro), dividido em partes como na fila concorrente.
+//
+// O "próximo paciente do hospital" é escolhido sem travar todos os
+// departamentos: cada um publica, num campo atômico, a chave do seu
+// primeiro paciente (nível de prioridade e hora de chegada). Quem atende
+// lê as chaves, trava só o departamento com a menor e atende o primeiro
+// dele.
+//
+// Numa transferência o paciente sai de um departamento e entra no balde da
+// mesma prioridade no outro, mantendo a hora de chegada (a espera continua
+// contando): ele fica na ordem de chegada, e não no fim, para o primeiro de
+// cada balde continuar sendo o mais antigo. As duas travas nunca são tomadas ao mesmo tempo, então
+// não há ordem de travamento a respeitar; durante a troca o paciente não
+// está em nenhuma fila.
+
+#define MAX_DEPARTAMENTOS 64
+#define TAM_NOME_DEPARTAMENTO 32
+// Chave publicada por um departamento sem pacientes (maior que qualquer outra)
+#define CABECA_VAZIA UINT64_MAX
+
+// Um departamento (alinhado à linha de cache: as travas e os contadores de
+// departamentos vizinhos não dividem a mesma linha)
+typedef struct {
+    _Alignas(64) pthread_mutex_t trava;  // Protege fila, historico e pool
+    Fila fila;
+    Pilha* historico;
+    PoolNos pool;                // Nós da fila e do histórico do departamento
+    _Atomic uint64_t cabeca;     // Chave do primeiro da fila: nível << 32 | chegada
+    atomic_int tamanho;          // Cópia de fila.tamanho lida sem trava
+    atomic_int cadastrados;
+    atomic_int atendidos;
+    atomic_int recebidos;        // Transferências recebidas
+    atomic_int enviados;         // Transferências enviadas
+    char nome[TAM_NOME_DEPARTAMENTO];
+} Departamento;
+
+// Os departamentos de um processo
+typedef struct {
+    Departamento departamentos[MAX_DEPARTAMENTOS];
+    int quantidade;
+    ParteIDs partesIDs[PARTES_IDS_CONCORRENTE];  // IDs usados em qualquer departamento
+} Hospital;
+
+// Inicializa 'quantidade' departamentos; 'nomes' pode ser NULL ("Ala 1"...)
+// Retorna 1 se conseguiu
+int inicializaHospital(Hospital* h, int quantidade, const char* const* nomes) {
+    if (quantidade < 1 || quantidade > MAX_DEPARTAMENTOS) return 0;
+    h->quantidade = quantidade;
+    for (int i = 0; i < PARTES_IDS_CONCORRENTE; i++) {
+        pthread_mutex_init(&h->partesIDs[i].trava, NULL);
+        inicializaIndice(&h->partesIDs[i].ids);
+    }
+    for (int i = 0; i < quantidade; i++) {
+        Departamento* d = &h->departamentos[i];
+        pthread_mutex_init(&d->trava, NULL);
+        inicializaPool(&d->pool);
+        inicializaFilaComPool(&d->fila, &d->pool);
+        d->historico = inicializaPilhaComPool(&d->pool);
+        if (d->historico == NULL) {
+            h->quantidade = i + 1;  // destruirHospital libera só os já iniciados
+            return 0;
+        }
+        atomic_init(&d->cabeca, CABECA_VAZIA);
+        atomic_init(&d->tamanho, 0);
+        atomic_init(&d->cadastrados, 0);
+        atomic_init(&d->atendidos, 0);
+        atomic_init(&d->recebidos, 0);
+        atomic_init(&d->enviados, 0);
+        if (nomes != NULL) snprintf(d->nome, sizeof(d->nome), "%s", nomes[i]);
+        else snprintf(d->nome, sizeof(d->nome), "Ala %d", i + 1);
+    }
+    return 1;
+}
+
+// Libera a memória dos departamentos (nenhuma thread pode estar usando)
+void destruirHospital(Hospital* h) {
+    for (int i = 0; i < h->quantidade; i++) {
+        Departamento* d = &h->departamentos[i];
+        destruirFila(&d->fila);
+        destruirPilha(d->historico);
+        pthread_mutex_destroy(&d->trava);
+    }
+    for (int i = 0; i < PARTES_IDS_CONCORRENTE; i++) {
+        destruirIndice(&h->partesIDs[i].ids);
+        pthread_mutex_destroy(&h->partesIDs[i].trava);
+    }
+}
+
+// Roteamento: departamento com o nome dado, ou -1
+int buscarDepartamento(const Hospital* h, const char* nome) {
+    for (int i = 0; i < h->quantidade; i++) {
+        if (strcmp(h->departamentos[i].nome, nome) == 0) return i;
+    }
+    return -1;
+}
+
+// Atualiza a chave e o tamanho publicados (com a trava do departamento)
+static void publicarDepartamento(Departamento* d) {
+    uint64_t chave = CABECA_VAZIA;
+    if (d->fila.ocupados != 0) {
+        int nivel = __builtin_ctz(d->fila.ocupados);
+        chave = (uint64_t) nivel << 32 | d->fila.baldes[nivel].inicio->chegada;
+    }
+    atomic_store(&d->cabeca, chave);
+    atomic_store(&d->tamanho, d->fila.tamanho);
+}
+
+// Cadastra o paciente na fila do departamento 'dep'
+// Retorna 1 se conseguiu, 0 se o ID já estava em uso no hospital ou
+// faltou memória
+int cadastrarDepartamento(Hospital* h, int dep, Paciente p) {
+    uint64_t inicio = relogioNs();
+    if (!reservarIDPartes(h->partesIDs, p.id)) {
+        registrarOperacao(OPERACAO_INSERIR, inicio, 0);
+        return 0;
+    }
+
+    Departamento* d = &h->departamentos[dep];
+    pthread_mutex_lock(&d->trava);
+    int inserido = inserirFila(&d->fila, p);
+    publicarDepartamento(d);
+    pthread_mutex_unlock(&d->trava);
+    if (!inserido) {  // Sem memória: o ID fica reservado, mas ninguém é contado
+        registrarOperacao(OPERACAO_INSERIR, inicio, 0);
+        return 0;
+    }
+
+    atomic_fetch_add(&d->cadastrados, 1);
+    metricas.contadores[CONTADOR_CADASTRADOS]++;
+    registrarOperacao(OPERACAO_INSERIR, inicio, 1);
+    return 1;
+}
+
+// Retira o primeiro da fila do departamento e o põe no histórico dele
+// (com a trava do departamento); retorna 0 se a fila estava vazia
+static int retirarPrimeiroDepartamento(Departamento* d, Paciente* atendido) {
+    if (d->fila.tamanho == 0) return 0;
+    *atendido = removerFila(&d->fila);
+    push(d->historico, *atendido);
+    publicarDepartamento(d);
+    return 1;
+}
+
+// Registra um atendimento feito por retirarPrimeiroDepartamento
+static void contarAtendimentoDepartamento(Departamento* d, const Paciente* atendido,
+                                          uint32_t espera, uint64_t inicio) {
+    atomic_fetch_add(&d->atendidos, 1);
+    metricas.contadores[CONTADOR_ATENDIDOS]++;
+    registrarEspera(atendido->prioridade, espera);
+    registrarOperacao(OPERACAO_ATENDER, inicio, 1);
+}
+
+// Atende o próximo paciente do departamento 'dep'
+// Retorna 1 e preenche 'atendido', ou 0 se a fila dele estava vazia
+int atenderDepartamento(Hospital* h, int dep, Paciente* atendido) {
+    uint64_t inicio = relogioNs();
+    Departamento* d = &h->departamentos[dep];
+    pthread_mutex_lock(&d->trava);
+    int havia = retirarPrimeiroDepartamento(d, atendido);
+    uint32_t espera = d->fila.ultimaEspera;
+    pthread_mutex_unlock(&d->trava);
+
+    if (!havia) {
+        registrarOperacao(OPERACAO_ATENDER, inicio, 0);
+        return 0;
+    }
+    contarAtendimentoDepartamento(d, atendido, espera, inicio);
+    return 1;
+}
+
+// Atende o próximo paciente do hospital: o de maior prioridade e, entre
+// iguais, o que chegou primeiro, qualquer que seja o departamento
+// As chaves são lidas sem trava; se o departamento escolhido esvaziou
+// antes de ser travado (outro médico levou o paciente), lê de novo
+// Retorna 1 e preenche 'atendido' e 'dep' (se não for NULL), ou 0 se
+// todos os departamentos estavam vazios
+int atenderProximoHospital(Hospital* h, Paciente* atendido, int* dep) {
+    uint64_t inicio = relogioNs();
+    for (;;) {
+        int melhor = -1;
+        uint64_t menor = CABECA_VAZIA;
+        for (int i = 0; i < h->quantidade; i++) {
+            uint64_t chave = atomic_load(&h->departamentos[i].cabeca);
+            if (chave < menor) {
+                menor = chave;
+                melhor = i;
+            }
+        }
+        if (melhor < 0) {
+            registrarOperacao(OPERACAO_ATENDER, inicio, 0);
+            return 0;
+        }
+
+        Departamento* d = &h->departamentos[melhor];
+        pthread_mutex_lock(&d->trava);
+        int havia = retirarPrimeiroDepartamento(d, atendido);
+        uint32_t espera = d->fila.ultimaEspera;
+        pthread_mutex_unlock(&d->trava);
+
+        if (havia) {
+            contarAtendimentoDepartamento(d, atendido, espera, inicio);
+            if (dep != NULL) *dep = melhor;
+            return 1;
+        }
+    }
+}
+
+// Põe no balde da sua prioridade um paciente vindo de outro departamento,
+// com a hora de chegada original e na ordem de chegada
+static void receberTransferido(Departamento* d, Paciente p, uint32_t chegada) {
+    pthread_mutex_lock(&d->trava);
+    int nivel = nivelDaPrioridade(p.prioridade);
+    uint32_t posicao = posicaoPorEntrada(&d->fila.baldes[nivel], chegada);
+    restaurarFila(&d->fila, p, nivel, posicao, chegada, chegada);
+    publicarDepartamento(d);
+    pthread_mutex_unlock(&d->trava);
+    atomic_fetch_add(&d->recebidos, 1);
+}
+
+// Transfere o paciente 'id' da fila do departamento 'origem' para a do
+// departamento 'destino'
+// Retorna 1 se conseguiu, 0 se o paciente não estava na fila da origem
+int transferirPaciente(Hospital* h, int id, int origem, int destino) {
+    if (origem == destino) return buscarIndice(&h->departamentos[origem].fila.indice, id) != NULL;
+
+    Departamento* de = &h->departamentos[origem];
+    Paciente p;
+    pthread_mutex_lock(&de->trava);
+    int estava = retirarFila(&de->fila, id, &p);
+    uint32_t chegada = de->fila.ultimaChegada;
+    if (estava) publicarDepartamento(de);
+    pthread_mutex_unlock(&de->trava);
+    if (!estava) return 0;
+
+    atomic_fetch_add(&de->enviados, 1);
+    receberTransferido(&h->departamentos[destino], p, chegada);
+    return 1;
+}
+
+// Retira o último paciente do balde menos urgente (o que menos perde com a
+// mudança de departamento); retorna 0 se a fila estava vazia
+static int retirarUltimoDepartamento(Departamento* d, Paciente* p, uint32_t* chegada) {
+    pthread_mutex_lock(&d->trava);
+    int havia = 0;
+    for (int i = NUM_PRIORIDADES - 1; i >= 0 && !havia; i--) {
+        No* ultimo = d->fila.baldes[i].fim;
+        if (ultimo == NULL) continue;
+        havia = retirarFila(&d->fila, ultimo->dados.id, p);
+        *chegada = d->fila.ultimaChegada;
+    }
+    if (havia) publicarDepartamento(d);
+    pthread_mutex_unlock(&d->trava);
+    return havia;
+}
+
+// Rebalanceamento: enquanto a fila mais longa tiver mais de 'tolerancia'
+// pacientes a mais que a mais curta, o último paciente menos urgente da
+// mais longa vai para a mais curta
+// Retorna quantos pacientes foram transferidos
+int rebalancearHospital(Hospital* h, int tolerancia) {
+    if (tolerancia < 1) tolerancia = 1;
+    int movidos = 0;
+    for (;;) {
+        int maior = 0, menor = 0;
+        for (int i = 1; i < h->quantidade; i++) {
+            int tamanho = atomic_load(&h->departamentos[i].tamanho);
+            if (tamanho > atomic_load(&h->departamentos[maior].tamanho)) maior = i;
+            if (tamanho < atomic_load(&h->departamentos[menor].tamanho)) menor = i;
+        }
+        int diferenca = atomic_load(&h->departamentos[maior].tamanho) -
+                        atomic_load(&h->departamentos[menor].tamanho);
+        if (diferenca <= tolerancia) return movidos;
+
+        Paciente p;
+        uint32_t chegada;
+        if (!retirarUltimoDepartamento(&h->departamentos[maior], &p, &chegada)) continue;
+        atomic_fetch_add(&h->departamentos[maior].enviados, 1);
+        receberTransferido(&h->departamentos[menor], p, chegada);
+        movidos++;
+    }
+}
+
+// Relatório somado de todos os departamentos, com uma linha por departamento
+void relatorioHospital(Hospital* h) {
+    int total[NUM_PRIORIDADES] = {0};
+    int cadastrados = 0, atendidos = 0, transferidos = 0;
+
+    int largura = larguraRotulosPrioridade(10);
+
+    printf("\n========== RELATÓRIO DOS DEPARTAMENTOS ==========\n");
+    printf("%-20s", "Departamento");
+    for (int j = 0; j < NUM_PRIORIDADES; j++) {
+        const char* rotulo = obterNomePrioridade(PRIORIDADE_MAXIMA + j);
+        printf(" %*s", larguraEmBytes(rotulo, largura), rotulo);
+    }
+    printf(" %10s %10s %10s\n", "Cadastros", "Atendidos", "Transf.");
+    for (int i = 0; i < h->quantidade; i++) {
+        Departamento* d = &h->departamentos[i];
+        int nivel[NUM_PRIORIDADES];
+        pthread_mutex_lock(&d->trava);
+        for (int j = 0; j < NUM_PRIORIDADES; j++) nivel[j] = d->fila.baldes[j].quantidade;
+        pthread_mutex_unlock(&d->trava);
+
+        int c = atomic_load(&d->cadastrados), a = atomic_load(&d->atendidos);
+        int r = atomic_load(&d->recebidos), e = atomic_load(&d->enviados);
+        printf("%-20s", d->nome);
+        for (int j = 0; j < NUM_PRIORIDADES; j++) printf(" %*d", largura, nivel[j]);
+        printf(" %10d %10d %+10d\n", c, a, r - e);
+        for (int j = 0; j < NUM_PRIORIDADES; j++) total[j] += nivel[j];
+        cadastrados += c;
+        atendidos += a;
+        transferidos += e;
+    }
+    printf("%-20s", "TOTAL");
+    for (int j = 0; j < NUM_PRIORIDADES; j++) printf(" %*d", largura, total[j]);
+    printf(" %10d %10d %10d\n", cadastrados, atendidos, transferidos);
+    printf("=================================================\n");
+}
+
+// ---------- Teste dos departamentos ----------
+// Cada departamento ganha uma thread fixada num núcleo, que cadastra os
+// pacientes do departamento, atende parte deles e transfere alguns para o
+// departamento vizinho. Ao mesmo tempo, médicos do hospital atendem pelo
+// "próximo paciente" global. No fim, a fila é rebalanceada e esvaziada
+// pelo atendimento global, que precisa sair em ordem de prioridade, e cada
+// ID precisa ter sido atendido exatamente uma vez.
+
+// Dados compartilhados pelas threads do teste
+typedef struct {
+    Hospital* hospital;
+    int pacientes;
+    atomic_uchar* vistos;        // vistos[id] = vezes que o ID foi atendido
+    atomic_int duplicados;
+    atomic_int transferencias;
+    atomic_int cadastrando;      // Departamentos que ainda estão cadastrando
+} TesteDepartamentos;
+
+// Parâmetros de uma thread do teste
+typedef struct {
+    TesteDepartamentos* teste;
+    int numero;
+} ThreadDepartamento;
+
+// Fixa a thread atual num núcleo (só no Linux; nos outros sistemas o
+// escalonador decide)
+static void fixarNucleo(int nucleo) {
+#ifdef __linux__
+    long nucleos = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nucleos < 1) return;
+    cpu_set_t conjunto;
+    CPU_ZERO(&conjunto);
+    CPU_SET(nucleo % nucleos, &conjunto);
+    pthread_setaffinity_np(pthread_self(), sizeof(conjunto), &conjunto);
+#else
+    (void) nucleo;
+#endif
+}
+
+// Confere que o paciente atendido não tinha sido atendido antes
+static void marcarAtendido(TesteDepartamentos* teste, const Paciente* p) {
+    if (atomic_fetch_add(&teste->vistos[p->id], 1) != 0)
+        atomic_fetch_add(&teste->duplicados, 1);
+}
+
+// Thread de um departamento: IDs numero+1, numero+1+departamentos, ...
+static void* threadDepartamento(void* arg) {
+    ThreadDepartamento* t = (ThreadDepartamento*) arg;
+    TesteDepartamentos* teste = t->teste;
+    Hospital* h = teste->hospital;
+    fixarNucleo(t->numero);
+
+    NomeRef ref = internarNome(h->departamentos[t->numero].nome);
+    int vizinho = (t->numero + 1) % h->quantidade;
+    uint32_t semente = 2463534242u + (uint32_t) t->numero;
+    int k = 0;
+    for (int id = t->numero + 1; id <= teste->pacientes; id += h->quantidade, k++) {
+        semente ^= semente << 13;
+        semente ^= semente >> 17;
+        semente ^= semente << 5;
+        Paciente p = {id, ref, (uint16_t) (IDADE_MIN + semente % IDADE_MAX),
+                      (int8_t) (PRIORIDADE_MAXIMA + semente % NUM_PRIORIDADES), 0};
+        cadastrarDepartamento(h, t->numero, p);
+
+        Paciente atendido;
+        if (k % 4 == 3 && atenderDepartamento(h, t->numero, &atendido)) marcarAtendido(teste, &atendido);
+        if (k % 16 == 7 && transferirPaciente(h, id - 4 * h->quantidade, t->numero, vizinho))
+            atomic_fetch_add(&teste->transferencias, 1);
+    }
+    atomic_fetch_sub(&teste->cadastrando, 1);
+    return NULL;
+}
+
+// Médico do hospital: atende pelo próximo global enquanto houver cadastros
+static void* medicoHospital(void* arg) {
+    TesteDepartamentos* teste = (TesteDepartamentos*) arg;
+    Paciente p;
+    while (atomic_load(&teste->cadastrando) > 0) {
+        if (atenderProximoHospital(teste->hospital, &p, NULL)) marcarAtendido(teste, &p);
+        else sched_yield();
+    }
+    return NULL;
+}
+
+// Executa o teste dos departamentos; retorna 0 se nenhum paciente foi
+// perdido ou duplicado e o esvaziamento global respeitou as prioridades
+int executarDepartamentos(int departamentos, int medicos, int pacientes) {
+    if (departamentos < 1 || departamentos > MAX_DEPARTAMENTOS || medicos < 0 || pacientes < 1) {
+        fprintf(stderr, "ERRO: Use de 1 a %d departamentos, médicos >= 0 e pacientes >= 1.\n",
+                MAX_DEPARTAMENTOS);
+        return 1;
+    }
+
+    Hospital* h = (Hospital*) aligned_alloc(64, sizeof(Hospital));
+    TesteDepartamentos teste;
+    teste.hospital = h;
+    teste.pacientes = pacientes;
+    teste.vistos = (atomic_uchar*) calloc((size_t) pacientes + 1, sizeof(atomic_uchar));
+    ThreadDepartamento* threads = (ThreadDepartamento*) calloc((size_t) departamentos, sizeof(ThreadDepartamento));
+    pthread_t* ids = (pthread_t*) calloc((size_t) (departamentos + medicos), sizeof(pthread_t));
+    int alocados = h != NULL && teste.vistos != NULL && threads != NULL && ids != NULL;
+    if (!alocados || !inicializaHospital(h, departamentos, NULL)) {
+        fprintf(stderr, "ERRO: Falha de alocação no teste dos departamentos.\n");
+        if (alocados) destruirHospital(h);
+        free(h);
+        free(teste.vistos);
+        free(threads);
+        free(ids);
+        return 1;
+    }
+    atomic_init(&teste.duplicados, 0);
+    atomic_init(&teste.transferencias, 0);
+    atomic_init(&teste.cadastrando, departamentos);
+
+    int silenciosaAntes = saidaSilenciosa;
+    saidaSilenciosa = 1;
+    double inicio = tempoAgora();
+
+    // Só as threads iniciadas entram em 'ids'. Um departamento que não foi
+    // iniciado não cadastra ninguém (seus pacientes aparecem como perdidos)
+    // e já sai da contagem de quem está cadastrando, para os médicos pararem
+    int iniciadas = 0;
+    for (int i = 0; i < departamentos; i++) {
+        threads[i].teste = &teste;
+        threads[i].numero = i;
+        if (pthread_create(&ids[iniciadas], NULL, threadDepartamento, &threads[i]) == 0) iniciadas++;
+        else atomic_fetch_sub(&teste.cadastrando, 1);
+    }
+    for (int i = 0; i < medicos; i++) {
+        if (pthread_create(&ids[iniciadas], NULL, medicoHospital, &teste) == 0) iniciadas++;
+    }
+    if (iniciadas < departamentos + medicos)
+        fprintf(stderr, "AVISO: Só %d de %d threads foram iniciadas.\n", iniciadas, departamentos + medicos);
+    for (int i = 0; i < iniciadas; i++) pthread_join(ids[i], NULL);
+    double segundos = tempoAgora() - inicio;
+
+    printf("DEPARTAMENTOS: %d departamentos, %d médicos do hospital, %d pacientes\n",
+           departamentos, medicos, pacientes);
+    printf("Tempo: %.3f s | Transferências: %d\n", segundos, atomic_load(&teste.transferencias));
+    relatorioHospital(h);
+
+    int movidos = rebalancearHospital(h, 1);
+    printf("Rebalanceamento: %d pacientes transferidos\n", movidos);
+    relatorioHospital(h);
+
+    // Esvaziamento pelo próximo global: as prioridades não podem voltar atrás
+    int foraDeOrdem = 0, ultimaPrioridade = PRIORIDADE_MAXIMA;
+    Paciente p;
+    while (atenderProximoHospital(h, &p, NULL)) {
+        marcarAtendido(&teste, &p);
+        if (p.prioridade < ultimaPrioridade) foraDeOrdem++;
+        ultimaPrioridade = p.prioridade;
+    }
+    saidaSilenciosa = silenciosaAntes;
+
+    int perdidos = 0;
+    for (int id = 1; id <= pacientes; id++) {
+        if (atomic_load(&teste.vistos[id]) == 0) perdidos++;
+    }
+    size_t noHistorico = 0;
+    for (int i = 0; i < departamentos; i++) noHistorico += tamanhoPilha(h->departamentos[i].historico);
+    int duplicados = atomic_load(&teste.duplicados);
+
+    printf("Perdidos: %d | Duplicados: %d | Fora de ordem: %d | Nos históricos: %zu\n",
+           perdidos, duplicados, foraDeOrdem, noHistorico);
+    int ok = perdidos == 0 && duplicados == 0 && foraDeOrdem == 0 && noHistorico == (size_t) pacientes;
+    printf("%s\n", ok ? "OK: nenhum paciente perdido ou duplicado." : "FALHA!");
+
+    destruirHospital(h);
+    free(h);
+    free(teste.vistos);
+    free(threads);
+    free(ids);
+    return ok ? 0 : 1;
+}
+
+// ============= SIMULAÇÃO =============
+// Simulação de eventos discretos para dimensionar a equipe: chegadas
+// sintéticas passam pelo código real da fila (inserirFila, removerFila e
+// push), sem um modelo à parte. O relógio é virtual: relogioMs devolve o
+// instante da simulação, então a espera, o envelhecimento e as métricas
+// da fila funcionam como em produção, e um mês de pronto-socorro roda em
+// poucos segundos. Com a mesma semente, o resultado é sempre o mesmo.
+//
+// - Chegadas: um processo de Poisson por prioridade. Cada chegada traz um
+//   grupo de pacientes de tamanho geométrico (média 'rajada'), o que
+//   imita ambulâncias e acidentes com várias vítimas; a taxa de pacientes
+//   por hora continua a pedida.
+// - Atendimento: duração exponencial com a média da prioridade da triagem.
+// - Médicos: cada um atende um paciente por vez; quem fica livre chama o
+//   primeiro da fila (removerFila) e o atendimento vai para o histórico.
+// Os eventos são as chegadas de cada prioridade (uma por prioridade,
+// olhadas como os baldes da fila) e o fim de cada atendimento em curso
+// (um heap de mínimo, pois podem ser centenas de médicos ocupados).
+
+#define MAX_MEDICOS_SIMULACAO 1000
+#define MAX_DIAS_SIMULACAO 365
+
+// Parâmetros de uma simulação
+typedef struct {
+    double dias;                                // Duração simulada
+    int medicos;
+    uint64_t semente;
+    double chegadasHora[NUM_PRIORIDADES];       // Pacientes por hora
+    double minutosAtendimento[NUM_PRIORIDADES]; // Duração média do atendimento
+    double rajada;                              // Pacientes por chegada, em média (>= 1)
+    uint32_t envelhecimentoMs;                  // 0 = desligado
+} ConfigSimulacao;
+
+// Valores padrão: um pronto-socorro com ~400 pacientes por dia
+// (as chegadas e durações de cada prioridade vêm da escala)
+#define PRIORIDADE_CHEGADAS(nome, rotulo, chegadas, minutos) chegadas,
+#define PRIORIDADE_MINUTOS(nome, rotulo, chegadas, minutos) minutos,
+const ConfigSimulacao CONFIG_SIMULACAO_PADRAO = {30, 6, 1, {PRIORIDADES(PRIORIDADE_CHEGADAS)},
+                                                 {PRIORIDADES(PRIORIDADE_MINUTOS)}, 1.2, 0};
+
+// Lê uma lista de números separados por vírgula ("1.5,5,10") em 'valores'
+// Retorna quantos foram lidos, ou -1 se a lista tiver mais de 'maximo'
+// números ou algo que não seja número
+int lerListaNumeros(const char* texto, double* valores, int maximo) {
+    int quantidade = 0;
+    for (;;) {
+        char* fim;
+        double valor = strtod(texto, &fim);
+        if (fim == texto || quantidade == maximo) return -1;
+        valores[quantidade++] = valor;
+        if (*fim == '\0') return quantidade;
+        if (*fim != ',') return -1;
+        texto = fim + 1;
+    }
+}
+
+// Logaritmo natural sem a libm (o programa compila sem -lm): x = m * 2^e
+// com m em [0.75, 1.5), onde a série de atanh converge em poucos termos
+static double logaritmoNatural(double x) {
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int expoente = (int) ((bits >> 52) & 0x7FF) - 1023;
+    bits = (bits & 0x000FFFFFFFFFFFFFull) | 0x3FF0000000000000ull;  // m em [1, 2)
+    double m;
+    memcpy(&m, &bits, sizeof(m));
+    if (m > 1.5) {
+        m /= 2;
+        expoente++;
+    }
+    double t = (m - 1) / (m + 1), t2 = t * t, termo = t, soma = 0;
+    for (int k = 1; k < 25; k += 2) {
+        soma += termo / k;
+        termo *= t2;
+    }
+    return 2 * soma + expoente * 0.69314718055994530942;
+}
+
+// Número uniforme em (0, 1]
+static double uniformeAberto(uint64_t* semente) {
+    return (double) ((proximoAleatorio(semente) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+// Amostra exponencial com a média dada
+static double amostraExponencial(uint64_t* semente, double media) {
+    return -media * logaritmoNatural(uniformeAberto(semente));
+}
+
+// Estado de uma simulação
+typedef struct {
+    ConfigSimulacao config;
+    PoolNos pool;                            // Só desta simulação: nada é compartilhado
+    Fila fila;
+    Pilha* historico;
+    uint64_t agora;                          // Relógio virtual (ms desde o início)
+    uint64_t fim;
+    uint64_t proximaChegada[NUM_PRIORIDADES];
+    uint64_t* fimAtendimento;                // Heap de mínimo dos atendimentos em curso
+    int* medicoAtendendo;                    //   e o médico de cada um
+    int ocupados;
+    int* livres;                             // Pilha de médicos livres
+    int numLivres;
+    int proximoID;
+    NomeRef nome;
+    // Resultados
+    uint64_t chegadas[NUM_PRIORIDADES];      // Pela prioridade da triagem
+    uint64_t atendidos[NUM_PRIORIDADES];
+    HistogramaLatencia espera[NUM_PRIORIDADES];
+    double areaFila[NUM_PRIORIDADES];        // Integral de pacientes no balde (ms)
+    int maiorFila[NUM_PRIORIDADES];
+    double areaOcupados;                     // Integral de médicos ocupados (ms)
+    HistogramaLatencia tamanhoFila;          // Pacientes em espera, a cada minuto simulado
+    uint64_t eventos;
+} Simulacao;
+
+// Avança o relógio virtual até 't', acumulando o tamanho dos baldes e a
+// ocupação dos médicos no intervalo
+static void avancarRelogio(Simulacao* s, uint64_t t) {
+    registrarAmostras(&s->tamanhoFila, (uint64_t) s->fila.tamanho, t / 60000 - s->agora / 60000);
+    double dt = (double) (t - s->agora);
+    for (int i = 0; i < NUM_PRIORIDADES; i++) s->areaFila[i] += dt * s->fila.baldes[i].quantidade;
+    s->areaOcupados += dt * s->ocupados;
+    s->agora = t;
+    agoraSimuladoMs = (uint32_t) t;  // Volta a zero a cada ~49 dias, como o relógio real
+}
+
+// Sorteia o instante da próxima chegada da prioridade no nível 'nivel'
+static void agendarChegada(Simulacao* s, int nivel) {
+    double mediaMs = 3600000.0 * s->config.rajada / s->config.chegadasHora[nivel];
+    s->proximaChegada[nivel] = s->config.chegadasHora[nivel] > 0
+        ? s->agora + 1 + (uint64_t) amostraExponencial(&s->config.semente, mediaMs)
+        : UINT64_MAX;
+}
+
+// Uma chegada: um grupo de pacientes entra na fila
+static void chegadaSimulada(Simulacao* s, int nivel) {
+    // Tamanho geométrico com média 'rajada': continua com probabilidade q
+    double q = 1 - 1 / s->config.rajada;
+    do {
+        uint64_t sorteio = proximoAleatorio(&s->config.semente);
+        Paciente p = {s->proximoID++, s->nome, (uint16_t) (IDADE_MIN + sorteio % 100),
+                      (int8_t) (PRIORIDADE_MAXIMA + nivel), 0};
+        inserirFila(&s->fila, p);
+        s->chegadas[nivel]++;
+        if (s->fila.baldes[nivel].quantidade > s->maiorFila[nivel])
+            s->maiorFila[nivel] = s->fila.baldes[nivel].quantidade;
+    } while (uniformeAberto(&s->config.semente) <= q);
+    agendarChegada(s, nivel);
+}
+
+// Põe um atendimento em curso no heap
+static void iniciarAtendimentoSimulado(Simulacao* s, int medico, uint64_t fim) {
+    int i = s->ocupados++;
+    while (i > 0 && s->fimAtendimento[(i - 1) / 2] > fim) {
+        s->fimAtendimento[i] = s->fimAtendimento[(i - 1) / 2];
+        s->medicoAtendendo[i] = s->medicoAtendendo[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    s->fimAtendimento[i] = fim;
+    s->medicoAtendendo[i] = medico;
+}
+
+// Tira do heap o atendimento que termina primeiro; retorna o médico
+static int terminarAtendimentoSimulado(Simulacao* s) {
+    int medico = s->medicoAtendendo[0];
+    uint64_t fim = s->fimAtendimento[--s->ocupados];
+    int ultimo = s->medicoAtendendo[s->ocupados];
+    int i = 0;
+    for (;;) {
+        int filho = 2 * i + 1;
+        if (filho >= s->ocupados) break;
+        if (filho + 1 < s->ocupados && s->fimAtendimento[filho + 1] < s->fimAtendimento[filho]) filho++;
+        if (s->fimAtendimento[filho] >= fim) break;
+        s->fimAtendimento[i] = s->fimAtendimento[filho];
+        s->medicoAtendendo[i] = s->medicoAtendendo[filho];
+        i = filho;
+    }
+    s->fimAtendimento[i] = fim;
+    s->medicoAtendendo[i] = ultimo;
+    return medico;
+}
+
+// Os médicos livres chamam os primeiros da fila
+static void chamarPacientes(Simulacao* s) {
+    while (s->numLivres > 0 && s->fila.tamanho > 0) {
+        Paciente p = removerFila(&s->fila);
+        push(s->historico, p);
+        int nivel = nivelDaPrioridade(p.prioridade);
+        s->atendidos[nivel]++;
+        registrarLatencia(&s->espera[nivel], (uint64_t) s->fila.ultimaEspera * 1000000u);
+
+        int medico = s->livres[--s->numLivres];
+        iniciarAtendimentoSimulado(s, medico, s->agora + 1 +
+            (uint64_t) amostraExponencial(&s->config.semente, 60000.0 * s->config.minutosAtendimento[nivel]));
+    }
+}
+
+// Executa a simulação até o fim do período, com o relógio virtual da
+// thread ligado
+static void rodarSimulacao(Simulacao* s) {
+    relogioSimulado = 1;
+    agoraSimuladoMs = 0;
+    for (int i = 0; i < NUM_PRIORIDADES; i++) agendarChegada(s, i);
+    for (;;) {
+        // Próximo evento: a chegada ou o fim de atendimento mais cedo
+        uint64_t t = s->ocupados > 0 ? s->fimAtendimento[0] : UINT64_MAX;
+        int chegada = -1;
+        for (int i = 0; i < NUM_PRIORIDADES; i++) {
+            if (s->proximaChegada[i] < t) {
+                t = s->proximaChegada[i];
+                chegada = i;
+            }
+        }
+        if (t > s->fim) break;
+
+        avancarRelogio(s, t);
+        s->eventos++;
+        if (chegada >= 0) chegadaSimulada(s, chegada);
+        else s->livres[s->numLivres++] = terminarAtendimentoSimulado(s);
+        chamarPacientes(s);
+    }
+    avancarRelogio(s, s->fim);
+    relogioSimulado = 0;
+}
+
+// Imprime o resultado da simulação (tempos em minutos)
+static void relatorioSimulacao(const Simulacao* s, double segundosReais) {
+    const ConfigSimulacao* c = &s->config;
+    double horas = (double) s->fim / 3600000.0;
+    printf("SIMULAÇÃO: %.1f dias, %d médicos, rajada média %.2f, envelhecimento %s\n",
+           c->dias, c->medicos, c->rajada, c->envelhecimentoMs > 0 ? "ligado" : "desligado");
+    int largura = larguraRotulosPrioridade(10);
+    printf("%-*s  Chegadas/h  Atend.(min)  Chegadas  Atendidos  Por hora  Fila média  Fila máx"
+           "  Espera média    p50    p90    p99    máx\n", largura, "Prioridade");
+    uint64_t totalChegadas = 0, totalAtendidos = 0;
+    for (int i = 0; i < NUM_PRIORIDADES; i++) {
+        const HistogramaLatencia* e = &s->espera[i];
+        const char* rotulo = obterNomePrioridade(PRIORIDADE_MAXIMA + i);
+        printf("%-*s  %10.2f  %11.1f  %8llu  %9llu  %8.2f  %10.2f  %8d  %12.1f %6.1f %6.1f %6.1f %6.1f\n",
+               larguraEmBytes(rotulo, largura), rotulo, c->chegadasHora[i], c->minutosAtendimento[i],
+               (unsigned long long) s->chegadas[i], (unsigned long long) s->atendidos[i],
+               (double) s->atendidos[i] / horas, s->areaFila[i] / (double) s->fim, s->maiorFila[i],
+               mediaLatencia(e) / 6e10, (double) percentilLatencia(e, 50) / 6e10,
+               (double) percentilLatencia(e, 90) / 6e10, (double) percentilLatencia(e, 99) / 6e10,
+               (double) maximoLatencia(e) / 6e10);
+        totalChegadas += s->chegadas[i];
+        totalAtendidos += s->atendidos[i];
+    }
+    printf("Total: %llu chegadas, %llu atendidos (%.2f por hora), %d em espera no fim\n",
+           (unsigned long long) totalChegadas, (unsigned long long) totalAtendidos,
+           (double) totalAtendidos / horas, s->fila.tamanho);
+    printf("Ocupação dos médicos: %.1f%% | Eventos: %llu | Tempo real: %.3f s\n",
+           100.0 * s->areaOcupados / ((double) s->fim * c->medicos),
+           (unsigned long long) s->eventos, segundosReais);
+    const HistogramaLatencia* f = &s->tamanhoFila;
+    printf("Pacientes em espera (a cada minuto): média %.1f | p50 %llu | p90 %llu | p99 %llu | máx %llu\n",
+           mediaLatencia(f), (unsigned long long) percentilLatencia(f, 50),
+           (unsigned long long) percentilLatencia(f, 90), (unsigned long long) percentilLatencia(f, 99),
+           (unsigned long long) maximoLatencia(f));
+}
+
+// Confere os parâmetros; retorna 1 se servem
+static int validarConfigSimulacao(const ConfigSimulacao* config) {
+    if (config->dias <= 0 || config->dias > MAX_DIAS_SIMULACAO ||
+        config->medicos < 1 || config->medicos > MAX_MEDICOS_SIMULACAO || config->rajada < 1) {
+        fprintf(stderr, "ERRO: Use mais de 0 e até %d dias, de 1 a %d médicos e rajada >= 1.\n",
+                MAX_DIAS_SIMULACAO, MAX_MEDICOS_SIMULACAO);
+        return 0;
+    }
+    for (int i = 0; i < NUM_PRIORIDADES; i++) {
+        if (config->chegadasHora[i] < 0 || config->minutosAtendimento[i] <= 0) {
+            fprintf(stderr, "ERRO: As chegadas devem ser >= 0 e as durações > 0.\n");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Prepara uma simulação zerada ('s' vem de calloc) com fila, histórico e
+// pool próprios; retorna 0 se faltar memória
+static int prepararSimulacao(Simulacao* s, const ConfigSimulacao* config, NomeRef nome) {
+    s->config = *config;
+    s->fim = (uint64_t) (config->dias * 86400000.0);
+    s->fimAtendimento = (uint64_t*) calloc((size_t) config->medicos, sizeof(uint64_t));
+    s->medicoAtendendo = (int*) malloc((size_t) config->medicos * sizeof(int));
+    s->livres = (int*) malloc((size_t) config->medicos * sizeof(int));
+    inicializaPool(&s->pool);
+    s->historico = inicializaPilhaComPool(&s->pool);
+    if (s->fimAtendimento == NULL || s->medicoAtendendo == NULL || s->livres == NULL || s->historico == NULL)
+        return 0;
+    // O médico 0 é o primeiro a ser chamado
+    for (int m = 0; m < config->medicos; m++) s->livres[m] = config->medicos - 1 - m;
+    s->numLivres = config->medicos;
+    s->proximoID = ID_MIN;
+    s->nome = nome;
+    inicializaFilaComPool(&s->fila, &s->pool);
+    s->fila.envelhecimentoMs = config->envelhecimentoMs;
+    return 1;
+}
+
+// Libera o que prepararSimulacao alocou (a estrutura em si fica)
+static void liberarSimulacao(Simulacao* s) {
+    if (s->fila.pool != NULL) destruirFila(&s->fila);
+    if (s->historico != NULL) destruirPilha(s->historico);
+    free(s->fimAtendimento);
+    free(s->medicoAtendendo);
+    free(s->livres);
+}
+
+// Executa a simulação descrita por 'config'
+// Retorna 0 se terminou, 1 em caso de parâmetros inválidos ou falta de memória
+int executarSimulacao(const ConfigSimulacao* config) {
+    if (!validarConfigSimulacao(config)) return 1;
+
+    Simulacao* s = (Simulacao*) calloc(1, sizeof(Simulacao));
+    if (s == NULL || !prepararSimulacao(s, config, internarNome("Simulado"))) {
+        fprintf(stderr, "ERRO: Falha de alocação na simulação.\n");
+        return 1;
+    }
+
+    int silenciosaAntes = saidaSilenciosa;
+    saidaSilenciosa = 1;
+    double inicio = tempoAgora();
+    rodarSimulacao(s);
+    double segundos = tempoAgora() - inicio;
+    saidaSilenciosa = silenciosaAntes;
+
+    relatorioSimulacao(s, segundos);
+
+    liberarSimulacao(s);
+    free(s);
+    destruirArmazemNomes();
+    return 0;
+}
+
+// ---------- Varredura em paralelo ----------
+// Uma simulação só diz pouco: --varredura roda 'repeticoes' simulações
+// (sementes diferentes) para cada quantidade de médicos, do mínimo ao
+// máximo, e cada fator de carga (multiplica as chegadas por hora). As
+// rodadas não compartilham nada: cada uma tem a sua fila, o seu histórico,
+// o seu pool e o relógio virtual da sua thread.
+// Distribuição por roubo de trabalho: cada thread recebe uma faixa
+// contígua de rodadas e as tira do início; sem trabalho, rouba a metade
+// final da faixa de outra. A faixa é o par (início, fim) num inteiro
+// atômico de 64 bits trocado por CAS, sem trava. Rodadas com poucos
+// médicos demoram mais (filas longas), e o roubo equilibra isso.
+// Cada rodada soma as suas distribuições nos histogramas (atômicos) da sua
+// célula, médicos x carga. As médias são somadas no fim, na ordem das
+// rodadas, e a semente de cada rodada só depende do seu número: a saída
+// é a mesma com qualquer quantidade de threads.
+
+#define MAX_CARGAS_VARREDURA 16
+#define MAX_THREADS_VARREDURA 256
+
+// Uma célula da varredura: quantidade de médicos e fator de carga
+typedef struct {
+    int medicos;
+    double carga;
+    HistogramaLatencia espera[NUM_PRIORIDADES];  // Espera dos atendidos (ns), somada das rodadas
+    HistogramaLatencia tamanhoFila;              // Pacientes em espera a cada minuto
+} CelulaVarredura;
+
+// Números de uma rodada que entram nas médias da célula
+typedef struct {
+    double atendidosHora;
+    double ocupacao;      // Fração do tempo com os médicos ocupados
+} ResultadoRodada;
+
+// Parâmetros da varredura
+typedef struct {
+    ConfigSimulacao base;               // Dias, chegadas, durações, rajada, semente...
+    int medicosMin, medicosMax;
+    int repeticoes;
+    double cargas[MAX_CARGAS_VARREDURA];
+    int numCargas;
+    int threads;                        // 0 = um por núcleo
+} ConfigVarredura;
+
+typedef struct TrabalhadorVarredura TrabalhadorVarredura;
+
+// Estado compartilhado (só leitura, exceto os histogramas atômicos das
+// células e a posição de cada rodada nos resultados)
+typedef struct {
+    const ConfigVarredura* config;
+    CelulaVarredura* celulas;
+    ResultadoRodada* resultados;
+    int rodadas;
+    NomeRef nome;
+    TrabalhadorVarredura* trabalhadores;
+    int threads;
+    atomic_int falhas;
+} Varredura;
+
+// Uma thread da varredura
+struct TrabalhadorVarredura {
+    _Alignas(64) _Atomic uint64_t faixa;  // Rodadas [início, fim) ainda não pegas: início << 32 | fim
+    Varredura* varredura;
+    int numero;
+    uint64_t rodadas;                     // Rodadas executadas por esta thread
+    uint64_t roubos;                      // Faixas roubadas de outras
+};
+
+// Quantidade de núcleos disponíveis (1 se não der para saber)
+static int numeroDeNucleos() {
+#ifdef _SC_NPROCESSORS_ONLN
+    long nucleos = sysconf(_SC_NPROCESSORS_ONLN);
+    return nucleos > 0 ? (int) nucleos : 1;
+#else
+    return 1;
+#endif
+}
+
+// Tira a primeira rodada da faixa; retorna 0 se ela estiver vazia
+static int pegarRodada(_Atomic uint64_t* faixa, int* rodada) {
+    uint64_t atual = atomic_load(faixa);
+    for (;;) {
+        uint32_t inicio = (uint32_t) (atual >> 32), fim = (uint32_t) atual;
+        if (inicio >= fim) return 0;
+        if (atomic_compare_exchange_weak(faixa, &atual, ((uint64_t) (inicio + 1) << 32) | fim)) {
+            *rodada = (int) inicio;
+            return 1;
+        }
+    }
+}
+
+// Rouba a metade final da faixa de outra thread para a própria
+// Retorna 0 se todas as outras estão sem trabalho
+static int roubarRodadas(TrabalhadorVarredura* t) {
+    Varredura* v = t->varredura;
+    for (int k = 1; k < v->threads; k++) {
+        _Atomic uint64_t* faixa = &v->trabalhadores[(t->numero + k) % v->threads].faixa;
+        uint64_t atual = atomic_load(faixa);
+        for (;;) {
+            uint32_t inicio = (uint32_t) (atual >> 32), fim = (uint32_t) atual;
+            if (inicio >= fim) break;
+            uint32_t corte = fim - (fim - inicio + 1) / 2;
+            if (atomic_compare_exchange_weak(faixa, &atual, ((uint64_t) inicio << 32) | corte)) {
+                // A própria faixa está vazia: ninguém mais escreve nela agora
+                atomic_store(&t->faixa, ((uint64_t) corte << 32) | fim);
+                t->roubos++;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Executa uma rodada e soma o resultado na sua célula
+static void executarRodada(Varredura* v, int rodada) {
+    const ConfigVarredura* cv = v->config;
+    CelulaVarredura* celula = &v->celulas[rodada / cv->repeticoes];
+    ConfigSimulacao config = cv->base;
+    config.medicos = celula->medicos;
+    for (int i = 0; i < NUM_PRIORIDADES; i++) config.chegadasHora[i] *= celula->carga;
+    uint64_t semente = cv->base.semente + (uint64_t) rodada;
+    config.semente = proximoAleatorio(&semente);  // Sementes vizinhas bem espalhadas
+
+    Simulacao* s = (Simulacao*) calloc(1, sizeof(Simulacao));
+    if (s == NULL || !prepararSimulacao(s, &config, v->nome)) {
+        atomic_fetch_add(&v->falhas, 1);
+        if (s != NULL) liberarSimulacao(s);
+        free(s);
+        return;
+    }
+    rodarSimulacao(s);
+
+    for (int i = 0; i < NUM_PRIORIDADES; i++) somarHistograma(&celula->espera[i], &s->espera[i]);
+    somarHistograma(&celula->tamanhoFila, &s->tamanhoFila);
+    uint64_t atendidos = 0;
+    for (int i = 0; i < NUM_PRIORIDADES; i++) atendidos += s->atendidos[i];
+    v->resultados[rodada].atendidosHora = (double) atendidos * 3600000.0 / (double) s->fim;
+    v->resultados[rodada].ocupacao = s->areaOcupados / ((double) s->fim * config.medicos);
+
+    liberarSimulacao(s);
+    free(s);
+}
+
+// Thread da varredura: a própria faixa primeiro, depois o que roubar
+static void* threadVarredura(void* arg) {
+    TrabalhadorVarredura* t = (TrabalhadorVarredura*) arg;
+    fixarNucleo(t->numero);
+    int rodada;
+    do {
+        while (pegarRodada(&t->faixa, &rodada)) {
+            executarRodada(t->varredura, rodada);
+            t->rodadas++;
+        }
+    } while (roubarRodadas(t));
+    return NULL;
+}
+
+// Imprime uma linha por célula: vazão, ocupação, tamanho da fila e espera
+// (p90 e p99 da espera em minutos, uma coluna por prioridade)
+static void relatorioVarredura(const Varredura* v) {
+    printf("Espera em minutos por prioridade:");
+    for (int i = 0; i < NUM_PRIORIDADES; i++)
+        printf(" %d=%s", PRIORIDADE_MAXIMA + i, obterNomePrioridade(PRIORIDADE_MAXIMA + i));
+    printf("\nMédicos  Carga  Por hora  Ocupação  Em espera p50   p90   p99 ");
+    for (int i = 0; i < NUM_PRIORIDADES; i++) printf("  p90/%d", PRIORIDADE_MAXIMA + i);
+    for (int i = 0; i < NUM_PRIORIDADES; i++) printf("  p99/%d", PRIORIDADE_MAXIMA + i);
+    printf("\n");
+    int repeticoes = v->config->repeticoes;
+    for (int c = 0; c < v->rodadas / repeticoes; c++) {
+        const CelulaVarredura* celula = &v->celulas[c];
+        double atendidosHora = 0, ocupacao = 0;
+        for (int r = c * repeticoes; r < (c + 1) * repeticoes; r++) {
+            atendidosHora += v->resultados[r].atendidosHora;
+            ocupacao += v->resultados[r].ocupacao;
+        }
+        const HistogramaLatencia* f = &celula->tamanhoFila;
+        printf("%7d  %5.2f  %8.2f  %7.1f%%  %13llu %5llu %5llu ",
+               celula->medicos, celula->carga, atendidosHora / repeticoes, 100.0 * ocupacao / repeticoes,
+               (unsigned long long) percentilLatencia(f, 50), (unsigned long long) percentilLatencia(f, 90),
+               (unsigned long long) percentilLatencia(f, 99));
+        for (int i = 0; i < NUM_PRIORIDADES; i++)
+            printf(" %6.1f", (double) percentilLatencia(&celula->espera[i], 90) / 6e10);
+        for (int i = 0; i < NUM_PRIORIDADES; i++)
+            printf(" %6.1f", (double) percentilLatencia(&celula->espera[i], 99) / 6e10);
+        printf("\n");
+    }
+}
+
+// Executa a varredura descrita por 'config'
+// Retorna 0 se todas as rodadas terminaram, 1 caso contrário
+int executarVarredura(const ConfigVarredura* config) {
+    ConfigSimulacao teste = config->base;
+    teste.medicos = config->medicosMax;
+    if (!validarConfigSimulacao(&teste)) return 1;
+    if (config->medicosMin < 1 || config->medicosMin > config->medicosMax ||
+        config->repeticoes < 1 || config->numCargas < 1 ||
+        config->threads < 0 || config->threads > MAX_THREADS_VARREDURA) {
+        fprintf(stderr, "ERRO: Use 1 <= médicos mínimo <= máximo, repetições >= 1 e até %d threads.\n",
+                MAX_THREADS_VARREDURA);
+        return 1;
+    }
+    for (int i = 0; i < config->numCargas; i++) {
+        if (config->cargas[i] <= 0) {
+            fprintf(stderr, "ERRO: As cargas devem ser > 0.\n");
+            return 1;
+        }
+    }
+    int numCelulas = (config->medicosMax - config->medicosMin + 1) * config->numCargas;
+    if ((int64_t) numCelulas * config->repeticoes > INT32_MAX) {
+        fprintf(stderr, "ERRO: Rodadas demais.\n");
+        return 1;
+    }
+
+    Varredura v;
+    v.config = config;
+    v.rodadas = numCelulas * config->repeticoes;
+    v.threads = config->threads > 0 ? config->threads : numeroDeNucleos();
+    if (v.threads > v.rodadas) v.threads = v.rodadas;
+    if (v.threads > MAX_THREADS_VARREDURA) v.threads = MAX_THREADS_VARREDURA;
+    v.nome = internarNome("Simulado");
+    atomic_init(&v.falhas, 0);
+    v.celulas = (CelulaVarredura*) calloc((size_t) numCelulas, sizeof(CelulaVarredura));
+    v.resultados = (ResultadoRodada*) calloc((size_t) v.rodadas, sizeof(ResultadoRodada));
+    v.trabalhadores = (TrabalhadorVarredura*) aligned_alloc(64, sizeof(TrabalhadorVarredura) * MAX_THREADS_VARREDURA);
+    pthread_t* ids = (pthread_t*) calloc((size_t) v.threads, sizeof(pthread_t));
+    if (v.celulas == NULL || v.resultados == NULL || v.trabalhadores == NULL || ids == NULL) {
+        fprintf(stderr, "ERRO: Falha de alocação na varredura.\n");
+        free(v.celulas);
+        free(v.resultados);
+        free(v.trabalhadores);
+        free(ids);
+        return 1;
+    }
+    // Células na ordem carga, médicos
+    for (int c = 0; c < numCelulas; c++) {
+        v.celulas[c].carga = config->cargas[c / (config->medicosMax - config->medicosMin + 1)];
+        v.celulas[c].medicos = config->medicosMin + c % (config->medicosMax - config->medicosMin + 1);
+    }
+
+    printf("VARREDURA: %d rodadas de %.1f dias (%d médicos x %d cargas x %d repetições), %d threads\n",
+           v.rodadas, config->base.dias, config->medicosMax - config->medicosMin + 1, config->numCargas,
+           config->repeticoes, v.threads);
+    fflush(stdout);
+
+    int silenciosaAntes = saidaSilenciosa;
+    saidaSilenciosa = 1;
+    double inicio = tempoAgora();
+    // Faixas iniciais do mesmo tamanho (a diferença fica para o roubo)
+    for (int i = 0; i < v.threads; i++) {
+        TrabalhadorVarredura* t = &v.trabalhadores[i];
+        uint64_t de = (uint64_t) v.rodadas * (uint64_t) i / (uint64_t) v.threads;
+        uint64_t ate = (uint64_t) v.rodadas * (uint64_t) (i + 1) / (uint64_t) v.threads;
+        atomic_init(&t->faixa, (de << 32) | ate);
+        t->varredura = &v;
+        t->numero = i;
+        t->rodadas = 0;
+        t->roubos = 0;
+    }
+    // Se uma thread não puder ser criada, as outras roubam a faixa dela;
+    // se nenhuma puder, esta thread faz o trabalho
+    int iniciadas = 0;
+    for (int i = 0; i < v.threads; i++) {
+        if (pthread_create(&ids[iniciadas], NULL, threadVarredura, &v.trabalhadores[i]) == 0) iniciadas++;
+    }
+    if (iniciadas < v.threads)
+        fprintf(stderr, "AVISO: Só %d de %d threads foram iniciadas.\n", iniciadas, v.threads);
+    if (iniciadas == 0) threadVarredura(&v.trabalhadores[0]);
+    for (int i = 0; i < iniciadas; i++) pthread_join(ids[i], NULL);
+    double segundos = tempoAgora() - inicio;
+    saidaSilenciosa = silenciosaAntes;
+
+    relatorioVarredura(&v);
+    uint64_t roubos = 0, menor = UINT64_MAX, maior = 0;
+    for (int i = 0; i < v.threads; i++) {
+        roubos += v.trabalhadores[i].roubos;
+        if (v.trabalhadores[i].rodadas < menor) menor = v.trabalhadores[i].rodadas;
+        if (v.trabalhadores[i].rodadas > maior) maior = v.trabalhadores[i].rodadas;
+    }
+    int falhas = atomic_load(&v.falhas);
+    printf("Tempo: %.3f s | %.1f rodadas/s | Roubos: %llu | Rodadas por thread: %llu a %llu | Falhas: %d\n",
+           segundos, v.rodadas / (segundos > 0 ? segundos : 1e-9), (unsigned long long) roubos,
+           (unsigned long long) menor, (unsigned long long) maior, falhas);
+
+    free(v.celulas);
+    free(v.resultados);
+    free(v.trabalhadores);
+    free(ids);
+    destruirArmazemNomes();
+    return falhas == 0 ? 0 : 1;
+}
+
+// ============= BENCHMARK =============
+// Mede as operações centrais (inserirFila, removerFila + push,
+// desfazerAtendimento e buscarPacientePorID) com cargas sintéticas de
+// 10^3 até o tamanho pedido. Cada operação é cronometrada individualmente
+// e o resultado sai em JSON, uma linha por carga/tamanho/operação, para
+// ser comparado entre versões. A vazão inclui o custo do cronômetro.
+//
+// Cargas:
+//   uniforme  - cadastra n pacientes com prioridades uniformes e atende todos
+//   rajada    - 90% na prioridade mínima, com rajadas da máxima, atendendo durante a chegada
+//   desfazer  - sessão com muitos desfazer: atende, atende, desfaz
+//   busca     - metade da fila atendida e n buscas (10% por IDs inexistentes)
+//   posicao   - metade da fila atendida e n consultas de posição, com
+//               cadastros e atendimentos intercalados
+
+// Estado de uma execução do benchmark
+typedef struct {
+    Fila fila;
+    Pilha* historico;
+    PoolNos pool;
+    HistogramaLatencia latencias[NUM_OPERACOES];
+    double segundos[NUM_OPERACOES];  // Tempo total por operação
+    uint64_t semente;
+    NomeRef nome;
+} ExecucaoBench;
+
+// Pico de memória residente do processo em KB (0 se indisponível)
+long picoMemoriaKB() {
+#ifndef _WIN32
+    struct rusage uso;
+    if (getrusage(RUSAGE_SELF, &uso) == 0) return uso.ru_maxrss;
+#endif
+    return 0;
+}
+
+// Cadastra o paciente 'id' com a prioridade informada, cronometrando
+static void benchInserir(ExecucaoBench* b, int id, int prioridade) {
+    Paciente p = {id, b->nome, (uint16_t) (IDADE_MIN + id % IDADE_MAX), (int8_t) prioridade, 0};
+    uint64_t t0 = relogioNs();
+    inserirFila(&b->fila, p);
+    uint64_t dt = relogioNs() - t0;
+    registrarLatencia(&b->latencias[OPERACAO_INSERIR], dt);
+    b->segundos[OPERACAO_INSERIR] += (double) dt / 1e9;
+}
+
+// Atende o próximo paciente (removerFila + push), cronometrando
+static void benchAtender(ExecucaoBench* b) {
+    uint64_t t0 = relogioNs();
+    Paciente p = removerFila(&b->fila);
+    if (p.id != -1) push(b->historico, p);
+    uint64_t dt = relogioNs() - t0;
+    registrarLatencia(&b->latencias[OPERACAO_ATENDER], dt);
+    b->segundos[OPERACAO_ATENDER] += (double) dt / 1e9;
+}
+
+// Desfaz o último atendimento, cronometrando
+static void benchDesfazer(ExecucaoBench* b) {
+    uint64_t t0 = relogioNs();
+    desfazerAtendimento(&b->fila, b->historico);
+    uint64_t dt = relogioNs() - t0;
+    registrarLatencia(&b->latencias[OPERACAO_DESFAZER], dt);
+    b->segundos[OPERACAO_DESFAZER] += (double) dt / 1e9;
+}
+
+// Busca um ID, cronometrando
+static void benchBuscar(ExecucaoBench* b, int id) {
+    uint64_t t0 = relogioNs();
+    volatile int encontrado = buscarPacientePorID(&b->fila, b->historico, id).id;
+    uint64_t dt = relogioNs() - t0;
+    (void) encontrado;
+    registrarLatencia(&b->latencias[OPERACAO_BUSCAR], dt);
+    b->segundos[OPERACAO_BUSCAR] += (double) dt / 1e9;
+}
+
+// Consulta a posição de um ID na fila, cronometrando
+static void benchPosicao(ExecucaoBench* b, int id) {
+    uint64_t t0 = relogioNs();
+    volatile int posicao = posicaoNaFila(&b->fila, id);
+    uint64_t dt = relogioNs() - t0;
+    (void) posicao;
+    registrarLatencia(&b->latencias[OPERACAO_POSICAO], dt);
+    b->segundos[OPERACAO_POSICAO] += (double) dt / 1e9;
+}
+
+// Prioridade uniforme entre todos os níveis
+static int prioridadeUniforme(ExecucaoBench* b) {
+    return PRIORIDADE_MAXIMA + (int) (proximoAleatorio(&b->semente) % NUM_PRIORIDADES);
+}
+
+// Executa uma carga com n pacientes
+static void executarCargaBench(ExecucaoBench* b, const char* carga, int n) {
+    if (strcmp(carga, "uniforme") == 0) {
+        for (int id = 1; id <= n; id++) benchInserir(b, id, prioridadeUniforme(b));
+        for (int i = 0; i < n; i++) benchAtender(b);
+    } else if (strcmp(carga, "rajada") == 0) {
+        // A cada 1000 chegadas, uma rajada de 100 da prioridade máxima seguidas;
+        // fora delas, 10% nos níveis intermediários e o resto na mínima
+        for (int id = 1; id <= n; id++) {
+            uint64_t sorteio = (id % 1000) < 100 ? 0 : proximoAleatorio(&b->semente);
+            int prioridade = (id % 1000) < 100 ? PRIORIDADE_MAXIMA
+                           : sorteio % 10 != 0 ? PRIORIDADE_MINIMA
+                           : PRIORIDADE_MAXIMA + 1 + (int) (sorteio / 10 % (NUM_PRIORIDADES > 2 ? NUM_PRIORIDADES - 2 : 1));
+            benchInserir(b, id, prioridade);
+            if (id % 2 == 0) benchAtender(b);
+        }
+        while (b->fila.tamanho > 0) benchAtender(b);
+    } else if (strcmp(carga, "desfazer") == 0) {
+        for (int id = 1; id <= n; id++) benchInserir(b, id, prioridadeUniforme(b));
+        for (int i = 0; i < n; i++) {
+            benchAtender(b);
+            benchAtender(b);
+            benchDesfazer(b);
+        }
+    } else if (strcmp(carga, "posicao") == 0) {
+        // Painel consultando a posição de todos enquanto a fila anda
+        for (int id = 1; id <= n; id++) benchInserir(b, id, prioridadeUniforme(b));
+        for (int i = 0; i < n / 2; i++) benchAtender(b);
+        for (int i = 0; i < n; i++) {
+            benchPosicao(b, 1 + (int) (proximoAleatorio(&b->semente) % (uint64_t) n));
+            if (i % 8 == 0) {
+                benchInserir(b, n + 1 + i / 8, prioridadeUniforme(b));
+                benchAtender(b);
+            }
+        }
+    } else {  // busca
+        for (int id = 1; id <= n; id++) benchInserir(b, id, prioridadeUniforme(b));
+        for (int i = 0; i < n / 2; i++) benchAtender(b);
+        for (int i = 0; i < n; i++) {
+            // 10% das buscas são por IDs que não existem
+            int id = 1 + (int) (proximoAleatorio(&b->semente) % (uint64_t) (n + n / 9));
+            benchBuscar(b, id);
+        }
+    }
+}
+
+// Executa o benchmark das cargas pedidas ("todas" ou o nome de uma carga)
+// para n = 10^3, 10^4, ... até 'nMaximo'
+int executarBenchmark(const char* cargaPedida, long nMaximo) {
+    static const char* cargas[] = {"uniforme", "rajada", "desfazer", "busca", "posicao"};
+    int numCargas = (int) (sizeof(cargas) / sizeof(cargas[0]));
+    int encontrou = strcmp(cargaPedida, "todas") == 0;
+    for (int c = 0; c < numCargas; c++) {
+        if (strcmp(cargaPedida, cargas[c]) == 0) encontrou = 1;
+    }
+    if (!encontrou || nMaximo < 1000 || nMaximo > 10000000) {
+        fprintf(stderr, "Uso: --bench <todas|uniforme|rajada|desfazer|busca|posicao> [n máximo, 1000 a 10000000]\n");
+        return 1;
+    }
+
+    ExecucaoBench* b = (ExecucaoBench*) malloc(sizeof(ExecucaoBench));
+    if (b == NULL) return 1;
+    saidaSilenciosa = 1;
+    NomeRef nome = internarNome("Paciente Benchmark");
+
+    for (int c = 0; c < numCargas; c++) {
+        if (strcmp(cargaPedida, "todas") != 0 && strcmp(cargaPedida, cargas[c]) != 0) continue;
+        for (long n = 1000; n <= nMaximo; n *= 10) {
+            // Cada execução tem fila, histórico e pool próprios
+            memset(b, 0, sizeof(*b));
+            inicializaPool(&b->pool);
+            inicializaFilaComPool(&b->fila, &b->pool);
+            b->historico = inicializaPilhaComPool(&b->pool);
+            b->semente = 42;
+            b->nome = nome;
+            if (b->historico == NULL) break;
+
+            executarCargaBench(b, cargas[c], (int) n);
+
+            for (int op = 0; op < NUM_OPERACOES; op++) {
+                HistogramaLatencia* h = &b->latencias[op];
+                if (amostrasLatencia(h) == 0) continue;
+                printf("{\"carga\":\"%s\",\"n\":%ld,\"operacao\":\"%s\",\"ops\":%llu,"
+                       "\"ops_por_s\":%.0f,\"media_ns\":%.1f,\"p50_ns\":%llu,\"p90_ns\":%llu,"
+                       "\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu,\"rss_pico_kb\":%ld}\n",
+                       cargas[c], n, nomesOperacao[op], (unsigned long long) amostrasLatencia(h),
+                       (double) amostrasLatencia(h) / (b->segundos[op] > 0 ? b->segundos[op] : 1e-9),
+                       mediaLatencia(h),
+                       (unsigned long long) percentilLatencia(h, 50),
+                       (unsigned long long) percentilLatencia(h, 90),
+                       (unsigned long long) percentilLatencia(h, 99),
+                       (unsigned long long) percentilLatencia(h, 99.9),
+                       (unsigned long long) maximoLatencia(h), picoMemoriaKB());
+            }
+            fflush(stdout);
+
+            destruirFila(&b->fila);
+            destruirPilha(b->historico);
+        }
+    }
+
+    free(b);
+    destruirArmazemNomes();
+    return 0;
+}
+
+// ============= MODO EM LOTE =============
+// Executa uma sequência de comandos lida de um arquivo (ou da entrada
+// padrão) sem menu, sem limpar a tela e sem mensagens por operação.
+// Formato: um comando por linha, campos separados por espaços
+//   I <id> <idade> <prioridade> <nome...>   Inserir paciente
+//   A                                      Atender paciente
+//   U                                      Desfazer a última ação
+//   Y                                      Refazer a última ação desfeita
+//   T <id> <prioridade>                    Retriagem (nova prioridade)
+//   D <id>                                 Desistência (sai da fila)
+//   F <id>                                 Buscar paciente por ID
+//   P <id>                                 Posição do paciente na fila
+//   N <parte do nome>                      Buscar pacientes por nome (lista os IDs)
+//   R                                      Exibir relatório
+//   M                                      Exibir métricas (JSON)
+// Linhas vazias e linhas iniciadas por '#' são ignoradas.
+
+// Tamanho do buffer de leitura do lote (também é o maior tamanho de linha)
+#define TAM_BUFFER_LOTE (1 << 20)
+
+// Tipos de comando aceitos pelo modo em lote
+typedef enum {
+    CMD_INSERIR,
+    CMD_ATENDER,
+    CMD_DESFAZER,
+    CMD_REFAZER,
+    CMD_PRIORIDADE,
+    CMD_DESISTENCIA,
+    CMD_BUSCAR,
+    CMD_BUSCAR_NOME,
+    CMD_POSICAO,
+    CMD_RELATORIO,
+    CMD_METRICAS,
+    CMD_INVALIDO
+} TipoComando;
+
+// Comando já decodificado de uma linha
+typedef struct {
+    TipoComando tipo;
+    int id;
+    int idade;
+    int prioridade;
+    char* nome;     // Nome (I) ou consulta (N); aponta para dentro do buffer de leitura
+} Comando;
+
+// Contadores do processamento de um lote
+typedef struct {
+    size_t comandos;     // Comandos executados
+    size_t inseridos;    // Cadastros aceitos
+    size_t atendidos;    // Atendimentos realizados
+    size_t desfeitos;    // Ações desfeitas
+    size_t refeitos;     // Ações refeitas
+    size_t retriagens;   // Prioridades alteradas
+    size_t desistencias; // Desistências registradas
+    size_t encontrados;  // Buscas com sucesso
+    size_t buscas;       // Total de buscas
+    size_t erros;        // Linhas inválidas ou operações recusadas
+} ResultadoLote;
+
+// Letra de cada tipo de comando, na ordem de TipoComando (usada no rastro)
+static const char LETRAS_COMANDO[] = "IAUYTDFNPRM";
+_Static_assert(sizeof(LETRAS_COMANDO) - 1 == CMD_INVALIDO, "uma letra por tipo de comando");
+
+// Decodifica uma linha (já terminada em \0) em um comando
+// O nome do comando de inserção aponta para dentro da própria linha
+Comando decodificarComando(char* linha) {
+    Comando cmd = {CMD_INVALIDO, 0, 0, 0, NULL};
+    char* p = pularEspacos(linha);
+    char letra = *p++;
+
+    switch (letra) {
+        case 'I': case 'i':
+            if (!lerCampoInteiro(&p, &cmd.id) ||
+                !lerCampoInteiro(&p, &cmd.idade) ||
+                !lerCampoInteiro(&p, &cmd.prioridade))
+                return cmd;
+            cmd.nome = pularEspacos(p);
+            // Remove espaços no fim do nome
+            char* fim = cmd.nome + strlen(cmd.nome);
+            while (fim > cmd.nome && (fim[-1] == ' ' || fim[-1] == '\t')) *--fim = '\0';
+            cmd.tipo = CMD_INSERIR;
+            break;
+        case 'A': case 'a':
+            cmd.tipo = CMD_ATENDER;
+            break;
+        case 'U': case 'u':
+            cmd.tipo = CMD_DESFAZER;
+            break;
+        case 'Y': case 'y':
+            cmd.tipo = CMD_REFAZER;
+            break;
+        case 'T': case 't':
+            if (lerCampoInteiro(&p, &cmd.id) && lerCampoInteiro(&p, &cmd.prioridade))
+                cmd.tipo = CMD_PRIORIDADE;
+            break;
+        case 'D': case 'd':
+            if (lerCampoInteiro(&p, &cmd.id)) cmd.tipo = CMD_DESISTENCIA;
+            break;
+        case 'F': case 'f':
+            if (lerCampoInteiro(&p, &cmd.id)) cmd.tipo = CMD_BUSCAR;
+            break;
+        case 'P': case 'p':
+            if (lerCampoInteiro(&p, &cmd.id)) cmd.tipo = CMD_POSICAO;
+            break;
+        case 'N': case 'n':
+            cmd.nome = pularEspacos(p);
+            if (cmd.nome[0] != '\0') cmd.tipo = CMD_BUSCAR_NOME;
+            break;
+        case 'R': case 'r':
+            cmd.tipo = CMD_RELATORIO;
+            break;
+        case 'M': case 'm':
+            cmd.tipo = CMD_METRICAS;
+            break;
+    }
+    return cmd;
+}
+
+// Cadastra o paciente de um comando I com as mesmas validações do
+// cadastro interativo (usado pelo lote e pelo servidor)
+// Retorna 1 se cadastrou, 0 se os dados são inválidos (ou faltou memória),
+// -1 se o ID já existe
+int inserirDoComando(Fila* fila, Pilha* historico, const Comando* cmd) {
+    if (!validarID(cmd->id) || !validarIdade(cmd->idade) ||
+        !validarPrioridade(cmd->prioridade) || cmd->nome[0] == '\0') {
+        recusarOperacao(OPERACAO_INSERIR);
+        return 0;
+    }
+    Paciente p;
+    p.id = cmd->id;
+    p.idade = (uint16_t) cmd->idade;
+    p.prioridade = (int8_t) cmd->prioridade;
+    p.reservado = 0;
+    if (idCadastrado(fila, historico, p.id)) {
+        recusarOperacao(OPERACAO_INSERIR);
+        return -1;
+    }
+    p.nome = internarNome(cmd->nome);
+    if (p.nome == NOME_FALHA) return 0;
+    return registrarPaciente(fila, historico, p);
+}
+
+// Executa um comando com as mesmas regras do menu interativo
+// Retorna 1 se a operação foi realizada, 0 se foi recusada
+int executarComando(Fila* fila, Pilha* historico, const Comando* cmd, ResultadoLote* res) {
+    res->comandos++;
+    switch (cmd->tipo) {
+        case CMD_INSERIR:
+            if (inserirDoComando(fila, historico, cmd) <= 0) return 0;
+            res->inseridos++;
+            return 1;
+        case CMD_ATENDER: {
+            Paciente atendido;
+            if (!atenderPaciente(fila, historico, &atendido)) return 0;
+            res->atendidos++;
+            return 1;
+        }
+        case CMD_DESFAZER:
+            if (!desfazerComando(fila, historico)) return 0;
+            res->desfeitos++;
+            return 1;
+        case CMD_REFAZER:
+            if (!refazerComando(fila, historico)) return 0;
+            res->refeitos++;
+            return 1;
+        case CMD_PRIORIDADE: {
+            int resultado = retriarPaciente(fila, cmd->id, cmd->prioridade);
+            if (resultado == 0) return 0;
+            if (resultado == 1) res->retriagens++;  // 2: já tinha a prioridade
+            return 1;
+        }
+        case CMD_DESISTENCIA:
+            if (!registrarDesistencia(fila, cmd->id)) return 0;
+            res->desistencias++;
+            return 1;
+        case CMD_BUSCAR:
+            res->buscas++;
+            if (consultarPaciente(fila, historico, cmd->id).id == -1) return 0;
+            res->encontrados++;
+            return 1;
+        case CMD_BUSCAR_NOME: {
+            // Uma linha com a consulta e os IDs encontrados, do mais parecido
+            Paciente resultados[MAX_RESULTADOS_NOME];
+            res->buscas++;
+            int encontrados = consultarPorNome(fila, historico, cmd->nome, resultados, MAX_RESULTADOS_NOME);
+            printf("N %s:", cmd->nome);
+            for (int i = 0; i < encontrados; i++) printf(" %d", resultados[i].id);
+            printf("\n");
+            if (encontrados <= 0) return 0;
+            res->encontrados++;
+            return 1;
+        }
+        case CMD_POSICAO: {
+            // Uma linha com a posição (0 = não está na fila) e o total
+            res->buscas++;
+            int posicao = consultarPosicao(fila, cmd->id);
+            printf("P %d: %d de %d\n", cmd->id, posicao, fila->tamanho);
+            if (posicao == 0) return 0;
+            res->encontrados++;
+            return 1;
+        }
+        case CMD_RELATORIO:
+            exibirRelatorio(fila);
+            return 1;
+        case CMD_METRICAS:
+            escreverMetricasJSON(stdout, fila);
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Processa o lote lido de 'entrada' até o fim do arquivo
+// A leitura é feita em blocos grandes num único buffer reaproveitado;
+// a linha incompleta no fim de um bloco é movida para o início do buffer
+// antes da próxima leitura, então não há alocação por linha
+void processarLote(FILE* entrada, Fila* fila, Pilha* historico, ResultadoLote* res) {
+    static char buffer[TAM_BUFFER_LOTE + 1];
+    size_t pendente = 0;   // Bytes de uma linha incompleta no início do buffer
+    size_t numLinha = 0;
+    int fimArquivo = 0;
+    int descartando = 0;   // Resto de uma linha longa demais, até o próximo \n
+
+    while (!fimArquivo) {
+        size_t lidos = fread(buffer + pendente, 1, TAM_BUFFER_LOTE - pendente, entrada);
+        if (lidos == 0) fimArquivo = 1;
+        size_t total = pendente + lidos;
+        if (total == 0) break;
+
+        char* inicio = buffer;
+        char* limite = buffer + total;
+        for (;;) {
+            char* quebra = (char*) memchr(inicio, '\n', (size_t) (limite - inicio));
+            if (descartando) {
+                // A linha longa já foi contada: só termina no próximo \n
+                if (quebra == NULL) {
+                    inicio = limite;
+                    break;
+                }
+                descartando = 0;
+                inicio = quebra + 1;
+                if (inicio >= limite) break;
+                continue;
+            }
+            if (quebra == NULL) {
+                if (!fimArquivo) {
+                    // Buffer cheio sem nenhuma quebra: linha maior que o buffer
+                    if (inicio == buffer && total == TAM_BUFFER_LOTE) {
+                        fprintf(stderr, "linha %zu: linha longa demais\n", ++numLinha);
+                        res->erros++;
+                        inicio = limite;
+                        descartando = 1;
+                    }
+                    break;  // Senão a linha é completada na próxima leitura
+                }
+                if (inicio == limite) break;
+                quebra = limite;  // Última linha sem \n
+            }
+            *quebra = '\0';
+            numLinha++;
+            if (quebra > inicio && quebra[-1] == '\r') quebra[-1] = '\0';  // Arquivos CRLF
+
+            char* p = pularEspacos(inicio);
+            if (*p != '\0' && *p != '#') {
+                Comando cmd = decodificarComando(p);
+                if (cmd.tipo == CMD_INVALIDO) {
+                    fprintf(stderr, "linha %zu: comando inválido\n", numLinha);
+                    res->erros++;
+                } else {
+                    anotarRastro(LETRAS_COMANDO[cmd.tipo], cmd.id, cmd.idade, cmd.prioridade, cmd.nome);
+                    if (!executarComando(fila, historico, &cmd, res) &&
+                        cmd.tipo != CMD_BUSCAR && cmd.tipo != CMD_BUSCAR_NOME &&
+                        cmd.tipo != CMD_POSICAO) {
+                        res->erros++;
+                    }
+                    concluirComandoRastro();
+                }
+                if (fila->diario != NULL) confirmarDiario(fila->diario, fila, historico);
+                gravarMetricasPeriodicas(fila, 0);
+            }
+            inicio = quebra + 1;
+            if (inicio >= limite) break;
+        }
+
+        // Move a linha incompleta para o início do buffer
+        pendente = inicio < limite ? (size_t) (limite - inicio) : 0;
+        memmove(buffer, inicio, pendente);
+    }
+}
+
+// Libera o estado de uma execução pela linha de comando (lote, listagem e
+// reprodução), no fim ou numa saída antecipada: fecha o diário, gravando
+// o snapshot, e destrói a fila, a pilha, o índice de nomes, os nomes e o
+// histórico de desfazer. 'diario' e 'nomes' podem ser NULL
+static void encerrarExecucao(Fila* fila, Pilha* pilha, DiarioWAL* diario, IndiceNomes* nomes) {
+    if (diario != NULL) fecharDiario(diario, fila, pilha);
+    destruirFila(fila);
+    destruirPilha(pilha);
+    destruirIndiceNomes(nomes);
+    destruirArmazemNomes();
+    destruirComandos();
+}
+
+// Executa o modo em lote: "-" lê da entrada padrão
+// Se 'prefixoDados' não for NULL, o lote parte do estado salvo e o grava
+// 'envelhecimentoMs' liga o envelhecimento da fila (0 = desligado)
+// 'importacao' (se não for NULL) é carregado antes dos comandos e
+// 'exportacao' (se não for NULL) recebe a fila e o histórico no fim
+int executarModoLote(const char* caminho, const char* prefixoDados, uint32_t envelhecimentoMs,
+                     const char* importacao, const char* exportacao) {
+    FILE* entrada = strcmp(caminho, "-") == 0 ? stdin : fopen(caminho, "rb");
+    if (entrada == NULL) {
+        fprintf(stderr, "ERRO: Não foi possível abrir o arquivo %s.\n", caminho);
+        return 1;
+    }
+
+    Fila fila;
+    inicializaFila(&fila);
+    Pilha* pilha = inicializaPilha();
+    if (pilha == NULL) {
+        if (entrada != stdin) fclose(entrada);
+        encerrarExecucao(&fila, pilha, NULL, NULL);
+        return 1;
+    }
+
+    DiarioWAL* diario = NULL;
+    if (prefixoDados != NULL) {
+        diario = abrirDiario(prefixoDados, &fila, pilha, DIARIO_LOTE_SYNC_LOTE);
+        if (diario == NULL) {
+            fprintf(stderr, "ERRO: Não foi possível abrir os dados em %s.\n", prefixoDados);
+            if (entrada != stdin) fclose(entrada);
+            encerrarExecucao(&fila, pilha, NULL, NULL);
+            return 1;
+        }
+    }
+
+    // Uma importação com problemas conta como erro do lote, mas o que foi
+    // lido até ali fica
+    int falhaImportacao = importacao != NULL && !importarComResumo(importacao, &fila, pilha);
+
+    // Só depois da recuperação: a reprodução do diário não pode promover
+    // ninguém por conta própria (as promoções estão no diário)
+    fila.envelhecimentoMs = envelhecimentoMs;
+
+    // Índice de nomes: montado uma vez sobre o estado recuperado
+    IndiceNomes* nomes = criarIndiceNomes();
+    if (nomes == NULL || !ligarIndiceNomes(nomes, &fila, pilha)) {
+        fprintf(stderr, "ERRO: Falha na alocação do índice de nomes.\n");
+        if (entrada != stdin) fclose(entrada);
+        encerrarExecucao(&fila, pilha, diario, nomes);
+        return 1;
+    }
+
+    ResultadoLote res;
+    memset(&res, 0, sizeof(res));
+    res.erros = (size_t) falhaImportacao;
+
+    iniciarRastro(&fila, pilha);
+    saidaSilenciosa = 1;
+    processarLote(entrada, &fila, pilha, &res);
+    saidaSilenciosa = 0;
+    encerrarRastro(&fila, pilha);
+    if (entrada != stdin) fclose(entrada);
+    if (diario != NULL) fecharDiario(diario, &fila, pilha);
+
+    // Resumo do lote
+    printf("LOTE PROCESSADO\n");
+    printf("Comandos: %zu | Erros: %zu\n", res.comandos, res.erros);
+    printf("Inseridos: %zu | Atendidos: %zu | Desfeitos: %zu | Refeitos: %zu\n",
+           res.inseridos, res.atendidos, res.desfeitos, res.refeitos);
+    printf("Retriagens: %zu | Desistências: %zu\n", res.retriagens, res.desistencias);
+    printf("Buscas: %zu (encontrados: %zu)\n", res.buscas, res.encontrados);
+    exibirRelatorio(&fila);
+    gravarMetricasPeriodicas(&fila, 1);
+    if (exportacao != NULL && !exportarComResumo(exportacao, &fila, pilha)) res.erros++;
+
+    encerrarExecucao(&fila, pilha, NULL, nomes);  // O diário já foi fechado
+    return res.erros == 0 ? 0 : 2;
+}
+
+// Listagem pela linha de comando (--listar): carrega o estado salvo (e o
+// arquivo importado, se houver), escreve a fila ou o histórico na saída
+// padrão e termina. As mensagens de carga vão para a saída de erro, para
+// que a saída possa ser processada (formatos compacto e json)
+int executarListagem(const char* qual, const char* prefixoDados, const char* importacao,
+                     const OpcoesListagem* op) {
+    int historico = strcmp(qual, "historico") == 0;
+    if (!historico && strcmp(qual, "fila") != 0) {
+        fprintf(stderr, "ERRO: Use --listar fila ou --listar historico.\n");
+        return 1;
+    }
+
+    Fila fila;
+    inicializaFila(&fila);
+    Pilha* pilha = inicializaPilha();
+    if (pilha == NULL) {
+        encerrarExecucao(&fila, pilha, NULL, NULL);
+        return 1;
+    }
+
+    // A listagem só lê os dados: sem diário, a importação também fica só
+    // em memória
+    saidaSilenciosa = 1;
+    if (prefixoDados != NULL && !carregarSomenteLeitura(prefixoDados, &fila, pilha)) {
+        fprintf(stderr, "ERRO: Não foi possível abrir os dados em %s.\n", prefixoDados);
+        saidaSilenciosa = 0;
+        encerrarExecucao(&fila, pilha, NULL, NULL);
+        return 1;
+    }
+    int resultado = 0;
+    if (importacao != NULL) {
+        ResultadoImportacao res;
+        if (!importarPacientes(importacao, &fila, pilha, &res)) resultado = 2;
+        fprintf(stderr, "Importados de %s: %zu na fila, %zu no histórico, %zu recusados.\n",
+                importacao, res.fila, res.historico, res.recusados);
+    }
+
+    size_t listados = historico ? listarHistorico(pilha, op) : listarFila(&fila, op);
+    size_t total = historico ? tamanhoPilha(pilha) : contarFila(&fila, op->prioridade);
+    if (op->formato == FORMATO_TABELA) printf("Mostrando %zu de %zu.\n", listados, total);
+
+    saidaSilenciosa = 0;
+    encerrarExecucao(&fila, pilha, NULL, NULL);
+    return resultado;
+}
+
+
+// ============= REPRODUÇÃO DO RASTRO =============
+// --reproduzir <arquivo> parte do mesmo estado da gravação (os mesmos
+// --dados e --importar; o cabeçalho traz o envelhecimento e a profundidade
+// do desfazer), passa cada comando do rastro (ver RASTRO DE COMANDOS) por
+// executarComando com o relógio virtual no instante gravado e, no fim,
+// compara o resumo da fila, do histórico e das métricas com o gravado.
+// Sem --ritmo-original os comandos são executados sem pausa; com ele, a
+// reprodução espera entre os comandos o mesmo tempo que a sessão original.
+// Use uma cópia dos dados: a sessão gravada já os alterou, e a reprodução
+// também grava neles.
+
+// Lê um varint de [*p, fim); retorna 0 se o registro está incompleto
+static int lerVarint(const unsigned char** p, const unsigned char* fim, uint64_t* valor) {
+    uint64_t v = 0;
+    for (int desloc = 0; desloc < 64 && *p < fim; desloc += 7) {
+        unsigned char b = *(*p)++;
+        v |= (uint64_t) (b & 0x7F) << desloc;
+        if (b < 0x80) {
+            *valor = v;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Desfaz o zigzag de codificarVarint
+static int dezigzag(uint64_t valor) {
+    return (int) ((uint32_t) (valor >> 1) ^ (0u - (uint32_t) (valor & 1)));
+}
+
+// Espera 'ms' milissegundos (--ritmo-original)
+static void dormirMs(uint32_t ms) {
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec ts = {(time_t) (ms / 1000), (long) (ms % 1000) * 1000000L};
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+#endif
+}
+
+// Executa um comando do rastro sem escrever nada: as consultas que o lote
+// escreve (N e P) só consultam, e o relatório e as métricas não alteram o
+// estado
+static void reproduzirComando(Fila* fila, Pilha* historico, const Comando* cmd, ResultadoLote* res) {
+    switch (cmd->tipo) {
+        case CMD_BUSCAR_NOME: {
+            Paciente resultados[MAX_RESULTADOS_NOME];
+            res->comandos++;
+            res->buscas++;
+            if (consultarPorNome(fila, historico, cmd->nome, resultados, MAX_RESULTADOS_NOME) > 0)
+                res->encontrados++;
+            break;
+        }
+        case CMD_POSICAO:
+            res->comandos++;
+            res->buscas++;
+            if (consultarPosicao(fila, cmd->id) != 0) res->encontrados++;
+            break;
+        case CMD_RELATORIO:
+        case CMD_METRICAS:
+            res->comandos++;
+            break;
+        default:
+            executarComando(fila, historico, cmd, res);
+    }
+}
+
+// Escreve, para cada parte do estado, se confere com o gravado
+// Retorna quantas partes diferem
+static int compararResumos(const char* titulo, ResumoEstado gravado, ResumoEstado obtido) {
+    int fila = gravado.fila != obtido.fila;
+    int historico = gravado.historico != obtido.historico;
+    int metricas = gravado.metricas != obtido.metricas;
+    printf("%s: fila %s | histórico %s | métricas %s\n", titulo,
+           fila ? "DIFERE" : "confere", historico ? "DIFERE" : "confere", metricas ? "DIFERE" : "confere");
+    return fila + historico + metricas;
+}
+
+// Reproduz o rastro 'caminho' sobre os dados de 'prefixoDados' e o arquivo
+// 'importacao' (ambos podem ser NULL)
+// Retorna 0 se o estado final confere, 2 se difere e 1 em caso de erro
+int executarReproducao(const char* caminho, const char* prefixoDados, const char* importacao,
+                       int ritmoOriginal) {
+    // O rastro inteiro vai para a memória, como o .wal em reproduzirWal
+    FILE* arq = fopen(caminho, "rb");
+    if (arq == NULL) {
+        fprintf(stderr, "ERRO: Não foi possível abrir o rastro %s.\n", caminho);
+        return 1;
+    }
+    fseek(arq, 0, SEEK_END);
+    long tamanho = ftell(arq);
+    fseek(arq, 0, SEEK_SET);
+    unsigned char* dados = tamanho > 0 ? (unsigned char*) malloc((size_t) tamanho) : NULL;
+    if (dados == NULL || fread(dados, 1, (size_t) tamanho, arq) != (size_t) tamanho) {
+        fprintf(stderr, "ERRO: Não foi possível ler o rastro %s.\n", caminho);
+        free(dados);
+        fclose(arq);
+        return 1;
+    }
+    fclose(arq);
+
+    uint32_t cabecalho[5];
+    ResumoEstado inicial, final;
+    size_t tamCabecalho = sizeof(cabecalho) + sizeof(inicial);
+    if ((size_t) tamanho >= tamCabecalho) memcpy(cabecalho, dados, sizeof(cabecalho));
+    if ((size_t) tamanho < tamCabecalho || cabecalho[0] != MAGICO_RASTRO) {
+        fprintf(stderr, "ERRO: %s não é um rastro de comandos.\n", caminho);
+        free(dados);
+        return 1;
+    }
+    if (cabecalho[1] != VERSAO_RASTRO) {
+        fprintf(stderr, "ERRO: Rastro %s gravado por outra versão ou escala de prioridades.\n", caminho);
+        free(dados);
+        return 1;
+    }
+    memcpy(&inicial, dados + sizeof(cabecalho), sizeof(inicial));
+    if (!configurarDesfazer(cabecalho[3])) {
+        fprintf(stderr, "ERRO: Falha na alocação do histórico de desfazer.\n");
+        free(dados);
+        return 1;
+    }
+
+    // O relógio virtual fica ligado até o fim, a começar pela carga: os
+    // pacientes recuperados chegam no mesmo instante que na gravação
+    uint32_t agora = cabecalho[4];
+    agoraSimuladoMs = agora;
+    relogioSimulado = 1;
+
+    Fila fila;
+    inicializaFila(&fila);
+    Pilha* pilha = inicializaPilha();
+    if (pilha == NULL) {
+        encerrarExecucao(&fila, pilha, NULL, NULL);
+        relogioSimulado = 0;
+        free(dados);
+        return 1;
+    }
+    DiarioWAL* diario = NULL;
+    if (prefixoDados != NULL) {
+        diario = abrirDiario(prefixoDados, &fila, pilha, DIARIO_LOTE_SYNC_LOTE);
+        if (diario == NULL) {
+            fprintf(stderr, "ERRO: Não foi possível abrir os dados em %s.\n", prefixoDados);
+            encerrarExecucao(&fila, pilha, NULL, NULL);
+            relogioSimulado = 0;
+            free(dados);
+            return 1;
+        }
+    }
+    if (importacao != NULL) importarComResumo(importacao, &fila, pilha);
+    fila.envelhecimentoMs = cabecalho[2];
+
+    IndiceNomes* nomes = criarIndiceNomes();
+    if (nomes == NULL || !ligarIndiceNomes(nomes, &fila, pilha)) {
+        fprintf(stderr, "ERRO: Falha na alocação do índice de nomes.\n");
+        encerrarExecucao(&fila, pilha, diario, nomes);
+        relogioSimulado = 0;
+        free(dados);
+        return 1;
+    }
+
+    ResumoEstado carregado = resumirEstado(&fila, pilha);
+    if (memcmp(&carregado, &inicial, sizeof(inicial)) != 0) {
+        fprintf(stderr, "AVISO: O estado carregado difere do que a gravação encontrou "
+                        "(use uma cópia dos dados e a mesma importação da gravação).\n");
+    }
+
+    ResultadoLote res;
+    memset(&res, 0, sizeof(res));
+    const unsigned char* p = dados + tamCabecalho;
+    const unsigned char* fim = dados + tamanho;
+    uint64_t gravados = 0;
+    int terminou = 0, invalido = 0;
+
+    saidaSilenciosa = 1;
+    uint64_t inicio = relogioNs();
+    while (p < fim) {
+        const unsigned char* registro = p;
+        char letra = (char) *p++;
+        uint64_t intervalo;
+        if (!lerVarint(&p, fim, &intervalo)) break;
+        if (letra == FIM_RASTRO) {
+            if (!lerVarint(&p, fim, &gravados) || (size_t) (fim - p) < sizeof(final)) break;
+            memcpy(&final, p, sizeof(final));
+            terminou = 1;
+            break;
+        }
+        const char* tipo = letra != '\0' ? strchr(LETRAS_COMANDO, letra) : NULL;
+        if (tipo == NULL) {
+            fprintf(stderr, "ERRO: Registro inválido no byte %zu do rastro.\n", (size_t) (registro - dados));
+            invalido = 1;
+            break;
+        }
+
+        // Campos: I = id, idade, prioridade; T = id, prioridade; D, F, P = id
+        Comando cmd = {(TipoComando) (tipo - LETRAS_COMANDO), 0, 0, 0, NULL};
+        int numCampos = letra == 'I' ? 3 : letra == 'T' ? 2 : (letra == 'D' || letra == 'F' || letra == 'P');
+        uint64_t campos[3] = {0, 0, 0};
+        int completo = 1;
+        for (int i = 0; i < numCampos && completo; i++) completo = lerVarint(&p, fim, &campos[i]);
+        cmd.id = dezigzag(campos[0]);
+        if (letra == 'I') {
+            cmd.idade = dezigzag(campos[1]);
+            cmd.prioridade = dezigzag(campos[2]);
+        } else if (letra == 'T') {
+            cmd.prioridade = dezigzag(campos[1]);
+        }
+        if (completo && (letra == 'I' || letra == 'N')) {
+            // O texto é usado direto do buffer, já terminado em '\0'
+            const unsigned char* nulo = (const unsigned char*) memchr(p, '\0', (size_t) (fim - p));
+            completo = nulo != NULL;
+            if (completo) {
+                cmd.nome = (char*) p;
+                p = nulo + 1;
+            }
+        }
+        if (!completo) break;  // Último registro cortado (sessão interrompida)
+
+        agora += (uint32_t) intervalo;
+        if (ritmoOriginal && intervalo > 0) dormirMs((uint32_t) intervalo);
+        agoraSimuladoMs = agora;
+        reproduzirComando(&fila, pilha, &cmd, &res);
+        if (diario != NULL) confirmarDiario(diario, &fila, pilha);
+    }
+    double segundos = (double) (relogioNs() - inicio) / 1e9;
+    saidaSilenciosa = 0;
+
+    printf("RASTRO REPRODUZIDO\n");
+    printf("Comandos: %zu em %.3f s (%.0f por segundo)\n", res.comandos, segundos,
+           segundos > 0 ? (double) res.comandos / segundos : 0.0);
+    printf("Inseridos: %zu | Atendidos: %zu | Desfeitos: %zu | Refeitos: %zu\n",
+           res.inseridos, res.atendidos, res.desfeitos, res.refeitos);
+    printf("Retriagens: %zu | Desistências: %zu\n", res.retriagens, res.desistencias);
+    printf("Buscas: %zu (encontrados: %zu)\n", res.buscas, res.encontrados);
+
+    int divergencias = 0;
+    if (terminou) {
+        if (gravados != res.comandos) {
+            printf("Comandos gravados: %llu (DIFERE)\n", (unsigned long long) gravados);
+            divergencias++;
+        }
+        divergencias += compararResumos("Estado final", final, resumirEstado(&fila, pilha));
+    } else if (!invalido) {
+        printf("AVISO: O rastro não tem o registro de fim (gravação interrompida); "
+               "não há estado final para conferir.\n");
+    }
+
+    encerrarExecucao(&fila, pilha, diario, nomes);
+    relogioSimulado = 0;
+    free(dados);
+    if (invalido) return 1;
+    return divergencias == 0 ? 0 : 2;
 }
 
-// ============= FUNÇÕES DE IMPRESSÃO =============
 
-// Imprime os dados de um único paciente de forma formatada
-void imprimirPaciente(Paciente p){
-	printf("\nID: %d\n", p.id);
-	printf("NOME: %s\n", p.nome);
-	printf("IDADE: %d anos\n", p.idade);
-	printf("PRIORIDADE: %s (%d)\n", obterNomePrioridade(p.prioridade), p.prioridade);
-	printf("------ --------- ------\n");
-}
+// ============= MODO SERVIDOR =============
+// Serve a fila por um socket TCP ou Unix, para que mesas, médicos e
+// painéis na parede compartilhem a mesma fila. O protocolo é de linhas:
+// os mesmos comandos do modo em lote (I, A, U, Y, T, D, F, P, N, R, M), um por
+// linha, e uma linha de resposta por comando, na mesma ordem:
+//   OK [dados]   ou   ERRO <motivo>
+// O cliente pode mandar vários comandos sem esperar as respostas
+// (pipelining). Uma única thread atende todas as conexões com epoll e
+// sockets não bloqueantes. As respostas de uma volta do laço só são
+// enviadas depois do fsync do diário, que vale para todas (commit em grupo).
+// Endereço: "porta" ou "host:porta" para TCP (o host padrão é 127.0.0.1)
+// ou um caminho contendo '/' para um socket Unix.
 
-// Imprime todos os pacientes em espera na fila, ordenados por prioridade
-void imprimirFila(Fila* fila) {
-    if (fila->inicio == NULL) {
-        printf("Fila vazia.\n");
-        return;
-    }
+#ifdef __linux__
 
-    // Percorre a lista encadeada do início até o fim
-    No* atual = fila->inicio;
-    printf("\n=== FILA DE ESPERA ===");
+// Bytes recebidos ainda não processados (também é o maior tamanho de linha)
+#define TAM_ENTRADA_CONEXAO (64 * 1024)
+// Com mais respostas que isso esperando envio, o servidor para de ler do
+// cliente até ele consumir (um cliente lento não faz a memória crescer)
+#define LIMITE_SAIDA_CONEXAO (4 * 1024 * 1024)
+#define MAX_EVENTOS_SERVIDOR 256
 
-    while (atual != NULL) {
-        imprimirPaciente(atual->dados);
-        atual = atual->prox;  // Avança para o próximo nó
-    }
+// Uma conexão de cliente
+typedef struct Conexao {
+    int fd;
+    char entrada[TAM_ENTRADA_CONEXAO];
+    size_t usadoEntrada;
+    char* saida;               // Respostas a enviar
+    size_t usadoSaida;
+    size_t enviadoSaida;
+    size_t capSaida;
+    int lendo;                 // EPOLLIN ligado
+    int escrevendo;            // EPOLLOUT ligado
+    int fechando;              // Cliente terminou (ou erro): fecha depois de enviar tudo
+    int marcada;               // Já está na lista de conexões a atualizar
+    struct Conexao* proxMarcada;
+} Conexao;
+
+static volatile sig_atomic_t servidorEncerrando = 0;
+
+// SIGINT/SIGTERM: o laço termina e o estado é gravado
+static void pedirEncerramento(int sinal) {
+    (void) sinal;
+    servidorEncerrando = 1;
 }
 
-// Imprime todo o histórico de atendimentos (do mais recente para o mais antigo)
-void imprimirPilha(Pilha* p) {
-    if (p == NULL || p->topo == NULL) {
-        printf("Pilha vazia.\n");
-        return;
+// Abre o socket do endereço: em modo 'servidor' faz bind + listen,
+// senão conecta. Retorna o descritor ou -1 (com a mensagem de erro)
+static int abrirSocket(const char* endereco, int servidor) {
+    if (strchr(endereco, '/') != NULL) {
+        struct sockaddr_un un;
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        if (strlen(endereco) >= sizeof(un.sun_path)) {
+            fprintf(stderr, "ERRO: Caminho de socket longo demais: %s\n", endereco);
+            return -1;
+        }
+        strcpy(un.sun_path, endereco);
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        if (servidor) unlink(endereco);  // Socket que sobrou de uma execução anterior
+        int ok = servidor ? bind(fd, (struct sockaddr*) &un, sizeof(un)) == 0 && listen(fd, SOMAXCONN) == 0
+                          : connect(fd, (struct sockaddr*) &un, sizeof(un)) == 0;
+        if (!ok) {
+            fprintf(stderr, "ERRO: Não foi possível usar o socket %s.\n", endereco);
+            close(fd);
+            return -1;
+        }
+        return fd;
     }
 
-    // Percorre a pilha do topo até a base (ordem LIFO - Last In, First Out)
-    NoPilha* atual = p->topo;
-    printf("\n=== HISTÓRICO DE ATENDIMENTOS ===");
+    // "host:porta" ou só "porta"
+    char host[256] = "127.0.0.1";
+    const char* porta = endereco;
+    const char* doisPontos = strrchr(endereco, ':');
+    if (doisPontos != NULL) {
+        size_t tam = (size_t) (doisPontos - endereco);
+        if (tam >= sizeof(host)) return -1;
+        memcpy(host, endereco, tam);
+        host[tam] = '\0';
+        porta = doisPontos + 1;
+    }
 
-    while (atual != NULL) {
-        imprimirPaciente(atual->dados);
-        atual = atual->prox;  // Vai para o próximo paciente do histórico
+    struct addrinfo dicas, *enderecos;
+    memset(&dicas, 0, sizeof(dicas));
+    dicas.ai_family = AF_UNSPEC;
+    dicas.ai_socktype = SOCK_STREAM;
+    dicas.ai_flags = servidor ? AI_PASSIVE : 0;
+    if (getaddrinfo(host, porta, &dicas, &enderecos) != 0) {
+        fprintf(stderr, "ERRO: Endereço inválido: %s\n", endereco);
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo* a = enderecos; a != NULL && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+        if (fd < 0) continue;
+        int um = 1;
+        int ok;
+        if (servidor) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &um, sizeof(um));
+            ok = bind(fd, a->ai_addr, a->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0;
+        } else {
+            ok = connect(fd, a->ai_addr, a->ai_addrlen) == 0;
+            if (ok) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &um, sizeof(um));
+        }
+        if (!ok) {
+            close(fd);
+            fd = -1;
+        }
     }
+    freeaddrinfo(enderecos);
+    if (fd < 0) fprintf(stderr, "ERRO: Não foi possível usar o endereço %s.\n", endereco);
+    return fd;
 }
 
-// Exibe o relatório geral do sistema com estatísticas
-void exibirRelatorio() {
-    printf("RELATÓRIO DE PACIENTES\n");
-    printf("Total de Pacientes Cadastrados: %d\n", estatisticas[0]);
-    printf("Total de Pacientes Atendidos: %d\n", estatisticas[1]);
-    printf("Total de Pacientes Desfeitos: %d\n", estatisticas[2]);
-    // Calcula pacientes em espera: cadastrados - atendidos
-    printf("Pacientes em Espera (Fila): %d\n", estatisticas[0] - estatisticas[1]);
+// Acrescenta uma resposta formatada à saída da conexão
+static void responder(Conexao* c, const char* formato, ...) {
+    for (;;) {
+        va_list args;
+        va_start(args, formato);
+        size_t livre = c->capSaida - c->usadoSaida;
+        int n = vsnprintf(c->saida + c->usadoSaida, livre, formato, args);
+        va_end(args);
+        if (n < 0) return;
+        if ((size_t) n < livre) {
+            c->usadoSaida += (size_t) n;
+            return;
+        }
+        // Não coube: dobra o buffer e formata de novo
+        size_t nova = c->capSaida * 2;
+        while (nova - c->usadoSaida <= (size_t) n) nova *= 2;
+        char* maior = (char*) realloc(c->saida, nova);
+        if (maior == NULL) {
+            // Sem a resposta, as seguintes ficariam trocadas: o cliente
+            // recebe o que já estava pronto e a conexão é fechada
+            c->fechando = 1;
+            return;
+        }
+        c->saida = maior;
+        c->capSaida = nova;
+    }
 }
 
-// Limpa a tela do console de forma compatível (Windows ou Linux)
-void limparTela(){
-	#ifdef _WIN32
-		system("cls");       // Comando Windows
-	#elif __linux__
-		system("clear");     // Comando Linux/macOS
-	#endif
+// Executa uma linha de comando e responde na conexão
+static void executarRequisicao(Fila* fila, Pilha* historico, char* linha, Conexao* c) {
+    Comando cmd = decodificarComando(linha);
+    if (cmd.tipo != CMD_INVALIDO)
+        anotarRastro(LETRAS_COMANDO[cmd.tipo], cmd.id, cmd.idade, cmd.prioridade, cmd.nome);
+    switch (cmd.tipo) {
+        case CMD_INSERIR: {
+            int r = inserirDoComando(fila, historico, &cmd);
+            if (r > 0) responder(c, "OK\n");
+            else responder(c, r == 0 ? "ERRO dados invalidos\n" : "ERRO id repetido\n");
+            break;
+        }
+        case CMD_ATENDER: {
+            Paciente p;
+            if (atenderPaciente(fila, historico, &p))
+                responder(c, "OK %d %d %s\n", p.id, p.prioridade, obterNome(p.nome));
+            else
+                responder(c, "ERRO fila vazia\n");
+            break;
+        }
+        case CMD_DESFAZER:
+            responder(c, desfazerComando(fila, historico) ? "OK\n" : "ERRO nada para desfazer\n");
+            break;
+        case CMD_REFAZER:
+            responder(c, refazerComando(fila, historico) ? "OK\n" : "ERRO nada para refazer\n");
+            break;
+        case CMD_PRIORIDADE:
+            // A prioridade inválida também passa por retriarPaciente, que a
+            // recusa e conta nas métricas, como no lote (e na reprodução)
+            if (retriarPaciente(fila, cmd.id, cmd.prioridade)) responder(c, "OK\n");
+            else if (!validarPrioridade(cmd.prioridade)) responder(c, "ERRO dados invalidos\n");
+            else responder(c, "ERRO fora da fila\n");
+            break;
+        case CMD_DESISTENCIA:
+            responder(c, registrarDesistencia(fila, cmd.id) ? "OK\n" : "ERRO fora da fila\n");
+            break;
+        case CMD_BUSCAR: {
+            Paciente p = consultarPaciente(fila, historico, cmd.id);
+            if (p.id == -1) {
+                responder(c, "ERRO nao encontrado\n");
+                break;
+            }
+            const char* situacao = buscarIndice(&fila->indice, p.id) != NULL ? "fila" : "historico";
+            responder(c, "OK %d %d %d %s %s\n", p.id, p.idade, p.prioridade, situacao, obterNome(p.nome));
+            break;
+        }
+        case CMD_BUSCAR_NOME: {
+            Paciente resultados[MAX_RESULTADOS_NOME];
+            int encontrados = consultarPorNome(fila, historico, cmd.nome, resultados, MAX_RESULTADOS_NOME);
+            if (encontrados < 0) {
+                responder(c, "ERRO consulta curta\n");
+                break;
+            }
+            responder(c, "OK");
+            for (int i = 0; i < encontrados; i++) responder(c, " %d", resultados[i].id);
+            responder(c, "\n");
+            break;
+        }
+        case CMD_POSICAO: {
+            int posicao = consultarPosicao(fila, cmd.id);
+            if (posicao == 0) responder(c, "ERRO fora da fila\n");
+            else responder(c, "OK %d %d\n", posicao, fila->tamanho);
+            break;
+        }
+        case CMD_RELATORIO:
+            responder(c, "OK cadastrados=%d atendidos=%d desfeitos=%d espera=%d",
+                      metricas.contadores[CONTADOR_CADASTRADOS], metricas.contadores[CONTADOR_ATENDIDOS],
+                      metricas.contadores[CONTADOR_DESFEITOS], fila->tamanho);
+            for (int i = 0; i < NUM_PRIORIDADES; i++) responder(c, " nivel%d=%d", i + 1, fila->baldes[i].quantidade);
+            responder(c, "\n");
+            break;
+        case CMD_METRICAS: {
+            // O JSON das métricas já termina com a quebra de linha
+            char* json = NULL;
+            size_t tamJson = 0;
+            FILE* memoria = open_memstream(&json, &tamJson);
+            if (memoria == NULL) {
+                responder(c, "ERRO memoria\n");
+                break;
+            }
+            escreverMetricasJSON(memoria, fila);
+            fclose(memoria);
+            responder(c, "OK %s", json);
+            free(json);
+            break;
+        }
+        default:
+            responder(c, "ERRO comando invalido\n");
+    }
+    concluirComandoRastro();
 }
 
-// ============= FUNÇÕES DE FILA =============
-// CONCEITO IMPORTANTE: Este é uma fila de PRIORIDADE (Priority Queue)
-// Pacientes NÃO entram na ordem de chegada, mas sim ORDENADOS por prioridade
-// Prioridades: 1=Emergência (máxima) → 2=Urgência → 3=Normal (mínima)
-// Quanto MENOR o número, MAIOR a prioridade de atendimento
-
-void inserirFila(Fila* fila, Paciente paciente) {
-    // PASSO 1: Aloca memória para um novo nó armazenar o paciente cadastrado
-    No* novo = (No*) malloc(sizeof(No));
-    if (novo == NULL) {
-        printf("ERRO: Falha na alocação de memória para novo paciente.\n");
-        return;
+// Executa todas as linhas completas recebidas; o resto fica no buffer
+// Para se a conexão passou a ser fechada (resposta que não coube)
+static void processarEntradaConexao(Fila* fila, Pilha* historico, Conexao* c) {
+    char* inicio = c->entrada;
+    char* limite = c->entrada + c->usadoEntrada;
+    char* quebra;
+    while (!c->fechando && (quebra = (char*) memchr(inicio, '\n', (size_t) (limite - inicio))) != NULL) {
+        *quebra = '\0';
+        if (quebra > inicio && quebra[-1] == '\r') quebra[-1] = '\0';
+        char* p = pularEspacos(inicio);
+        if (*p != '\0' && *p != '#') executarRequisicao(fila, historico, p, c);
+        inicio = quebra + 1;
     }
+    c->usadoEntrada = (size_t) (limite - inicio);
+    memmove(c->entrada, inicio, c->usadoEntrada);
 
-    novo->dados = paciente;
-    novo->prox = NULL;
-
-    // PASSO 2: VERIFICA SE FILA ESTÁ VAZIA
-    // Se a fila estiver vazia, o novo paciente é o primeiro e último
-    if (fila->inicio == NULL) {
-        fila->inicio = novo;
-        fila->fim = novo;
-        printf("Paciente %s inserido na fila (primeira posição).\n", paciente.nome);
-        return;
+    if (c->usadoEntrada == TAM_ENTRADA_CONEXAO) {
+        responder(c, "ERRO linha longa demais\n");
+        c->fechando = 1;
     }
+}
 
-    // PASSO 3: VERIFICA INSERÇÃO NO INÍCIO
-    // Se o novo paciente tem prioridade MAIOR (número MENOR) que o primeiro
-    // Exemplo: Novo=1(Emergência), Primeiro=3(Normal) → Novo vai para frente
-    if (paciente.prioridade < fila->inicio->dados.prioridade) {
-        novo->prox = fila->inicio;  // Novo aponta para quem era o primeiro
-        fila->inicio = novo;        // Novo vira o novo primeiro
-        printf("Paciente %s inserido na fila (início - alta prioridade).\n", paciente.nome);
-        return;
+// Lê o que chegou na conexão e executa os comandos completos
+static void lerConexao(Fila* fila, Pilha* historico, Conexao* c) {
+    ssize_t n = recv(c->fd, c->entrada + c->usadoEntrada, TAM_ENTRADA_CONEXAO - c->usadoEntrada, 0);
+    if (n > 0) {
+        c->usadoEntrada += (size_t) n;
+        processarEntradaConexao(fila, historico, c);
+    } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        // Fim do envio do cliente: uma última linha sem \n ainda vale
+        if (n == 0 && c->usadoEntrada > 0 && c->usadoEntrada < TAM_ENTRADA_CONEXAO) {
+            c->entrada[c->usadoEntrada++] = '\n';
+            processarEntradaConexao(fila, historico, c);
+        }
+        c->fechando = 1;
     }
+}
 
-    // PASSO 4: ENCONTRA A POSIÇÃO CORRETA NO MEIO/FIM
-    // Este loop é a PARTE MAIS COMPLEXA - ler com atenção:
-    // 
-    // Começamos em 'atual' no primeiro paciente
-    // Enquanto houver próximo paciente (atual->prox != NULL) e
-    // a prioridade do PRÓXIMO for MENOR ou IGUAL ao novo
-    // continua avançando o 'atual' para encontrar o ponto de inserção
-    //
-    // Exemplo com fila de tamanho 3:
-    // Fila atual:   [P1:prio=2] -> [P2:prio=2] -> [P3:prio=3]
-    // Novo atual:   Novo paciente com prioridade=2
-    // 
-    // Iteração 1: atual aponta para P1
-    //   - P1->prox é P2 (não é NULL)
-    //   - P2->prioridade (2) <= prioridade nova (2) é VERDADEIRO
-    //   - Then: atual = P2
-    // Iteração 2: atual aponta para P2
-    //   - P2->prox é P3 (não é NULL)
-    //   - P3->prioridade (3) <= prioridade nova (2) é FALSO
-    //   - Loop termina com atual em P2
-    // Resultado: Novo será inserido ENTRE P2 e P3
-    
-    No* atual = fila->inicio;
-    while (atual->prox != NULL && atual->prox->dados.prioridade <= paciente.prioridade) {
-        atual = atual->prox;  // Avança para o próximo nó
+// Envia o que der da saída sem bloquear; retorna 0 se a conexão falhou
+static int enviarConexao(Conexao* c) {
+    while (c->enviadoSaida < c->usadoSaida) {
+        ssize_t n = send(c->fd, c->saida + c->enviadoSaida, c->usadoSaida - c->enviadoSaida, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        c->enviadoSaida += (size_t) n;
     }
+    c->usadoSaida = 0;
+    c->enviadoSaida = 0;
+    return 1;
+}
 
-    // PASSO 5: REALIZA A INSERÇÃO
-    // Insere o novo paciente após 'atual'
-    novo->prox = atual->prox;  // Novo aponta para quem 'atual' apontava
-    atual->prox = novo;        // 'atual' agora aponta para novo
+// Ajusta os eventos pedidos ao epoll conforme o estado da conexão
+static void atualizarEventosConexao(int epfd, Conexao* c) {
+    int pendente = c->usadoSaida > c->enviadoSaida;
+    int lendo = !c->fechando && c->usadoSaida - c->enviadoSaida < LIMITE_SAIDA_CONEXAO;
+    if (lendo == c->lendo && pendente == c->escrevendo) return;
+    struct epoll_event ev;
+    ev.events = (lendo ? EPOLLIN : 0) | (pendente ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->lendo = lendo;
+    c->escrevendo = pendente;
+}
 
-    // Se o novo node não tem seguidor, é o último da fila
-    if (novo->prox == NULL) {
-        fila->fim = novo;
-    }
+// Descritor guardado para quando os descritores acabam (EMFILE/ENFILE): o
+// socket de escuta continuaria pronto e o epoll voltaria sem parar. A
+// reserva é fechada, quem espera é aceito e fechado na hora, e a reserva
+// é reaberta. Sem reserva, a escuta sai do epoll por um segundo
+static int descritorReserva = -1;
+static uint64_t escutaPausadaAte = 0;  // relogioNs() em que a escuta volta (0 = ativa)
 
-    printf("Paciente %s inserido na fila.\n", paciente.nome);
+// Tira o socket de escuta do epoll até escutaPausadaAte (ver servirFila)
+static void pausarEscuta(int epfd, int escuta) {
+    struct epoll_event ev;
+    ev.events = 0;
+    ev.data.ptr = NULL;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, escuta, &ev);
+    escutaPausadaAte = relogioNs() + 1000000000ull;
 }
 
-// Remove e retorna o primeiro paciente da fila (o de maior prioridade)
-// Esta é a operação de atendimento: sempre atendemos quem tem prioridade
-Paciente removerFila(Fila* fila) {
-    // Define um paciente "vazio" com ID=-1 como marcador de erro
-    Paciente vazio = {-1, "", 0, PRIORIDADE_INVALIDA};
-    
-    // Verifica se fila está vazia
-    if (fila->inicio == NULL) {
-        printf("ERRO: Fila vazia. Nenhum paciente para atender.\n");
-        return vazio;
-    }
-    
-    // Salva referência ao primeiro nó
-    No* temp = fila->inicio;
-    // Copia os dados do paciente a ser removido para um campo auxiliar
-    Paciente paciente = temp->dados;
-
-    // Atualiza o início: o primeiro passa a ser o segundo
-    fila->inicio = temp->prox;
+// Aceita todas as conexões pendentes no socket de escuta
+static void aceitarConexoes(int epfd, int escuta, size_t* conexoes) {
+    for (;;) {
+        int fd = accept(escuta, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EMFILE || errno == ENFILE) {
+                if (descritorReserva >= 0) {
+                    // Recusa quem está esperando com o descritor da reserva
+                    close(descritorReserva);
+                    fd = accept(escuta, NULL, NULL);
+                    int erro = errno;
+                    if (fd >= 0) close(fd);
+                    descritorReserva = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                    if (fd >= 0 || erro == EINTR || erro == ECONNABORTED) continue;
+                    if (erro == EAGAIN || erro == EWOULDBLOCK) return;
+                }
+                pausarEscuta(epfd, escuta);
+            } else if (errno == ENOBUFS || errno == ENOMEM) {
+                pausarEscuta(epfd, escuta);
+            }
+            return;  // EAGAIN: não há mais ninguém esperando
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        int um = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &um, sizeof(um));  // Falha em socket Unix, sem problema
 
-    // Se a fila ficou vazia, também atualiza o fim
-    if (fila->inicio == NULL) {
-        fila->fim = NULL;
+        Conexao* c = (Conexao*) calloc(1, sizeof(Conexao));
+        char* saida = (char*) malloc(4096);
+        if (c == NULL || saida == NULL) {
+            free(c);
+            free(saida);
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->saida = saida;
+        c->capSaida = 4096;
+        c->lendo = 1;
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            free(c->saida);
+            free(c);
+            close(fd);
+            continue;
+        }
+        (*conexoes)++;
     }
+}
 
-    free(temp);       // Libera a memória do nó que foi removido
-    return paciente;  // Retorna os dados do paciente atendido
+// Fecha a conexão e libera a memória
+static void fecharConexao(int epfd, Conexao* c, size_t* conexoes) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c->saida);
+    free(c);
+    (*conexoes)--;
 }
 
-// ============= FUNÇÕES DE PILHA =============
-// Pilha é usada para manter histórico de atendimentos (LIFO)
+// Laço principal do servidor até SIGINT/SIGTERM
+// Retorna 0 se encerrou normalmente, 1 se não conseguiu começar
+static int servirFila(const char* endereco, Fila* fila, Pilha* historico, DiarioWAL* diario) {
+    int escuta = abrirSocket(endereco, 1);
+    if (escuta < 0) return 1;
+    fcntl(escuta, F_SETFL, fcntl(escuta, F_GETFL) | O_NONBLOCK);
 
-// Adiciona um novo atendimento ao topo da pilha
-void push(Pilha* p, Paciente paciente) {
-    // Aloca memória para um novo nó no histórico
-    NoPilha* novo = (NoPilha*) malloc(sizeof(NoPilha));
-    if (novo == NULL) {
-        printf("Erro de alocação.\n");
-        return;
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;  // NULL identifica o socket de escuta
+    if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, escuta, &ev) != 0) {
+        fprintf(stderr, "ERRO: Falha ao iniciar o epoll.\n");
+        close(escuta);
+        if (epfd >= 0) close(epfd);
+        return 1;
     }
 
-    novo->dados = paciente;      // Armazena o paciente atendido
-    novo->prox = p->topo;        // Novo aponta para o antigo topo
-    p->topo = novo;              // Novo se torna o topo
-}
+    struct sigaction acao;
+    memset(&acao, 0, sizeof(acao));
+    acao.sa_handler = pedirEncerramento;
+    sigaction(SIGINT, &acao, NULL);
+    sigaction(SIGTERM, &acao, NULL);
 
-// Remove e retorna o elemento do topo da pilha
-// Retorna 1 se bem-sucedido, 0 se pilha vazia
-int pop(Pilha* p, Paciente* paciente) {
-    // Verifica se pilha está vazia
-    if (p->topo == NULL) return 0;
+    printf("Servidor ouvindo em %s (Ctrl+C encerra).\n", endereco);
+    fflush(stdout);
 
-    // Salva o topo atual
-    NoPilha* temp = p->topo;
-    // Copia os dados para o ponteiro fornecido
-    *paciente = temp->dados;
-    // Atualiza topo para o próximo nó
-    p->topo = temp->prox;
+    struct epoll_event eventos[MAX_EVENTOS_SERVIDOR];
+    size_t conexoes = 0;
+    descritorReserva = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    while (!servidorEncerrando) {
+        int n = epoll_wait(epfd, eventos, MAX_EVENTOS_SERVIDOR, 1000);
+        if (n < 0 && errno != EINTR) break;
 
-    // Libera memória do nó removido
-    free(temp);
-    return 1;  // Sucesso
-}
+        // Escuta pausada por falta de descritores: volta depois do prazo
+        if (escutaPausadaAte != 0 && relogioNs() >= escutaPausadaAte) {
+            ev.events = EPOLLIN;
+            ev.data.ptr = NULL;
+            epoll_ctl(epfd, EPOLL_CTL_MOD, escuta, &ev);
+            escutaPausadaAte = 0;
+        }
 
-// ============= FUNÇÕES DE LIMPEZA (LIBERAR MEMÓRIA) =============
-// Importante: evitar vazamento de memória ao encerrar o programa
+        // Lê e executa tudo o que chegou, guardando as respostas
+        Conexao* marcadas = NULL;
+        for (int i = 0; i < n; i++) {
+            Conexao* c = (Conexao*) eventos[i].data.ptr;
+            if (c == NULL) {
+                aceitarConexoes(epfd, escuta, &conexoes);
+                continue;
+            }
+            if (eventos[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                if (c->lendo) lerConexao(fila, historico, c);
+                else if (!(eventos[i].events & EPOLLOUT)) c->fechando = 1;  // Erro sem leitura pendente
+            }
+            if (!c->marcada) {
+                c->marcada = 1;
+                c->proxMarcada = marcadas;
+                marcadas = c;
+            }
+        }
 
-// Libera toda a memória da fila
-void destruirFila(Fila* fila) {
-    if (fila == NULL) return;
+        // Um fsync para todas as alterações desta volta, antes das respostas
+        if (diario != NULL) confirmarDiario(diario, fila, historico);
+        descarregarRastro();
+        gravarMetricasPeriodicas(fila, 0);
 
-    // Percorre toda a fila do início até o fim
-    No* atual = fila->inicio;
-    while (atual != NULL) {
-        No* temp = atual;      // Guarda referência ao nó atual
-        atual = atual->prox;   // Avança para o próximo antes de liberar
-        free(temp);            // Libera a memória do nó guardado
+        while (marcadas != NULL) {
+            Conexao* c = marcadas;
+            marcadas = c->proxMarcada;
+            c->marcada = 0;
+            int ok = enviarConexao(c);
+            if (!ok || (c->fechando && c->usadoSaida == c->enviadoSaida)) fecharConexao(epfd, c, &conexoes);
+            else atualizarEventosConexao(epfd, c);
+        }
     }
-    // Limpa os ponteiros
-    fila->inicio = NULL;
-    fila->fim = NULL;
-}
-
-// Libera toda a memória da pilha (histórico)
-void destruirPilha(Pilha* p) {
-    if (p == NULL) return;
 
-    // Percorre toda a pilha do topo até a base
-    NoPilha* atual = p->topo;
-    while (atual != NULL) {
-        NoPilha* temp = atual;  // Guarda referência ao nó atual
-        atual = atual->prox;    // Avança para o próximo antes de liberar
-        free(temp);             // Libera a memória do nó guardado
-    }
-    free(p);  // Libera a estrutura da pilha em si
+    printf("\nEncerrando servidor (%zu conexões abertas)...\n", conexoes);
+    if (descritorReserva >= 0) close(descritorReserva);
+    descritorReserva = -1;
+    close(epfd);  // As conexões restantes são fechadas pelo fim do processo
+    close(escuta);
+    if (strchr(endereco, '/') != NULL) unlink(endereco);
+    return 0;
 }
 
-// ============= FUNÇÕES DE BUSCA =============
-
-// Busca um paciente na fila pelo ID
-// Retorna os dados do paciente se encontrado, senão retorna um paciente vazio (ID=-1)
-Paciente buscarPacientePorID(Fila* fila, int id) {
-    // Paciente marcador para "não encontrado"
-    Paciente vazio = {-1, "", 0, PRIORIDADE_INVALIDA};
+// Executa o modo servidor: recupera o estado (com --dados), serve a fila
+// até SIGINT/SIGTERM e grava tudo ao encerrar
+int executarServidor(const char* endereco, const char* prefixoDados, uint32_t envelhecimentoMs,
+                     const char* importacao, const char* exportacao) {
+    Fila fila;
+    inicializaFila(&fila);
+    Pilha* pilha = inicializaPilha();
+    if (pilha == NULL) return 1;
 
-    // Percorre a fila do início até encontrar ou atingir o fim
-    No* atual = fila->inicio;
-    while (atual) {
-        // Se encontrou o ID, retorna os dados imediatamente
-        if (atual->dados.id == id)
-            return atual->dados;
-        atual = atual->prox;  // Avança para o próximo
+    // Toda resposta é durável, como no menu; o fsync fica agrupado por
+    // volta do laço porque confirmarDiario só é chamado ali (ver servirFila)
+    DiarioWAL* diario = NULL;
+    if (prefixoDados != NULL) {
+        diario = abrirDiario(prefixoDados, &fila, pilha, DIARIO_LOTE_SYNC_INTERATIVO);
+        if (diario == NULL) {
+            fprintf(stderr, "ERRO: Não foi possível abrir os dados em %s.\n", prefixoDados);
+            return 1;
+        }
     }
+    if (importacao != NULL) importarComResumo(importacao, &fila, pilha);
+    fila.envelhecimentoMs = envelhecimentoMs;
 
-    // Se chegou aqui, não encontrou - retorna paciente vazio
-    return vazio;
-}
+    IndiceNomes* nomes = criarIndiceNomes();
+    if (nomes == NULL || !ligarIndiceNomes(nomes, &fila, pilha)) {
+        fprintf(stderr, "ERRO: Falha na alocação do índice de nomes.\n");
+        return 1;
+    }
 
-// Interface de busca: solicita ID ao usuário e exibe o paciente
-void buscarPaciente(Fila* fila) {
-    int id;
-    printf("\nID do paciente: ");
-    scanf("%d", &id);
-    getchar();  // Limpa o \n deixado por scanf (buffer)
-
-    // Faz a busca
-    Paciente p = buscarPacientePorID(fila, id);
-    // Verifica se foi encontrado (ID=-1 significa não encontrado)
-    if (p.id == -1)
-        printf("Paciente não encontrado.\n");
-    else
-        imprimirPaciente(p);  // Exibe os dados do paciente encontrado
-}
+    iniciarRastro(&fila, pilha);
+    saidaSilenciosa = 1;
+    int resultado = servirFila(endereco, &fila, pilha, diario);
+    saidaSilenciosa = 0;
+    encerrarRastro(&fila, pilha);
 
-// Exibe o menu principal do sistema com todas as opções disponíveis
-void menu() {
-    printf("\n===== SISTEMA HOSPITALAR =====\n");
-    printf("1 - Inserir paciente na fila\n");
-    printf("2 - Atender paciente\n");
-    printf("3 - Desfazer atendimento\n");
-    printf("4 - Buscar paciente por ID\n");
-    printf("5 - Mostrar fila de espera\n");
-    printf("6 - Mostrar histórico de atendimentos\n");
-    printf("7 - Exibir relatório do sistema\n");
-    printf("0 - Sair\n");
-    printf("Escolha: ");
+    gravarMetricasPeriodicas(&fila, 1);
+    if (exportacao != NULL) exportarComResumo(exportacao, &fila, pilha);
+    if (diario != NULL) fecharDiario(diario, &fila, pilha);
+    destruirFila(&fila);
+    destruirPilha(pilha);
+    destruirIndiceNomes(nomes);
+    destruirArmazemNomes();
+    destruirComandos();
+    return resultado;
 }
 
-// ============= FUNÇÕES DE ENTRADA SEGURA =============
-// Estas funções tratam erros de entrada prevaimente e validam os dados
+// Cliente de linha de comando: envia as linhas da entrada padrão ao
+// servidor sem esperar as respostas (pipelining) e escreve as respostas
+// na saída padrão; no fim informa a vazão na saída de erro
+int executarCliente(const char* endereco) {
+    int fd = abrirSocket(endereco, 0);
+    if (fd < 0) return 1;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
 
-// Lê um inteiro com validação de entrada e valor mínimo
-// Retorna -1 se houver erro (entrada inválida ou valor abaixo do mínimo)
-int lerInteiro(int minimo) {
-    int valor;
-    int resultado = scanf("%d", &valor);  // Tenta ler um inteiro
+    static char envio[TAM_ENTRADA_CONEXAO];
+    static char recebido[TAM_ENTRADA_CONEXAO];
+    size_t usadoEnvio = 0, enviado = 0;
+    int fimEntrada = 0, fimEnvio = 0;
+    size_t respostas = 0;
+    uint64_t inicio = relogioNs();
 
-    // Limpa o buffer de entrada (remove caracteres indesejados como \n)
-    while (getchar() != '\n');
+    for (;;) {
+        struct pollfd fds[2];
+        int nfds = 1;
+        fds[0].fd = fd;
+        fds[0].events = POLLIN | (enviado < usadoEnvio ? POLLOUT : 0);
+        if (!fimEntrada && usadoEnvio < sizeof(envio)) {
+            fds[1].fd = STDIN_FILENO;
+            fds[1].events = POLLIN;
+            nfds = 2;
+        }
+        if (poll(fds, (nfds_t) nfds, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
 
-    // Verifica se scanf conseguiu ler um inteiro com sucesso
-    if (resultado != 1) {
-        printf("ERRO: Entrada inválida. Digite um número inteiro.\n");
-        return -1;
+        if (nfds == 2 && (fds[1].revents & (POLLIN | POLLHUP))) {
+            ssize_t n = read(STDIN_FILENO, envio + usadoEnvio, sizeof(envio) - usadoEnvio);
+            if (n <= 0) fimEntrada = 1;
+            else usadoEnvio += (size_t) n;
+        }
+        if (enviado < usadoEnvio) {
+            ssize_t n = send(fd, envio + enviado, usadoEnvio - enviado, MSG_NOSIGNAL);
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) break;
+            if (n > 0) enviado += (size_t) n;
+            if (enviado == usadoEnvio) usadoEnvio = enviado = 0;
+        }
+        if (fimEntrada && usadoEnvio == 0 && !fimEnvio) {
+            shutdown(fd, SHUT_WR);  // O servidor responde o que falta e fecha
+            fimEnvio = 1;
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t n = recv(fd, recebido, sizeof(recebido), 0);
+            if (n == 0) break;
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+                break;
+            }
+            for (ssize_t i = 0; i < n; i++) respostas += recebido[i] == '\n';
+            fwrite(recebido, 1, (size_t) n, stdout);
+        }
     }
+    fflush(stdout);
+    close(fd);
 
-    // Valida o valor mínimo
-    if (valor < minimo) {
-        printf("ERRO: Valor deve ser >= %d.\n", minimo);
-        return -1;
-    }
+    double segundos = (double) (relogioNs() - inicio) / 1e9;
+    fprintf(stderr, "%zu respostas em %.3f s (%.0f por segundo)\n",
+            respostas, segundos, segundos > 0 ? (double) respostas / segundos : 0.0);
+    return 0;
+}
 
-    return valor;  // Retorna o valor lido e validado
+#else
+
+int executarServidor(const char* endereco, const char* prefixoDados, uint32_t envelhecimentoMs,
+                     const char* importacao, const char* exportacao) {
+    (void) endereco; (void) prefixoDados; (void) envelhecimentoMs; (void) importacao; (void) exportacao;
+    fprintf(stderr, "ERRO: O modo servidor só está disponível no Linux (epoll).\n");
+    return 1;
 }
 
-// Lê uma string (nome) de forma segura, evitando buffer overflow
-// fgets é mais seguro que gets porque permite limitar o tamanho
-void lerString(char* buffer, int tamanho) {
-    if (fgets(buffer, tamanho, stdin) != NULL) {
-        // Remove o \n que fgets deixa no final
-        // strcspn encontra a posição de \n e a substitui por \0 (terminador)
-        buffer[strcspn(buffer, "\n")] = '\0';
-    } else {
-        // Se houve erro, deixa string vazia
-        buffer[0] = '\0';
-        while (getchar() != '\n');  // Limpa buffer de erro
-    }
+int executarCliente(const char* endereco) {
+    (void) endereco;
+    fprintf(stderr, "ERRO: O modo cliente só está disponível no Linux.\n");
+    return 1;
 }
 
-// Coleta dados de um novo paciente via entrada do usuário e o insere na fila
-void cadastrarPaciente(Fila* fila) {
-    Paciente p;  // Cria estrutura local para armazenar os dados
+#endif
 
-    printf("\n=== CADASTRO DE PACIENTE ===\n");
 
-    // ========== LER E VALIDAR ID ==========
-    printf("ID do paciente: ");
-    p.id = lerInteiro(ID_MIN);
-    if (p.id == -1) return;  // Se houve erro, aborta o cadastro
+// ============= FUNÇÃO PRINCIPAL =============
 
-    // ========== LER E VALIDAR NOME ==========
-    printf("Nome do paciente: ");
-    lerString(p.nome, 100);
-    if (strlen(p.nome) == 0) {  // Valida se nome não está vazio
-        printf("ERRO: Nome não pode ser vazio.\n");
-        return;
-    }
+int main(int argc, char* argv[]) {
+#ifdef _WIN32
+    // Configura o console do Windows para os acentos (UTF-8) e para as
+    // sequências ANSI de limparTela. No Linux e no macOS o terminal já
+    // recebe UTF-8, e o locale não é carregado (só atrasaria a abertura)
+	setlocale(LC_CTYPE, "pt_BR.UTF-8");
+	SetConsoleOutputCP(CP_UTF8);
+	HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+	DWORD modoConsole;
+	if (GetConsoleMode(console, &modoConsole))
+		SetConsoleMode(console, modoConsole | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+#endif
 
-    // ========== LER E VALIDAR IDADE ==========
-    printf("Idade do paciente: ");
-    p.idade = lerInteiro(IDADE_MIN);
-    if (p.idade == -1 || !validarIdade(p.idade)) {  // Valida intervalo (1-150 anos)
-        printf("ERRO: Idade deve estar entre %d e %d anos.\n", IDADE_MIN, IDADE_MAX);
-        return;
+    // ========== OPÇÕES DE LINHA DE COMANDO ==========
+    // --batch <arquivo>  executa um lote de comandos (- = entrada padrão)
+    // --dados <prefixo>  salva e recupera o estado em <prefixo>.wal/.snap
+    // --estresse <mesas> <médicos> <pacientes>  testa a fila concorrente
+    // --metricas <arquivo> [segundos]  grava as métricas periodicamente
+    // --envelhecimento <segundos>  espera que sobe um nível de prioridade
+    // --desfazer <n>  profundidade do desfazer/refazer (0 = só atendimentos)
+    // --quiet  menu sem as mensagens de abertura e de encerramento
+    // --importar <arquivo>  carrega pacientes de um CSV ou binário ao iniciar
+    // --exportar <arquivo>  grava a fila e o histórico ao encerrar
+    // --servidor <endereço>  serve a fila por TCP ([host:]porta) ou socket Unix
+    // --cliente <endereço>  envia a entrada padrão a um servidor
+    // --departamentos <n> <médicos> <pacientes>  testa os departamentos
+    // --simular <dias> <médicos> [semente]  simula o pronto-socorro com
+    //   relógio virtual, com --chegadas a,b,... (por hora, um valor por
+    //   prioridade), --duracoes a,b,... (minutos), --rajada <média> e
+    //   --envelhecimento
+    // --varredura <dias> <médicos mín> <médicos máx> <repetições> [threads]
+    //   roda muitas simulações em paralelo, com as mesmas opções da
+    //   --simular, --cargas a,b,... (fatores das chegadas) e --semente <n>
+    // --listar fila|historico  escreve a fila ou o histórico e termina, com
+    //   --formato tabela|compacto|json, --limite <n>, --inicio <n> e
+    //   --prioridade <1..PRIORIDADE_MINIMA>
+    // --gravar <arquivo>  grava o rastro dos comandos do menu, do lote ou
+    //   do servidor
+    // --reproduzir <arquivo> [--ritmo-original]  reexecuta um rastro e
+    //   confere o estado final (com os mesmos --dados e --importar)
+    const char* arquivoLote = NULL;
+    const char* listagem = NULL;
+    OpcoesListagem opcoesListagem = {FORMATO_TABELA, 0, 0, 0};
+    const char* enderecoServidor = NULL;
+    const char* arquivoImportacao = NULL;
+    const char* arquivoExportacao = NULL;
+    const char* prefixoDados = NULL;
+    const char* arquivoRastro = NULL;
+    const char* arquivoReproducao = NULL;
+    int ritmoOriginal = 0;
+    uint32_t envelhecimentoMs = 0;
+    long profundidadeDesfazer = PROFUNDIDADE_DESFAZER;
+    int simular = 0, varrer = 0;
+    ConfigSimulacao configSimulacao = CONFIG_SIMULACAO_PADRAO;
+    ConfigVarredura configVarredura = {CONFIG_SIMULACAO_PADRAO, 1, 1, 1, {1}, 1, 0};
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            arquivoLote = argv[++i];
+        } else if (strcmp(argv[i], "--quiet") == 0) {
+            semBanners = 1;
+        } else if (strcmp(argv[i], "--dados") == 0 && i + 1 < argc) {
+            prefixoDados = argv[++i];
+        } else if (strcmp(argv[i], "--servidor") == 0 && i + 1 < argc) {
+            enderecoServidor = argv[++i];
+        } else if (strcmp(argv[i], "--cliente") == 0 && i + 1 < argc) {
+            return executarCliente(argv[i + 1]);
+        } else if (strcmp(argv[i], "--listar") == 0 && i + 1 < argc) {
+            listagem = argv[++i];
+        } else if (strcmp(argv[i], "--formato") == 0 && i + 1 < argc) {
+            const char* formato = argv[++i];
+            if (strcmp(formato, "tabela") == 0) opcoesListagem.formato = FORMATO_TABELA;
+            else if (strcmp(formato, "compacto") == 0) opcoesListagem.formato = FORMATO_COMPACTO;
+            else if (strcmp(formato, "json") == 0) opcoesListagem.formato = FORMATO_JSON;
+            else {
+                fprintf(stderr, "ERRO: Formato deve ser tabela, compacto ou json.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--limite") == 0 && i + 1 < argc) {
+            long limite = atol(argv[++i]);
+            if (limite < 0) {
+                fprintf(stderr, "ERRO: O limite deve ser >= 0 (0 = sem limite).\n");
+                return 1;
+            }
+            opcoesListagem.limite = (size_t) limite;
+        } else if (strcmp(argv[i], "--inicio") == 0 && i + 1 < argc) {
+            long inicio = atol(argv[++i]);
+            opcoesListagem.inicio = inicio > 0 ? (size_t) inicio : 0;
+        } else if (strcmp(argv[i], "--prioridade") == 0 && i + 1 < argc) {
+            int prioridade = atoi(argv[++i]);
+            if (!validarPrioridade(prioridade)) {
+                fprintf(stderr, "ERRO: A prioridade deve ser de %d a %d.\n", PRIORIDADE_MAXIMA, PRIORIDADE_MINIMA);
+                return 1;
+            }
+            opcoesListagem.prioridade = prioridade;
+        } else if (strcmp(argv[i], "--importar") == 0 && i + 1 < argc) {
+            arquivoImportacao = argv[++i];
+        } else if (strcmp(argv[i], "--exportar") == 0 && i + 1 < argc) {
+            arquivoExportacao = argv[++i];
+        } else if (strcmp(argv[i], "--gravar") == 0 && i + 1 < argc) {
+            arquivoRastro = argv[++i];
+        } else if (strcmp(argv[i], "--reproduzir") == 0 && i + 1 < argc) {
+            arquivoReproducao = argv[++i];
+        } else if (strcmp(argv[i], "--ritmo-original") == 0) {
+            ritmoOriginal = 1;
+        } else if (strcmp(argv[i], "--envelhecimento") == 0 && i + 1 < argc) {
+            double segundos = atof(argv[++i]);
+            if (segundos <= 0 || segundos > 86400) {
+                fprintf(stderr, "ERRO: O envelhecimento deve estar entre 0 e 86400 segundos.\n");
+                return 1;
+            }
+            envelhecimentoMs = (uint32_t) (segundos * 1000);
+            if (envelhecimentoMs == 0) envelhecimentoMs = 1;
+        } else if (strcmp(argv[i], "--desfazer") == 0 && i + 1 < argc) {
+            profundidadeDesfazer = atol(argv[++i]);
+            if (profundidadeDesfazer < 0 || profundidadeDesfazer > 1000000) {
+                fprintf(stderr, "ERRO: A profundidade do desfazer deve estar entre 0 e 1000000.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--metricas") == 0 && i + 1 < argc) {
+            const char* caminho = argv[++i];
+            double segundos = 10;
+            // O intervalo é opcional
+            if (i + 1 < argc && argv[i + 1][0] != '-') segundos = atof(argv[++i]);
+            configurarMetricasPeriodicas(caminho, segundos > 0 ? segundos : 10);
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            const char* carga = i + 1 < argc ? argv[i + 1] : "todas";
+            long nMaximo = i + 2 < argc ? atol(argv[i + 2]) : 1000000;
+            return executarBenchmark(carga, nMaximo);
+        } else if (strcmp(argv[i], "--estresse") == 0 && i + 3 < argc) {
+            return executarEstresse(atoi(argv[i + 1]), atoi(argv[i + 2]), atoi(argv[i + 3]));
+        } else if (strcmp(argv[i], "--departamentos") == 0 && i + 3 < argc) {
+            return executarDepartamentos(atoi(argv[i + 1]), atoi(argv[i + 2]), atoi(argv[i + 3]));
+        } else if (strcmp(argv[i], "--simular") == 0 && i + 2 < argc) {
+            simular = 1;
+            configSimulacao.dias = atof(argv[++i]);
+            configSimulacao.medicos = atoi(argv[++i]);
+            // A semente é opcional
+            if (i + 1 < argc && argv[i + 1][0] != '-') configSimulacao.semente = strtoull(argv[++i], NULL, 10);
+        } else if ((strcmp(argv[i], "--chegadas") == 0 || strcmp(argv[i], "--duracoes") == 0) && i + 1 < argc) {
+            double* valores = argv[i][2] == 'c' ? configSimulacao.chegadasHora : configSimulacao.minutosAtendimento;
+            if (lerListaNumeros(argv[++i], valores, NUM_PRIORIDADES) != NUM_PRIORIDADES) {
+                fprintf(stderr, "ERRO: Informe %d valores, um por prioridade (de %d a %d).\n",
+                        NUM_PRIORIDADES, PRIORIDADE_MAXIMA, PRIORIDADE_MINIMA);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--rajada") == 0 && i + 1 < argc) {
+            configSimulacao.rajada = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--semente") == 0 && i + 1 < argc) {
+            configSimulacao.semente = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--varredura") == 0 && i + 4 < argc) {
+            varrer = 1;
+            configSimulacao.dias = atof(argv[++i]);
+            configVarredura.medicosMin = atoi(argv[++i]);
+            configVarredura.medicosMax = atoi(argv[++i]);
+            configVarredura.repeticoes = atoi(argv[++i]);
+            // A quantidade de threads é opcional (padrão: uma por núcleo)
+            if (i + 1 < argc && argv[i + 1][0] != '-') configVarredura.threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--cargas") == 0 && i + 1 < argc) {
+            configVarredura.numCargas = lerListaNumeros(argv[++i], configVarredura.cargas, MAX_CARGAS_VARREDURA);
+            if (configVarredura.numCargas < 1) {
+                fprintf(stderr, "ERRO: Informe de 1 a %d cargas separadas por vírgula.\n", MAX_CARGAS_VARREDURA);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Uso: %s [--dados <prefixo>] [--batch <arquivo>|-] [--metricas <arquivo> [segundos]]\n", argv[0]);
+            fprintf(stderr, "       %s [--envelhecimento <segundos>] [--desfazer <n>] (com qualquer uma das opções acima)\n", argv[0]);
+            fprintf(stderr, "       %s [--quiet] (menu sem as mensagens de abertura e encerramento)\n", argv[0]);
+            fprintf(stderr, "       %s [--importar <arquivo>] [--exportar <arquivo>] (CSV ou binário)\n", argv[0]);
+            fprintf(stderr, "       %s [--gravar <rastro>] (com o menu, --batch ou --servidor)\n", argv[0]);
+            fprintf(stderr, "       %s --reproduzir <rastro> [--ritmo-original] [--dados <prefixo>] [--importar <arquivo>]\n", argv[0]);
+            fprintf(stderr, "       %s --servidor <[host:]porta|caminho> [--dados <prefixo>] ...\n", argv[0]);
+            fprintf(stderr, "       %s --cliente <[host:]porta|caminho> < comandos.txt\n", argv[0]);
+            fprintf(stderr, "       %s --listar fila|historico [--formato tabela|compacto|json] [--limite <n>]\n", argv[0]);
+            fprintf(stderr, "           [--inicio <n>] [--prioridade <1-%d>] [--dados <prefixo>] [--importar <arquivo>]\n",
+                    PRIORIDADE_MINIMA);
+            fprintf(stderr, "       %s --estresse <mesas> <médicos> <pacientes>\n", argv[0]);
+            fprintf(stderr, "       %s --departamentos <departamentos> <médicos> <pacientes>\n", argv[0]);
+            fprintf(stderr, "       %s --simular <dias> <médicos> [semente] [--chegadas a,b,...] [--duracoes a,b,...]\n", argv[0]);
+            fprintf(stderr, "           [--rajada <média>] [--envelhecimento <segundos>]\n");
+            fprintf(stderr, "       %s --varredura <dias> <médicos mín> <médicos máx> <repetições> [threads]\n", argv[0]);
+            fprintf(stderr, "           [--cargas a,b,...] [--semente <n>] (e as opções da --simular)\n");
+            fprintf(stderr, "       %s --bench [carga] [n máximo]\n", argv[0]);
+            return 1;
+        }
     }
 
-    // ========== LER E VALIDAR PRIORIDADE ==========
-    printf("Prioridade (1-Emergência, 2-Urgência, 3-Normal): ");
-    p.prioridade = lerInteiro(EMERGENCIA);
-    if (p.prioridade == -1 || !validarPrioridade(p.prioridade)) {  // Valida se está entre 1-3
-        printf("ERRO: Prioridade deve ser 1, 2 ou 3.\n");
-        return;
+    if (!configurarDesfazer((size_t) profundidadeDesfazer)) {
+        fprintf(stderr, "ERRO: Falha na alocação do histórico de desfazer.\n");
+        return 1;
     }
 
-    // ========== INSERIR NA FILA COM PRIORIDADE ==========
-    inserirFila(fila, p);  // Inser­ção respeita ordem de prioridade automática
-    
-    // Incrementa counter global de pacientes cadastrados
-    estatisticas[0]++;
-}
-
-// Desfaz o último atendimento: remove da pilha e reinsere na fila
-// Útil quando houver engano no atendimento
-int desfazerAtendimento(Fila* fila, Pilha* historico) {
-    // Valida se há algo para desfazer (histórico vazio)
-    if (historico == NULL || historico->topo == NULL) {
-        printf("Nao ha atendimentos para desfazer.\n");
-        return 0;
+    // Simulação: não usa os dados salvos nem o menu
+    configSimulacao.envelhecimentoMs = envelhecimentoMs;
+    if (varrer) {
+        configVarredura.base = configSimulacao;
+        return executarVarredura(&configVarredura);
     }
+    if (simular) return executarSimulacao(&configSimulacao);
 
-    Paciente pacienteDesfeito;
-
-    // Remove o último atendimento da pilha (operação pop)
-    if (!pop(historico, &pacienteDesfeito)) {
-        return 0;
+    // Listagem: só escreve a fila ou o histórico
+    if (listagem != NULL) {
+        return executarListagem(listagem, prefixoDados, arquivoImportacao, &opcoesListagem);
     }
 
-    // Reinsere o paciente na fila, respeitando sua prioridade
-    inserirFila(fila, pacienteDesfeito);
-
-    printf("Atendimento de %s desfeito com sucesso.\n", pacienteDesfeito.nome);
-
-    // Atualiza os contadores do sistema
-    estatisticas[1]--;  // Decrementa contador de atendidos
-    estatisticas[2]++;  // Incrementa contador de desfeitos
-
-    return 1;  // Sucesso
-}
+    // Reprodução: reexecuta um rastro gravado e confere o estado final
+    if (arquivoReproducao != NULL) {
+        return executarReproducao(arquivoReproducao, prefixoDados, arquivoImportacao, ritmoOriginal);
+    }
 
+    // Gravação: o rastro é aberto antes da carga dos dados (ver abrirRastro)
+    if (arquivoRastro != NULL && !abrirRastro(arquivoRastro)) return 1;
 
-// ============= FUNÇÃO PRINCIPAL =============
+    // Modo servidor: a fila passa a ser atendida pela rede
+    if (enderecoServidor != NULL) {
+        return executarServidor(enderecoServidor, prefixoDados, envelhecimentoMs,
+                                arquivoImportacao, arquivoExportacao);
+    }
 
-int main() {
-    // Configura o locale para português (permite acentuação nos caracteres)
-	setlocale(LC_ALL, "pt_BR.UTF-8");
+    // Modo em lote: não abre o menu
+    if (arquivoLote != NULL) {
+        return executarModoLote(arquivoLote, prefixoDados, envelhecimentoMs,
+                                arquivoImportacao, arquivoExportacao);
+    }
 
     // ========== INICIALIZAÇÃO DO SISTEMA ==========
     // Cria a fila de espera de pacientes
@@ -524,21 +8280,55 @@ int main() {
         return 1;  // Encerra com código de erro
     }
 
+    // Recupera o estado salvo e passa a registrar cada alteração
+    DiarioWAL* diario = NULL;
+    if (prefixoDados != NULL) {
+        diario = abrirDiario(prefixoDados, &fila, pilha, DIARIO_LOTE_SYNC_INTERATIVO);
+        if (diario == NULL) {
+            printf("ERRO: Não foi possível abrir os dados em %s.\n", prefixoDados);
+            destruirFila(&fila);
+            destruirPilha(pilha);
+            destruirArmazemNomes();
+            return 1;
+        }
+    }
+    // Pacientes transferidos de outra unidade (o resumo mostra os recusados)
+    if (arquivoImportacao != NULL) importarComResumo(arquivoImportacao, &fila, pilha);
+
+    // O envelhecimento só é ligado depois da recuperação (ver executarModoLote)
+    fila.envelhecimentoMs = envelhecimentoMs;
+
+    // Busca por nome sobre o estado recuperado
+    IndiceNomes* nomes = criarIndiceNomes();
+    if (nomes == NULL || !ligarIndiceNomes(nomes, &fila, pilha)) {
+        printf("ERRO: Falha na alocação do índice de nomes.\n");
+        return 1;
+    }
+    iniciarRastro(&fila, pilha);
+
     int op;  // Variável para armazenar a opção do menu escolhida
 
+    // A saída do menu vai para o terminal em blocos: cada tela sai numa
+    // escrita só, quando lerLinha pede a próxima resposta
+    setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+
     // Exibe mensagem de boas-vindas
-    printf("\n");
-    printf("╔════════════════════════════════════════╗\n");
-    printf("║     BEM-VINDO AO SISTEMA HOSPITALAR    ║\n");
-    printf("╚════════════════════════════════════════╝\n");
+    if (!semBanners) {
+        printf("\n");
+        printf("╔════════════════════════════════════════╗\n");
+        printf("║     BEM-VINDO AO SISTEMA HOSPITALAR    ║\n");
+        printf("╚════════════════════════════════════════╝\n");
+    }
 
     // ========== LOOP PRINCIPAL ==========
     // Executa enquanto o usuário não escolher sair (op != 0)
     do {
         menu();  // Exibe as opções disponíveis
         op = lerInteiro(0);  // Lê e valida a escolha do usuário
-        if (op == -1) {
-            printf("Digite uma opção válida (0-7).\n");
+        if (entradaEncerrada) {
+            op = 0;  // Fim da entrada: encerra salvando, como a opção 0
+        } else if (op == -1) {
+            printf("Digite uma opção válida (0-11).\n");
             continue;  // Volta ao inicío do loop se entrada foi inválida
         }
 
@@ -547,36 +8337,32 @@ int main() {
             // ========== CASO 1: INSERIR PACIENTE ==========
             case 1:
 				limparTela();
-                cadastrarPaciente(&fila);  // Abre interface de cadastro
+                cadastrarPaciente(&fila, pilha);  // Abre interface de cadastro
                 break;
 
             // ========== CASO 2: ATENDER PACIENTE ==========
             case 2: {
 				limparTela();
-                // Remove o primeiro paciente (maior prioridade) da fila
-                Paciente atendido = removerFila(&fila);
-                // Verifica se conseguiu remover (ID != -1 significa sucesso)
-                if (atendido.id != -1) {
-                    // Adiciona ao histórico (pilha) para permitir desfazer
-                    push(pilha, atendido);
+                // Remove o primeiro paciente da fila e o registra no histórico
+                Paciente atendido;
+                anotarRastro('A', 0, 0, 0, NULL);
+                if (atenderPaciente(&fila, pilha, &atendido)) {
                     printf("\n✓ PACIENTE ATENDIDO:\n");
                     imprimirPaciente(atendido);
-                    
-                    // Incrementa contador global de atendidos
-                    estatisticas[1]++;
                 }
                 break;
             }
-            // ========== CASO 3: DESFAZER ATENDIMENTO ==========
+            // ========== CASO 3: DESFAZER ==========
             case 3:
 				limparTela();
-				desfazerAtendimento(&fila, pilha);  // Remove do histórico e reinsere na fila
+				anotarRastro('U', 0, 0, 0, NULL);
+				desfazerComando(&fila, pilha);  // Última ação do histórico
 				break;
 
             // ========== CASO 4: BUSCAR PACIENTE ==========
             case 4:
                 limparTela();
-                buscarPaciente(&fila);  // Solicita ID e exibe dados
+                buscarPaciente(&fila, pilha);  // Solicita ID e exibe dados
                 break;
 
             // ========== CASO 5: VISUALIZAR FILA ==========
@@ -594,24 +8380,70 @@ int main() {
             // ========== CASO 7: EXIBIR RELATÓRIO ==========
             case 7:
                 limparTela();
-                exibirRelatorio();  // Mostra estatísticas do sistema
+                anotarRastro('R', 0, 0, 0, NULL);
+                exibirRelatorio(&fila);  // Mostra estatísticas do sistema
+                break;
+
+            // ========== CASO 8: EXIBIR MÉTRICAS ==========
+            case 8:
+                limparTela();
+                anotarRastro('M', 0, 0, 0, NULL);
+                imprimirMetricas(&fila);  // Latências, profundidade e tempo de espera
+                break;
+
+            // ========== CASO 9: REFAZER ==========
+            case 9:
+                limparTela();
+                anotarRastro('Y', 0, 0, 0, NULL);
+                refazerComando(&fila, pilha);  // Última ação desfeita
+                break;
+
+            // ========== CASO 10: RETRIAGEM ==========
+            case 10:
+                limparTela();
+                retriarInterativo(&fila);  // Nova prioridade para quem espera
+                break;
+
+            // ========== CASO 11: DESISTÊNCIA ==========
+            case 11:
+                limparTela();
+                desistenciaInterativa(&fila);  // Paciente sai da fila sem atendimento
                 break;
 
             // ========== CASO 0: SAIR ==========
             case 0:
-                printf("\nEncerrando sistema...\n");
-                printf("Limpando memória...\n");
+                if (!semBanners) {
+                    printf("\nEncerrando sistema...\n");
+                    printf("Limpando memória...\n");
+                }
+                gravarMetricasPeriodicas(&fila, 1);
+                encerrarRastro(&fila, pilha);  // Estado final, para a reprodução conferir
+                if (arquivoExportacao != NULL) exportarComResumo(arquivoExportacao, &fila, pilha);
+                // Grava o snapshot final antes de liberar as estruturas
+                if (diario != NULL) {
+                    fecharDiario(diario, &fila, pilha);
+                    diario = NULL;
+                }
                 // Libera TODA a memória alocada dinamicamente
                 destruirFila(&fila);    // Libera fila
                 destruirPilha(pilha);   // Libera pilha
-                printf("Sistema encerrado com sucesso.\n\n");
+                destruirIndiceNomes(nomes); // Libera o índice de busca por nome
+                destruirArmazemNomes(); // Libera os nomes dos pacientes
+                destruirComandos();     // Libera o histórico de desfazer
+                if (!semBanners) printf("Sistema encerrado com sucesso.\n\n");
                 break;
 
             // ========== OPÇÃO INVÁLIDA ==========
             default:
-                printf("ERRO: Opção inválida. Escolha entre 0 e 7.\n");
+                printf("ERRO: Opção inválida. Escolha entre 0 e 11.\n");
         }
 
+        // Torna as alterações desta operação duráveis
+        concluirComandoRastro();
+        if (diario != NULL) confirmarDiario(diario, &fila, pilha);
+        descarregarRastro();
+        if (op != 0) gravarMetricasPeriodicas(&fila, 0);
+
     } while (op != 0);  // Continua até usuário escolher sair
 
     return 0;  // Encerra o programa